@@ -0,0 +1,40 @@
+#!/bin/sh
+
+# Compare the switch and table machine backends on code size and on the
+# benchmark (with an optional corpus size in megabytes). Both are optimized
+# builds. If perf is available, this also prints the instructions per parsed
+# byte, counting the whole benchmark run (including generating the corpora).
+
+set -e # -x
+
+megabytes=${1:-4}
+header="s/^/backend,/"
+
+size optimized_yip.o optimized_table_yip.o
+
+for backend in switch table
+do
+    case $backend in
+    switch) bench=optimized_yip_bench ;;
+    table) bench=optimized_table_yip_bench ;;
+    esac
+    if perf stat -x, -e instructions true 2> /dev/null
+    then
+        perf stat -x, -e instructions -o bench_backends.perf ./$bench $megabytes > bench_backends.output
+        instructions=`grep instructions bench_backends.perf | cut -d, -f1`
+    else
+        ./$bench $megabytes > bench_backends.output
+        instructions=
+    fi
+    sed "1$header;1!s/^/$backend,/" bench_backends.output
+    header=d
+    bytes=`awk -F, '$13 == "ok" { bytes += $4 } END { print bytes + 0 }' bench_backends.output`
+    if [ -n "$instructions" ] && [ "$bytes" -gt 0 ]
+    then
+        echo "$backend: `expr $instructions / $bytes` instructions/byte" >&2
+    fi
+done
+
+rm -rf bench_backends.output bench_backends.perf
+
+true
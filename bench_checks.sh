@@ -0,0 +1,22 @@
+#!/bin/sh
+
+# Compare the cost of the invariant checking levels, running the benchmark
+# (with an optional corpus size in megabytes) linked with each build of yip.o.
+# The optimized build also has no assertions at all.
+
+set -e # -x
+
+megabytes=${1:-4}
+header="s/^/check,/"
+
+for check in optimized off cheap sampled full
+do
+    case $check in
+    optimized) bench=optimized_yip_bench ;;
+    *) bench=check_${check}_yip_bench ;;
+    esac
+    ./$bench $megabytes | sed "1$header;1!s/^/$check,/"
+    header=d
+done
+
+true
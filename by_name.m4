@@ -2,32 +2,42 @@ divert(1)
 /* Productions with no additional arguments. */
 static const MACHINE_BY_NAME machines[] = {
 divert(2)dnl
-    { NULL, NULL }
+    { NULL, NULL, NULL }
 };
 
 /* Productions with N argument. */
 static const MACHINE_BY_NAME machines_with_n[] = {
 divert(3)dnl
-    { NULL, NULL }
+    { NULL, NULL, NULL }
 };
 
 /* Productions with T argument. */
 static const MACHINE_BY_NAME machines_with_t[] = {
 divert(4)dnl
-    { NULL, NULL }
+    { NULL, NULL, NULL }
 };
 
 /* Productions with N and T arguments. */
 static const MACHINE_BY_NAME machines_with_nt[] = {
 divert(5)dnl
-    { NULL, NULL }
+    { NULL, NULL, NULL }
 };
+#if defined(YIP_COUNT_STATS) || defined(YIP_TRACE)
+
+/* Identifiers and names of all the machines, in the order of their generated code. */
+static const YIP_MACHINE_STATS all_machine_stats[] = {
+divert(6)dnl
+    { NULL, NULL, 0 }
+};
+#endif /* YIP_COUNT_STATS || YIP_TRACE */
 divert(-1)
 
 define(`BEGIN_MACHINE', `
 define(`MACHINE_ID', `$2')
 divert(8)dnl
-    { "$3", $2 },
+    { "$3", $2, $2_utf8 },
+divert(5)dnl
+    { "$1", "$3", 0 },
 divert(-1)
 ')
 
@@ -65,13 +75,13 @@ divert(-1)
 ')
 
 define(`WITH_t', `
-divert(4)dnl
+divert(3)dnl
 undivert(8)dnl
 divert(-1)
 ')
 
 define(`WITH_nt', `
-divert(5)dnl
+divert(4)dnl
 undivert(8)dnl
 divert(-1)
 ')
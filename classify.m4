@@ -1,9 +1,12 @@
 divert(-1)
 
 define(`BEGIN_CLASSIFICATION', `
+define(`RANGES_COUNT', 0)
 divert(1)
-/* Mask for a decoded unicode character. */
-static long long int code_mask(int code) {
+#ifdef CLASSIFY_BY_RANGES
+
+/* Mask for a decoded unicode character, using a chain of range tests. */
+static long long int code_mask_by_ranges(int code) {
     if (code == INVALID_CODE) return 0;
     assert(code + 1 >= 0);
     if (code + 1 < numof(low_char_mask)) return low_char_mask[code + 1];
@@ -13,7 +16,48 @@ divert(-1)
 define(`END_CLASSIFICATION', `
 divert(1)dnl
     return 0;
+}
+
+#endif /* CLASSIFY_BY_RANGES */
+
+/* High characters classification trie leaves. Each holds 1 + the class of 256 consecutive characters, or 0. */
+static const unsigned char high_char_leaves[][256] = {
+divert(-1)
+define(`LEAVES_COUNT', 0)
+define(`BLOCK_PREFIX', `')
+divert(3)dnl
+};
+
+/* Index of the classification trie leaf of each block of 256 characters. */
+static const unsigned char high_char_blocks[0x1100] = {
+divert(-1)
+FOR_EACH(0, 4351, `BLOCK_LEAF')
+ifelse(eval(LEAVES_COUNT > 256), 1, `
+errprint(`classify.m4: too many classification trie leaves
+')
+m4exit(1)
+')
+divert(4)dnl
+
+};
+
+/* Mask of each value stored in the classification trie leaves. */
+static const long long int high_char_masks[65] = {
+    0dnl
+divert(-1)
+FOR_EACH(0, 63, `CLASS_MASK')
+divert(4)dnl
+
 };
+
+/* Mask for a decoded unicode character. Costs the same for all characters. */
+static long long int code_mask(int code) {
+    if (code == INVALID_CODE) return 0;
+    assert(code + 1 >= 0);
+    if (code + 1 < numof(low_char_mask)) return low_char_mask[code + 1];
+    if (code >= 0x110000) return 0;
+    return high_char_masks[high_char_leaves[high_char_blocks[code >> 8]][code & 0xFF]];
+}
 divert(-1)
 ')
 
@@ -21,4 +65,65 @@ define(`HIGH_CHAR_RANGE', `
 divert(1)dnl
     if ($2 <= code && code <= $3) return 1ll << $1;
 divert(-1)
+define(`RANGES_COUNT', incr(RANGES_COUNT))
+define(`RANGE_CLASS_'RANGES_COUNT, `$1')
+define(`RANGE_LOW_'RANGES_COUNT, `$2')
+define(`RANGE_HIGH_'RANGES_COUNT, `$3')
+')
+
+define(`FOR_EACH', `ifelse(eval($1 <= $2), 1, `$3($1)`'FOR_EACH(incr($1), $2, `$3')')')
+
+define(`CODE_VALUE', `RANGE_VALUE($1, 1)')
+
+define(`RANGE_VALUE', `ifelse(eval($2 > RANGES_COUNT), 1, 0,
+`ifelse(eval(RANGE_LOW_$2 <= $1 && $1 <= RANGE_HIGH_$2), 1, `incr(RANGE_CLASS_$2)', `RANGE_VALUE($1, incr($2))')')')
+
+define(`BLOCK_KIND', `RANGE_KIND(eval($1 * 256), eval($1 * 256 + 255), 1)')
+
+define(`RANGE_KIND', `ifelse(eval($3 > RANGES_COUNT), 1, `UNIFORM_0',
+`ifelse(eval(RANGE_HIGH_$3 < $1 || $2 < RANGE_LOW_$3), 1, `RANGE_KIND($1, $2, incr($3))',
+`ifelse(eval(RANGE_LOW_$3 <= $1 && $2 <= RANGE_HIGH_$3), 1, `UNIFORM_'incr(RANGE_CLASS_$3), `MIXED')')')')
+
+define(`BLOCK_LEAF', `
+define(`BLOCK_KEY', BLOCK_KIND($1))
+ifelse(BLOCK_KEY, `MIXED', `define(`BLOCK_KEY', `MIXED_$1')')
+ifdef(`LEAF_'BLOCK_KEY, `', `NEW_LEAF($1)')
+divert(3)dnl
+BLOCK_PREFIX`'ifelse(eval($1 % 16), 0, `    ')`'defn(`LEAF_'BLOCK_KEY)`'dnl
+divert(-1)
+define(`BLOCK_PREFIX', ifelse(eval($1 % 16), 15, ``,
+'', ``, ''))
+')
+
+define(`NEW_LEAF', `
+define(`LEAF_'BLOCK_KEY, LEAVES_COUNT)
+define(`LEAVES_COUNT', incr(LEAVES_COUNT))
+divert(2)dnl
+    /* format(`%3d 0x%06x', defn(`LEAF_'BLOCK_KEY), eval($1 * 256)) */ {
+divert(-1)
+ifelse(substr(BLOCK_KEY, 0, 8), `UNIFORM_',
+       `define(`LEAF_VALUE', substr(BLOCK_KEY, 8))FOR_EACH(0, 255, `UNIFORM_VALUE')',
+       `define(`LEAF_BASE', eval($1 * 256))FOR_EACH(0, 255, `MIXED_VALUE')')
+divert(2)dnl
+    },
+divert(-1)
+')
+
+define(`UNIFORM_VALUE', `LEAF_ENTRY($1, LEAF_VALUE)')
+
+define(`MIXED_VALUE', `LEAF_ENTRY($1, CODE_VALUE(eval(LEAF_BASE + $1)))')
+
+define(`LEAF_ENTRY', `
+divert(2)dnl
+ifelse(eval($1 % 16), 0, `       ')`' $2`'ifelse($1, 255, `
+', eval($1 % 16), 15, `,
+', `,')dnl
+divert(-1)
+')
+
+define(`CLASS_MASK', `
+divert(4)dnl
+,
+    1ll << $1`'dnl
+divert(-1)
 ')
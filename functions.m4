@@ -14,9 +14,15 @@ define(`EndEscape', `End_Escape')
 define(`LineFeed', `Line_Feed')
 define(`LineFold', `Line_Fold')
 
+define(`MACHINE_INDEX', 0)
+
 define(`BEGIN_MACHINE', `
 divert(1)dnl
-static RETURN $2(YIP *yip) {
+static RETURN MACHINE_VARIANT($2)(YIP *yip) {
+    ENTER_MACHINE(MACHINE_INDEX);
+#ifdef COMPUTED_GOTO
+    goto dispatch;
+#endif /* COMPUTED_GOTO */
     for (;;) {
         switch (State) {
 divert(-1)
@@ -30,26 +36,45 @@ divert(1)dnl
             return RETURN_ERROR;
         }
     }
+#ifdef COMPUTED_GOTO
+dispatch:
+    {
+        static const void *const states[] = {
+undivert(7)dnl
+        };
+        assert(0 <= State && State < numof(states));
+        goto *states[State];
+    }
+#endif /* COMPUTED_GOTO */
 }
 divert(-1)
+define(`MACHINE_INDEX', incr(MACHINE_INDEX))
 ')
 
 define(`BEGIN_STATE', `
 define(`STATE_INDEX', `$1')
 divert(1)dnl
         case $1:
+divert(7)dnl
+            &&state_$1,
 divert(-1)
 ifelse($1, `0', `
 divert(1)dnl
-            yip_invariant(yip);
+#ifdef COMPUTED_GOTO
+        state_0:
+#endif /* COMPUTED_GOTO */
+            step_invariant(yip);
+            TRACE(YIP_TRACE_STATE, $1);
 divert(-1)
 ', `
 divert(1)dnl
         state_$1:
-            yip_invariant(yip);
+            step_invariant(yip);
+            TRACE(YIP_TRACE_STATE, $1);
 divert(-1)
 ')
 define(`WHEN_DONE', `assert(0);')
+define(`NEXT_CHAR_STATE', `')
 ')
 
 define(`TOKEN_ACTION', `
@@ -104,6 +129,7 @@ TOKEN_ACTION(`unexpected(yip)', `$1')
 
 define(`NEXT_CHAR', `
 TEST_ACTION(`next_char(yip)')
+define(`NEXT_CHAR_STATE', STATE_INDEX)
 ')
 
 define(`PREV_CHAR', `
@@ -111,7 +137,7 @@ VOID_ACTION(`prev_char(yip)')
 ')
 
 define(`NEXT_LINE', `
-VOID_ACTION(`next_line(yip)')
+TEST_ACTION(`next_line(yip)')
 ')
 
 define(`BEGIN_CHOICE', `
@@ -231,27 +257,35 @@ define(`TRANSITION_PREFIX', ` else ')
 define(`BEGIN_CLASSES', `
 define(`IS_ALWAYS', `NO')
 define(`PREFIX', `')
-divert(1)dnl
-TRANSITION_PREFIX`'if (Curr_char->mask & (dnl
-divert(-1)
-define(`TRANSITION_PREFIX', ` else ')
+define(`CLASSES_MASK', `')
 ')
 
 define(`CLASS', `
-divert(1)dnl
-PREFIX`'(1ll << $1)dnl
-divert(-1)
+define(`CLASSES_MASK', defn(`CLASSES_MASK')`'PREFIX`'(1ll << $1))
 define(`PREFIX', ` | ')
 ')
 
 define(`END_CLASSES', `
+ifelse(TRANSITION_PREFIX`'TARGET_STATE, `            'NEXT_CHAR_STATE, `
+SAME_CLASS_RUN
+')
 divert(1)dnl
-)) {
+TRANSITION_PREFIX`'if (Curr->mask & (CLASSES_MASK)) {
 divert(-1)
 GOTO_STATE(`                ')
 divert(1)dnl
             }dnl
 divert(-1)
+define(`TRANSITION_PREFIX', ` else ')
+')
+
+define(`SAME_CLASS_RUN', `
+divert(1)dnl
+            if (next_chars(yip, CLASSES_MASK) < 0) {
+                State = STATE_INDEX;
+                return RETURN_ERROR;
+            }
+divert(-1)
 ')
 
 define(`GOTO_STATE', `
@@ -0,0 +1,182 @@
+divert(1)dnl
+/* {{{ */
+/* Machine tables. */
+divert(-1)
+
+divert(2)dnl
+/* }}} */
+divert(-1)
+
+define(`BeginComment', `Begin_Comment')
+define(`BeginEscape', `Begin_Escape')
+define(`EndComment', `End_Comment')
+define(`EndEscape', `End_Escape')
+define(`LineFeed', `Line_Feed')
+define(`LineFold', `Line_Fold')
+
+define(`MACHINE_INDEX', 0)
+
+define(`BEGIN_MACHINE', `
+define(`MACHINE_ID', `$2')
+define(`TRANSITIONS_COUNT', 0)
+')
+
+define(`END_MACHINE', `
+divert(1)dnl
+
+static const TABLE_TRANSITION MACHINE_ID`'_transitions[] = {
+undivert(3)dnl
+    /* ~ */ { TABLE_ALWAYS, 0, 0 }
+};
+
+static const TABLE_STATE MACHINE_ID`'_states[] = {
+undivert(4)dnl
+};
+
+static const TABLE_MACHINE MACHINE_ID`'_table[1] = { { MACHINE_ID`'_states, MACHINE_ID`'_transitions } };
+
+static RETURN MACHINE_ID`'(YIP *yip) {
+    ENTER_MACHINE(MACHINE_INDEX);
+    return run_table(yip, MACHINE_ID`'_table);
+}
+
+static RETURN MACHINE_ID`'_utf8(YIP *yip) {
+    ENTER_MACHINE(MACHINE_INDEX);
+    return run_table_utf8(yip, MACHINE_ID`'_table);
+}
+divert(-1)
+define(`MACHINE_INDEX', incr(MACHINE_INDEX))
+')
+
+define(`BEGIN_STATE', `
+define(`STATE_INDEX', `$1')
+define(`STATE_ACTION', `TABLE_NO_ACTION, 0, -1')
+define(`NEXT_CHAR_STATE', `')
+define(`FIRST_TRANSITION', TRANSITIONS_COUNT)
+')
+
+define(`ACTION', `
+define(`STATE_ACTION', `$1, ifelse(`$2', `', `0', `$2'), ifelse(`$3', `', `-1', `$3')')
+')
+
+define(`BEGIN_TOKEN', `
+ACTION(`TABLE_BEGIN_TOKEN', `YIP_`'translit($1, `a-z', `A-Z')', `$2')
+')
+
+define(`END_TOKEN', `
+ACTION(`TABLE_END_TOKEN', `YIP_`'translit($1, `a-z', `A-Z')', `$2')
+')
+
+define(`EMPTY_TOKEN', `
+ACTION(`TABLE_EMPTY_TOKEN', `YIP_`'translit($1, `a-z', `A-Z')', `$2')
+')
+
+define(`UNEXPECTED', `
+ACTION(`TABLE_UNEXPECTED', `', `$1')
+')
+
+define(`NEXT_CHAR', `
+ACTION(`TABLE_NEXT_CHAR')
+define(`NEXT_CHAR_STATE', STATE_INDEX)
+')
+
+define(`UNSUPPORTED', `
+errprint(`tables.m4: $1 in 'MACHINE_ID` is not implemented
+')
+m4exit(1)
+')
+
+define(`PREV_CHAR', `
+UNSUPPORTED(`PREV_CHAR')
+')
+
+define(`NEXT_LINE', `
+ACTION(`TABLE_NEXT_LINE')
+')
+
+define(`BEGIN_CHOICE', `
+UNSUPPORTED(`BEGIN_CHOICE')
+')
+
+define(`END_CHOICE', `
+UNSUPPORTED(`END_CHOICE')
+')
+
+define(`COMMIT', `
+ACTION(`TABLE_COMMIT', `CHOICE_`'translit($1, `a-z', `A-Z')', `$2')
+')
+
+define(`RESET_COUNTER', `
+ACTION(`TABLE_RESET_COUNTER')
+')
+
+define(`INCREMENT_COUNTER', `
+ACTION(`TABLE_INCREMENT_COUNTER')
+')
+
+define(`PUSH_STATE', `
+ACTION(`TABLE_PUSH_STATE')
+')
+
+define(`SET_STATE', `
+ACTION(`TABLE_SET_STATE', `', `$1')
+')
+
+define(`POP_STATE', `
+ACTION(`TABLE_POP_STATE', `', `$1')
+')
+
+define(`RESET_STATE', `
+ACTION(`TABLE_RESET_STATE')
+')
+
+define(`END_TRANSITIONS', `
+divert(4)dnl
+    /* STATE_INDEX */ { STATE_ACTION, FIRST_TRANSITION, eval(TRANSITIONS_COUNT - FIRST_TRANSITION) },
+divert(-1)
+')
+
+define(`BEGIN_TRANSITION', `
+define(`TARGET_STATE', `$2')
+define(`TRANSITION_KIND', `TABLE_ALWAYS')
+define(`CLASSES_MASK', `0')
+')
+
+define(`END_TRANSITION', `
+divert(3)dnl
+    /* STATE_INDEX.$1 */ { TRANSITION_KIND, TARGET_STATE, CLASSES_MASK },
+divert(-1)
+define(`TRANSITIONS_COUNT', incr(TRANSITIONS_COUNT))
+')
+
+define(`COUNTER_LESS_THAN_N', `
+define(`TRANSITION_KIND', `TABLE_COUNTER_LESS_THAN_N')
+')
+
+define(`COUNTER_LESS_EQUAL_N', `
+define(`TRANSITION_KIND', `TABLE_COUNTER_LESS_EQUAL_N')
+')
+
+define(`IS_SAME_STATE', `
+define(`TRANSITION_KIND', `TABLE_IS_SAME_STATE')
+')
+
+define(`BEGIN_CLASSES', `
+define(`PREFIX', `')
+define(`CLASSES_MASK', `')
+')
+
+define(`CLASS', `
+define(`CLASSES_MASK', defn(`CLASSES_MASK')`'PREFIX`'(1ll << $1))
+define(`PREFIX', ` | ')
+')
+
+define(`END_CLASSES', `
+ifelse(eval(TRANSITIONS_COUNT == FIRST_TRANSITION), 1, `ifelse(TARGET_STATE, NEXT_CHAR_STATE, `
+define(`TRANSITION_KIND', `TABLE_CLASSES_RUN')
+', `
+define(`TRANSITION_KIND', `TABLE_CLASSES')
+')', `
+define(`TRANSITION_KIND', `TABLE_CLASSES')
+')
+')
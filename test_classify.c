@@ -0,0 +1,57 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Same as in yip.c, which the generated tables rely on. */
+#define numof(ARRAY) (int)(sizeof(ARRAY) / sizeof(ARRAY[0]))
+#define INVALID_CODE  (-1000)
+
+/* Also generate the original chain of range tests for comparison. */
+#define CLASSIFY_BY_RANGES
+
+#include "table.i"
+#include "classify.i"
+
+/* One past the highest unicode character. */
+static const int MAX_CODE = 0x110000;
+
+/* How many times to classify the whole unicode range when timing. */
+static const int ROUNDS = 20;
+
+/* Abort execution with a helpful message. */
+static void die(const char *message, int code) {
+    fprintf(stderr, "test_classify: %s: 0x%06x\n", message, code);
+    exit(1);
+}
+
+/* Verify the trie classifies every character the same as the chain of range
+ * tests. */
+static void test_same() {
+    int code;
+    if (code_mask(INVALID_CODE) != code_mask_by_ranges(INVALID_CODE)) die("mismatch", INVALID_CODE);
+    for (code = -1; code < MAX_CODE; code++)
+        if (code_mask(code) != code_mask_by_ranges(code)) die("mismatch", code);
+}
+
+/* Time classifying the whole unicode range using some classification
+ * function. The sum of masks is returned to keep the compiler honest. */
+static long long int time_mask(const char *name, long long int (*mask)(int)) {
+    long long int sum = 0;
+    clock_t start = clock();
+    double seconds;
+    int round, code;
+    for (round = 0; round < ROUNDS; round++)
+        for (code = -1; code < MAX_CODE; code++)
+            sum += mask(code);
+    seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%-10s %8.3f ns/char\n", name, seconds * 1e9 / ((double)ROUNDS * (MAX_CODE + 1)));
+    return sum;
+}
+
+/* Verify and time both classification methods. */
+int main() {
+    test_same();
+    if (time_mask("ranges", code_mask_by_ranges) != time_mask("trie", code_mask)) die("sum mismatch", 0);
+    return 0;
+}
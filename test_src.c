@@ -1,3 +1,5 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -97,6 +99,53 @@ static void test_source(YIP_SOURCE *source) {
     }
 }
 
+/* Size of the header the counting allocator keeps before each block. */
+#define COUNT_HEADER_SIZE 16
+
+/* Number of bytes allocated by the counting allocator, now and at most. */
+static long counted_size = 0;
+static long max_counted_size = 0;
+
+/* Count an allocated block. */
+static void *count_block(char *block, size_t size) {
+    if (!block) return NULL;
+    *(size_t *)block = size;
+    counted_size += size;
+    if (counted_size > max_counted_size) max_counted_size = counted_size;
+    return block + COUNT_HEADER_SIZE;
+}
+
+/* Allocate memory, counting it. */
+static void *counting_allocate(void *context, size_t size) {
+    (void)context;
+    return count_block(malloc(COUNT_HEADER_SIZE + size), size);
+}
+
+/* Reallocate memory, counting it. */
+static void *counting_reallocate(void *context, void *memory, size_t old_size, size_t new_size) {
+    char *block = memory ? (char *)memory - COUNT_HEADER_SIZE : NULL;
+    (void)context;
+    (void)old_size;
+    if (block) counted_size -= *(size_t *)block;
+    block = realloc(block, COUNT_HEADER_SIZE + new_size);
+    if (!block) {
+        if (memory) counted_size += *(size_t *)((char *)memory - COUNT_HEADER_SIZE);
+        return NULL;
+    }
+    return count_block(block, new_size);
+}
+
+/* Release memory, counting it. */
+static void counting_release(void *context, void *memory) {
+    (void)context;
+    if (!memory) return;
+    counted_size -= *(size_t *)((char *)memory - COUNT_HEADER_SIZE);
+    free((char *)memory - COUNT_HEADER_SIZE);
+}
+
+/* Allocator counting the allocated bytes. */
+static YIP_ALLOCATOR counting_allocator[1] = { { counting_allocate, counting_reallocate, counting_release, NULL, NULL } };
+
 /* Test buffer sources. */
 static void test_buf() {
     YIP_SOURCE *source;
@@ -145,6 +194,51 @@ static void test_fdm() {
     test_source(source);
 }
 
+/* Test mapping file descriptor sources through a small window, so it is moved many times. */
+static void test_fdw() {
+    YIP_SOURCE *source;
+    set_input_fd();
+    source = yip_fd_window_source(input_fd, 1, 8192);
+    if (source == NULL) die("yip_fd_window_source");
+    test_source(source);
+}
+
+/* Test parsing past 4GB, using a sparse file created at the input path. Only the printable character at its end is
+ * written, and parsing starts at an entry just before it, so the source window is moved to offsets which do not fit in an
+ * int (or in 32 bits) without decoding the zero bytes before them. */
+static void test_big() {
+    static const char *END_TEXT = "~";
+    off_t file_size = ((off_t)1 << 32) + 65536;
+    long end_size = strlen(END_TEXT);
+    YIP_PRODUCTION production = { "c-printable", NULL, NULL, NULL };
+    YIP_INDEX_ENTRY entry;
+    const YIP_TOKEN *token;
+    YIP *yip;
+    int fd = open(input_path, O_RDWR|O_CREAT|O_TRUNC|O_BINARY, 0644);
+    if (fd < 0) die("open");
+    if (ftruncate(fd, file_size) < 0) die("ftruncate");
+    if (lseek(fd, file_size - end_size, SEEK_SET) < 0 || write(fd, END_TEXT, end_size) != end_size) die("write");
+    entry.byte_offset = entry.char_offset = file_size - end_size;
+    entry.line = 1;
+    entry.line_char = 0;
+    entry.encoding = YIP_UTF8;
+    entry.code = YIP_BEGIN_DOCUMENT;
+    entry.depth = 0;
+    yip = yip_test_at(yip_fd_window_source(fd, 1, 0), 1, &production, &entry);
+    if (!yip) die("yip_test_at");
+    while ((token = yip_next_token(yip)) && token->code != YIP_DONE) {
+        if (token->byte_offset <= 0xFFFFFFFFL) {
+            fprintf(stderr, "test_src: unexpected byte offset %ld\n", token->byte_offset);
+            exit(1);
+        }
+        if (token->code != YIP_ERROR && write(1, token->buffer->begin, token->buffer->end - token->buffer->begin) < 0)
+            die("write");
+    }
+    if (!token) die("yip_next_token");
+    if (yip_close(yip) < 0) die("yip_close");
+    if (unlink(input_path) < 0) die("unlink");
+}
+
 /* Test "best attempt" file descriptor sources. */
 static void test_fd() {
     YIP_SOURCE *source;
@@ -154,6 +248,79 @@ static void test_fd() {
     test_source(source);
 }
 
+/* Test reading file descriptor sources keeps the buffer bounded by the retained data rather than by the input size. */
+static void test_bound() {
+    static const long MAX_SIZE = 32768;
+    YIP_SOURCE *source;
+    set_input_fd();
+    source = yip_fd_read_source_with_allocator(input_fd, 1, counting_allocator);
+    if (source == NULL) die("yip_fd_read_source_with_allocator");
+    test_source(source);
+    if (max_counted_size > MAX_SIZE || counted_size) {
+        fprintf(stderr, "test_src: allocated %ld bytes, %ld bytes at most\n", counted_size, max_counted_size);
+        exit(1);
+    }
+}
+
+/* Test reading file descriptor sources using an arena allocator. */
+static void test_arena() {
+    YIP_SOURCE *source;
+    YIP_ALLOCATOR *arena = yip_arena_allocator(1000);
+    if (arena == NULL) die("yip_arena_allocator");
+    set_input_fd();
+    source = yip_fd_read_source_with_allocator(input_fd, 1, arena);
+    if (source == NULL) die("yip_fd_read_source_with_allocator");
+    test_source(source);
+    arena->close(arena);
+}
+
+/* Test reading file descriptor sources using an arena allocator, repeatedly growing the buffer to hold much more data
+ * and then releasing it, as happens when a parser looks far ahead. The old copies of the buffer must not pile up. */
+static void test_grow() {
+    static const int MORE_SIZE = 5432;
+    static const long GROW_SIZE = 131072;
+    YIP_SOURCE *source;
+    YIP_ALLOCATOR *arena = yip_arena_allocator(16384);
+    if (arena == NULL) die("yip_arena_allocator");
+    set_input_fd();
+    source = yip_fd_read_source_with_allocator(input_fd, 1, arena);
+    if (source == NULL) die("yip_fd_read_source_with_allocator");
+    for (;;) {
+        int status = source->more(source, MORE_SIZE);
+        long size = source->buffer->end - source->buffer->begin;
+        if (status < 0) die("yip_source_more");
+        if (yip_arena_size(arena) > 2 * GROW_SIZE) {
+            fprintf(stderr, "test_src: arena holds %ld bytes\n", yip_arena_size(arena));
+            exit(1);
+        }
+        if (status == 0 || size >= GROW_SIZE) {
+            if (write(1, source->buffer->begin, size) < 0) die("write");
+            if (source->less(source, size) < 0) die("yip_source_less");
+        }
+        if (status == 0) break;
+    }
+    if (source->close(source) < 0) die("close");
+    arena->close(arena);
+}
+
+/* Test reading file descriptor sources in a background thread. */
+static void test_async() {
+    YIP_SOURCE *source;
+    set_input_fd();
+    source = yip_fd_async_source(input_fd, 1);
+    if (source == NULL) die("yip_fd_async_source");
+    test_source(source);
+}
+
+/* Test decompressing gzip compressed file descriptor sources. */
+static void test_gz() {
+    YIP_SOURCE *source;
+    set_input_fd();
+    source = yip_gzip_source(yip_fd_read_source(input_fd, 1));
+    if (source == NULL) die("yip_gzip_source");
+    test_source(source);
+}
+
 /* Test "best attempt" file path sources. */
 static void test_path() {
     YIP_SOURCE *source = yip_path_source(input_path);
@@ -161,9 +328,78 @@ static void test_path() {
     test_source(source);
 }
 
+/* Test detecting the encoding from each byte order mark, followed by a character so the marks of the 16 and 32 bit
+ * encodings are not confused. The byte order mark token holds the name of the encoding, without its first letter
+ * (which is the token code). */
+static void test_bom() {
+    static const struct { const char *bytes; int size; YIP_ENCODING encoding; } marks[] = {
+        { "\xEF\xBB\xBF" "a",             4, YIP_UTF8    },
+        { "\xFF\xFE" "a\0",               4, YIP_UTF16LE },
+        { "\xFE\xFF" "\0a",               4, YIP_UTF16BE },
+        { "\xFF\xFE\0\0" "a\0\0\0",   8, YIP_UTF32LE },
+        { "\0\0\xFE\xFF" "\0\0\0a",   8, YIP_UTF32BE }
+    };
+    YIP_PRODUCTION production = { "c-byte-order-mark", NULL, NULL, NULL };
+    int index;
+    for (index = 0; index < (int)(sizeof(marks) / sizeof(marks[0])); index++) {
+        const char *name = yip_encoding_name(marks[index].encoding);
+        YIP_SOURCE *source = yip_buffer_source(marks[index].bytes, marks[index].bytes + marks[index].size);
+        YIP *yip = source ? yip_test(source, 1, &production) : NULL;
+        const YIP_TOKEN *token = yip ? yip_next_token(yip) : NULL;
+        if (!token) die("yip_next_token");
+        if (token->code != YIP_BOM || token->code != name[0]
+         || token->buffer->end - token->buffer->begin != (long)strlen(name + 1)
+         || memcmp(token->buffer->begin, name + 1, strlen(name + 1))) {
+            fprintf(stderr, "test_src: byte order mark of %s not detected\n", name);
+            exit(1);
+        }
+        if (yip_close(yip) < 0) die("yip_close");
+    }
+    printf("bom\n");
+}
+
+/* Feed the next input byte to a parser waiting for it, returning whether there was one. */
+static int feed_byte(YIP *yip, const char *input, int *fed) {
+    int size = strlen(input);
+    if (errno != EAGAIN || *fed == size) return 0;
+    if (yip_feed(yip, input + *fed, 1, *fed + 1 == size) < 0) die("yip_feed");
+    ++*fed;
+    return 1;
+}
+
+/* Test skipping a group, both when all the input is available and when it is fed one byte at a time, so the skip is
+ * stopped waiting for input and resumed. */
+static void test_skip() {
+    static const char *INPUT = "\\U0001F600";
+    YIP_PRODUCTION production = { "c-ns-esc-char", NULL, NULL, NULL };
+    const YIP_TOKEN *token;
+    int errors, fed_errors, fed = 0, waits = 0;
+    YIP *yip = yip_test(yip_buffer_source(INPUT, INPUT + strlen(INPUT)), 1, &production);
+    if (!yip || !(token = yip_next_token(yip))) die("yip_next_token");
+    if (token->code != YIP_BEGIN_ESCAPE || !(token = yip_skip_node(yip, &errors)) || token->code != YIP_END_ESCAPE) {
+        fprintf(stderr, "test_src: skipping a group failed\n");
+        exit(1);
+    }
+    if (yip_close(yip) < 0) die("yip_close");
+    yip = yip_test(yip_feed_source(), 1, &production);
+    if (!yip) die("yip_test");
+    while (!(token = yip_next_token(yip)) && feed_byte(yip, INPUT, &fed))
+        ;
+    if (!token) die("yip_next_token");
+    if (token->code == YIP_BEGIN_ESCAPE)
+        while (!(token = yip_skip_node(yip, &fed_errors)) && feed_byte(yip, INPUT, &fed))
+            waits++;
+    if (!token || token->code != YIP_END_ESCAPE || fed_errors != errors || !waits) {
+        fprintf(stderr, "test_src: skipping a fed group failed\n");
+        exit(1);
+    }
+    if (yip_close(yip) < 0) die("yip_close");
+    printf("skip\n");
+}
+
 /* Aborts execution with a helpful message. */
 static void usage() {
-    fprintf(stderr, "Usage: test_src {str|buf|fp|fdr|fdm|fd|path} [path|-]\n");
+    fprintf(stderr, "Usage: test_src {str|buf|fp|fdr|fdm|fdw|big|fd|bound|arena|grow|async|gz|path|bom|skip} [path|-]\n");
     exit(1);
 }
 
@@ -181,10 +417,28 @@ int main(int argc, char *argv[]) {
         test_fdr();
     else if (!strcmp(argv[1], "fdm"))
         test_fdm();
+    else if (!strcmp(argv[1], "fdw"))
+        test_fdw();
+    else if (!strcmp(argv[1], "big"))
+        test_big();
     else if (!strcmp(argv[1], "fd"))
         test_fd();
+    else if (!strcmp(argv[1], "bound"))
+        test_bound();
+    else if (!strcmp(argv[1], "arena"))
+        test_arena();
+    else if (!strcmp(argv[1], "grow"))
+        test_grow();
+    else if (!strcmp(argv[1], "async"))
+        test_async();
+    else if (!strcmp(argv[1], "gz"))
+        test_gz();
     else if (!strcmp(argv[1], "path"))
         test_path();
+    else if (!strcmp(argv[1], "bom"))
+        test_bom();
+    else if (!strcmp(argv[1], "skip"))
+        test_skip();
     else
         usage();
     return 0;
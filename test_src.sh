@@ -2,7 +2,7 @@
 
 set -e # -x
 
-for method in str buf fp fdr fd
+for method in str buf fp fdr fd arena async
 do
     result=`echo "abc" | valgrind -q test_src $method`
     test "$result" = "abc"
@@ -13,20 +13,64 @@ result=`echo "abc" | valgrind -q test_src fdm 2>&1`
 set -e
 test "$result" = "yip_fd_map_source: Illegal seek"
 
+set +e
+result=`echo "abc" | valgrind -q test_src fdw 2>&1`
+set -e
+test "$result" = "yip_fd_window_source: Illegal seek"
+
+result=`valgrind -q test_src big test_src.big`
+test "$result" = "~"
+
+result=`valgrind -q test_src bom`
+test "$result" = "bom"
+
+result=`valgrind -q test_src skip`
+test "$result" = "skip"
+
 yes "The quick brown fox jumps over the lazy dog" | dd of=test_src.input bs=1024 count=1024 2> /dev/null
 
-for method in str buf fp fdr fdm fd path
+for method in str buf fp fdr fdm fdw fd arena grow async path
 do
     valgrind -q test_src $method test_src.input > test_src.output
     cmp -s test_src.input test_src.output
 done
 
-for method in str buf fp fdr fd
+for method in str buf fp fdr fd arena grow async
 do
     cat test_src.input | valgrind -q test_src $method > test_src.output
     cmp -s test_src.input test_src.output
 done
 
-rm -rf test_src.input test_src.output
+yes "The quick brown fox jumps over the lazy dog" | head -c 16777216 > test_src.long.input
+cat test_src.long.input | valgrind -q test_src bound > test_src.output
+cmp -s test_src.long.input test_src.output
+rm -f test_src.long.input
+
+gzip -c test_src.input > test_src.input.gz
+
+# Gzip sources are only compiled by "make YIP_ZLIB=1", which also passes YIP_ZLIB to this script.
+if test -n "$YIP_ZLIB"
+then
+    valgrind -q test_src gz test_src.input.gz > test_src.output
+    cmp -s test_src.input test_src.output
+
+    cat test_src.input.gz | valgrind -q test_src gz > test_src.output
+    cmp -s test_src.input test_src.output
+
+    valgrind -q test_src path test_src.input.gz > test_src.output
+    cmp -s test_src.input test_src.output
+
+    set +e
+    result=`head -c 1000 test_src.input.gz | valgrind -q test_src gz 2>&1 > /dev/null`
+    set -e
+    test "$result" = "yip_source_more: Input/output error"
+else
+    set +e
+    result=`valgrind -q test_src gz test_src.input.gz 2>&1`
+    set -e
+    test "$result" = "yip_gzip_source: Function not implemented"
+fi
+
+rm -rf test_src.input test_src.input.gz test_src.output
 
 true
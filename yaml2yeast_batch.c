@@ -0,0 +1,175 @@
+#define _POSIX_C_SOURCE 200112L
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "yip.h"
+
+/* {{{ */
+
+/* Paths of all the input files to parse. */
+static char **paths = NULL;
+static int paths_count = 0;
+
+/* Index of the next path to parse, and aggregate results; all protected by the mutex. */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static int next_path = 0;
+static int parsed = 0;
+static int unimplemented = 0;
+static long total_bytes = 0;
+static long total_tokens = 0;
+
+/* Abort execution with errno-based message. */
+static void die(const char *where) {
+    perror(where);
+    exit(1);
+}
+
+/* Current wall clock time in seconds. */
+static double now() {
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL) < 0) die("gettimeofday");
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* }}} */
+/* {{{ */
+
+/* Split the next dot-separated part of a file name. */
+static char *next_dot(char *text) {
+    assert(text);
+    assert(*text);
+    while (*text != '.') {
+        text++;
+        if (!*text) {
+            errno = EFAULT;
+            die("next_dot");
+        }
+    }
+    *text++ = '\0';
+    return text;
+}
+
+/* Deduce the tested production from an input file name, as yaml2yeast_test does. */
+static YIP_PRODUCTION parse_file_name(char *file) {
+    YIP_PRODUCTION production = { file, NULL, NULL, NULL };
+    char *text = next_dot(file);
+    if (!strncmp(text, "n=", 2)) {
+        production.n = text + 2;
+        text = next_dot(text + 2);
+    }
+    if (!strncmp(text, "c=", 2)) {
+        production.c = text + 2;
+        text = next_dot(text + 2);
+    }
+    if (!strncmp(text, "t=", 2)) {
+        production.t = text + 2;
+        text = next_dot(text + 2);
+    }
+    return production;
+}
+
+/* Parse a single input file, discarding the tokens. */
+static void parse_path(const char *path) {
+    const char *base = strrchr(path, '/');
+    char *file = malloc(strlen(base ? base + 1 : path) + 1);
+    YIP_SOURCE *source = yip_path_source(path);
+    long bytes = 0;
+    long tokens = 0;
+    if (!file) die("malloc");
+    strcpy(file, base ? base + 1 : path);
+    if (!source) die(path);
+    else {
+        YIP_PRODUCTION production = parse_file_name(file);
+        YIP *yip = yip_test(source, 1, &production);
+        if (!yip) {
+            free(file);
+            pthread_mutex_lock(&mutex);
+            unimplemented++;
+            pthread_mutex_unlock(&mutex);
+            return;
+        }
+        for (;;) {
+            const YIP_TOKEN *token = yip_next_token(yip);
+            if (!token) die(path);
+            tokens++;
+            if (token->code == YIP_DONE) {
+                bytes = token->byte_offset;
+                break;
+            }
+        }
+        if (yip_close(yip) < 0) die(path);
+    }
+    free(file);
+    pthread_mutex_lock(&mutex);
+    parsed++;
+    total_bytes += bytes;
+    total_tokens += tokens;
+    pthread_mutex_unlock(&mutex);
+}
+
+/* Worker thread: parse paths until none are left. */
+static void *parse_paths(void *data) {
+    (void)data;
+    for (;;) {
+        int index;
+        pthread_mutex_lock(&mutex);
+        index = next_path++;
+        pthread_mutex_unlock(&mutex);
+        if (index >= paths_count) return NULL;
+        parse_path(paths[index]);
+    }
+}
+
+/* Collect all the input files in a directory. */
+static void collect_directory_paths(const char *path) {
+    DIR *dir = opendir(path);
+    struct dirent *entry;
+    if (!dir) die(path);
+    while ((entry = readdir(dir))) {
+        const char *file = entry->d_name;
+        if (*file == '.' || strlen(file) < 6 || strcmp(file + strlen(file) - 6, ".input")) continue;
+        paths = realloc(paths, (paths_count + 1) * sizeof(*paths));
+        if (!paths) die("realloc");
+        paths[paths_count] = malloc(strlen(path) + strlen(file) + 2);
+        if (!paths[paths_count]) die("malloc");
+        sprintf(paths[paths_count++], "%s/%s", path, file);
+    }
+    if (errno || closedir(dir) < 0) die(path);
+}
+
+/* Aborts execution with a helpful message. */
+static void usage() {
+    fprintf(stderr, "Usage: yaml2yeast_batch threads directory...\n");
+    exit(1);
+}
+
+/* Parse all the input files in the directories using several threads, and report the aggregate throughput. */
+int main(int argc, char *argv[]) {
+    int threads_count, i;
+    pthread_t *threads;
+    double start, seconds;
+    if (argc < 3 || (threads_count = atoi(argv[1])) <= 0) usage();
+    for (i = 2; i < argc; i++) collect_directory_paths(argv[i]);
+    threads = malloc(threads_count * sizeof(*threads));
+    if (!threads) die("malloc");
+    start = now();
+    for (i = 0; i < threads_count; i++)
+        if ((errno = pthread_create(threads + i, NULL, parse_paths, NULL))) die("pthread_create");
+    for (i = 0; i < threads_count; i++)
+        if ((errno = pthread_join(threads[i], NULL))) die("pthread_join");
+    seconds = now() - start;
+    printf("Threads %d, files %d, parsed %d, not implemented %d, bytes %ld, tokens %ld, seconds %.3f, MB/s %.3f\n",
+           threads_count, paths_count, parsed, unimplemented, total_bytes, total_tokens, seconds,
+           seconds > 0 ? total_bytes / seconds / 1e6 : 0.0);
+    for (i = 0; i < paths_count; i++) free(paths[i]);
+    free(paths);
+    free(threads);
+    return 0;
+}
+
+/* }}} */
@@ -85,8 +85,13 @@ static void run_test_file(YIP *yip, char *path) {
     }
     for (;;) {
         const YIP_TOKEN *token = yip_next_token(yip);
+        long line, line_char;
         if (token->code == YIP_DONE) break;
-        fprintf(error_fp, "# B: %ld, C: %ld, L: %ld, c: %ld\n", token->byte_offset, token->char_offset, token->line, token->line_char);
+        if (yip_token_position(yip, token, &line, &line_char, NULL) < 0) {
+            perror(path);
+            exit(1);
+        }
+        fprintf(error_fp, "# B: %ld, C: %ld, L: %ld, c: %ld\n", token->byte_offset, token->char_offset, line, line_char);
         fputc(token->code, error_fp);
         if (token->buffer->begin) {
             unsigned const char *begin = token->buffer->begin;
@@ -20,17 +20,106 @@
  * IN THE SOFTWARE.
  */
 
+#define _POSIX_C_SOURCE 200112L
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#ifndef YIP_NO_THREADS
+#   include <pthread.h>
+#endif /* YIP_NO_THREADS */
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
+#ifdef YIP_ZLIB
+#   include <zlib.h>
+#endif /* YIP_ZLIB */
+#ifdef YIP_ZSTD
+#   include <zstd.h>
+#endif /* YIP_ZSTD */
 #include "yip.h"
 
+/* Vector instructions used for scanning runs of ASCII characters, if available. */
+#if defined(__AVX2__) || defined(__SSSE3__)
+#   include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#   include <arm_neon.h>
+#endif
+
+/* Force inlining of functions specialized by constant arguments, if possible. */
+#if defined(__GNUC__)
+#   define ALWAYS_INLINE __inline__ __attribute__((always_inline))
+#else
+#   define ALWAYS_INLINE
+#endif
+
+/* Resume generated machines by jumping directly to the state (labels as values), if possible. */
+#if defined(__GNUC__) && !defined(YIP_NO_COMPUTED_GOTO)
+#   define COMPUTED_GOTO
+#endif
+
+/* Count runtime statistics only if asked to, so they cost nothing otherwise. */
+#ifdef YIP_COUNT_STATS
+#   define COUNT(MEMBER, AMOUNT) (Stats->MEMBER += (AMOUNT))
+#   define COUNT_MAX(MEMBER, VALUE) ((VALUE) > Stats->MEMBER ? (void)(Stats->MEMBER = (VALUE)) : (void)0)
+#   define COUNT_MACHINE(INDEX) (Machine_stats[INDEX].entries++)
+#else
+#   define COUNT(MEMBER, AMOUNT) ((void)0)
+#   define COUNT_MAX(MEMBER, VALUE) ((void)0)
+#   define COUNT_MACHINE(INDEX) ((void)0)
+#endif /* YIP_COUNT_STATS */
+
+/* Record trace events only if asked to, both when compiling and when parsing. */
+#ifdef YIP_TRACE
+#   define TRACE(KIND, VALUE) (Trace_events ? trace_event(yip, KIND, VALUE) : (void)0)
+#   define TRACE_MACHINE(INDEX) (Trace_machine = (INDEX), TRACE(YIP_TRACE_ENTER, 0))
+#else
+#   define TRACE(KIND, VALUE) ((void)0)
+#   define TRACE_MACHINE(INDEX) ((void)0)
+#endif /* YIP_TRACE */
+
+/* Check parser invariants at the level asked for: not at all, only O(1) checks of the top of the stacks, walking all the
+ * stacks, or the O(1) checks walking all the stacks once every YIP_CHECK_SAMPLE machine steps. Unless asked otherwise,
+ * do the full checks, or none if NDEBUG is defined. */
+#define YIP_CHECK_OFF 0
+#define YIP_CHECK_CHEAP 1
+#define YIP_CHECK_FULL 2
+#define YIP_CHECK_SAMPLED 3
+#ifndef YIP_CHECK_LEVEL
+#   ifdef NDEBUG
+#       define YIP_CHECK_LEVEL YIP_CHECK_OFF
+#   else
+#       define YIP_CHECK_LEVEL YIP_CHECK_FULL
+#   endif /* NDEBUG */
+#endif /* YIP_CHECK_LEVEL */
+#ifndef YIP_CHECK_SAMPLE
+#   define YIP_CHECK_SAMPLE 1024
+#endif /* YIP_CHECK_SAMPLE */
+
+/* Count and trace entering a generated machine. */
+#define ENTER_MACHINE(INDEX) (COUNT_MACHINE(INDEX), TRACE_MACHINE(INDEX))
+
+/* Trace time stamps use the CPU cycle counter if possible, calibrated against the CPU time when dumped. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define TRACE_TICKS() ((unsigned long long)__builtin_ia32_rdtsc())
+#   define TRACE_CYCLES
+#else
+#   define TRACE_TICKS() ((unsigned long long)clock())
+#endif
+
+/* Track the position of characters in their line, unless lines are computed on demand from an index of line starts. */
+#ifdef YIP_LAZY_POSITIONS
+#   define ADVANCE_LINE_CHAR(CHARACTER, AMOUNT) ((void)0)
+#else
+#   define ADVANCE_LINE_CHAR(CHARACTER, AMOUNT) ((CHARACTER)->line_char += (AMOUNT))
+#endif /* YIP_LAZY_POSITIONS */
+
 /* Isn't it lovely we all speak the same language? */
 #ifndef O_BINARY
 #   define O_BINARY 0
@@ -54,10 +143,214 @@
 
 /* Buffers: */
 
+/* Allocate memory using malloc. */
+static void *default_allocate(void *context, size_t size) {
+    (void)context;
+    return malloc(size);
+}
+
+/* Reallocate memory using realloc. */
+static void *default_reallocate(void *context, void *memory, size_t old_size, size_t new_size) {
+    (void)context;
+    (void)old_size;
+    return realloc(memory, new_size);
+}
+
+/* Release memory using free. */
+static void default_release(void *context, void *memory) {
+    (void)context;
+    free(memory);
+}
+
+/* Allocator used when none is specified. */
+static YIP_ALLOCATOR default_allocator[1] = { { default_allocate, default_reallocate, default_release, NULL, NULL } };
+
+/* Returns the allocator to actually use. */
+static YIP_ALLOCATOR *allocator_or_default(YIP_ALLOCATOR *allocator) {
+    return allocator ? allocator : default_allocator;
+}
+
+/* Allocate zeroed memory using an allocator. */
+static void *allocate_zero(YIP_ALLOCATOR *allocator, size_t size) {
+    void *memory = allocator->allocate(allocator->context, size);
+    if (memory) memset(memory, 0, size);
+    return memory;
+}
+
+/* Alignment of all arena blocks. Sufficient for any standard type. */
+#define ARENA_ALIGNMENT 16
+
+/* Round a size up to the arena alignment. */
+#define arena_align(SIZE) (((SIZE) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT)
+
+/* Default arena chunk size. */
+static const size_t ARENA_CHUNK_SIZE = 65536;
+
+/* Chunk of arena memory. The blocks follow the (aligned) header. */
+typedef struct ARENA_CHUNK {
+    struct ARENA_CHUNK *next;   /* Previously allocated chunk. */
+    size_t size;                /* Size of the blocks area. */
+    size_t used;                /* Used size of the blocks area. */
+    size_t last;                /* Offset of the last allocated block. */
+} ARENA_CHUNK;
+
+/* Block larger than a chunk, allocated on its own so it can be resized and released. The block follows the (aligned)
+ * header. */
+typedef struct ARENA_LARGE {
+    struct ARENA_LARGE *prev;   /* Previous large block, or NULL. */
+    struct ARENA_LARGE *next;   /* Next large block, or NULL. */
+    size_t size;                /* Size of the block. */
+} ARENA_LARGE;
+
+/* Arena allocator. */
+typedef struct ARENA {
+    YIP_ALLOCATOR common[1];    /* Common members. */
+    ARENA_CHUNK *chunks;        /* Most recently allocated chunk. */
+    ARENA_LARGE *large;         /* Most recently allocated large block. */
+    size_t chunk_size;          /* Size of the blocks area of the chunks. */
+} ARENA;
+
+/* Address of a block in an arena chunk. */
+#define arena_block(CHUNK, OFFSET) ((char *)(CHUNK) + arena_align(sizeof(ARENA_CHUNK)) + (OFFSET))
+
+/* Address of a large arena block, and the header of a large arena block. */
+#define arena_large_block(LARGE) ((char *)(LARGE) + arena_align(sizeof(ARENA_LARGE)))
+#define arena_large_header(MEMORY) ((ARENA_LARGE *)((char *)(MEMORY) - arena_align(sizeof(ARENA_LARGE))))
+
+/* Whether a block of some size is a large arena block. */
+#define is_arena_large(ARENA, SIZE) (arena_align(SIZE) > (ARENA)->chunk_size)
+
+/* {{{ */
+
+/* Link a large arena block into the list of large blocks, at its (possibly new) address. */
+static void *arena_link_large(ARENA *arena, ARENA_LARGE *large) {
+    if (large->prev) large->prev->next = large;
+    else             arena->large = large;
+    if (large->next) large->next->prev = large;
+    return arena_large_block(large);
+}
+
+/* Allocate a large arena block. */
+static void *arena_allocate_large(ARENA *arena, size_t size) {
+    ARENA_LARGE *large = malloc(arena_align(sizeof(ARENA_LARGE)) + size);
+    if (!large) return NULL;
+    large->prev = NULL;
+    large->next = arena->large;
+    large->size = size;
+    return arena_link_large(arena, large);
+}
+
+/* Release a large arena block. */
+static void arena_release_large(ARENA *arena, ARENA_LARGE *large) {
+    if (large->prev) large->prev->next = large->next;
+    else             arena->large = large->next;
+    if (large->next) large->next->prev = large->prev;
+    free(large);
+}
+
+/* Allocate a block from an arena. Blocks larger than a chunk are allocated on their own. */
+static void *arena_allocate(void *context, size_t size) {
+    ARENA *arena = context;
+    ARENA_CHUNK *chunk = arena->chunks;
+    if (is_arena_large(arena, size)) return arena_allocate_large(arena, size);
+    size = arena_align(size);
+    if (!chunk || chunk->size - chunk->used < size) {
+        chunk = malloc(arena_align(sizeof(ARENA_CHUNK)) + arena->chunk_size);
+        if (!chunk) return NULL;
+        chunk->size = arena->chunk_size;
+        chunk->used = 0;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    chunk->last = chunk->used;
+    chunk->used += size;
+    return arena_block(chunk, chunk->last);
+}
+
+/* Reallocate a block from an arena. Large blocks are resized using realloc, and the last allocated block of a chunk is
+ * resized in place if possible. Other blocks are copied, so growing a block wastes at most a chunk's worth of memory
+ * before it becomes a large block. */
+static void *arena_reallocate(void *context, void *memory, size_t old_size, size_t new_size) {
+    ARENA *arena = context;
+    ARENA_CHUNK *chunk = arena->chunks;
+    void *new_memory;
+    if (!memory) return arena_allocate(context, new_size);
+    if (is_arena_large(arena, old_size) && is_arena_large(arena, new_size)) {
+        ARENA_LARGE *large = realloc(arena_large_header(memory), arena_align(sizeof(ARENA_LARGE)) + new_size);
+        if (!large) return NULL;
+        large->size = new_size;
+        return arena_link_large(arena, large);
+    }
+    if (!is_arena_large(arena, old_size) && !is_arena_large(arena, new_size)
+     && chunk && memory == arena_block(chunk, chunk->last) && chunk->size - chunk->last >= arena_align(new_size)) {
+        chunk->used = chunk->last + arena_align(new_size);
+        return memory;
+    }
+    new_memory = arena_allocate(context, new_size);
+    if (!new_memory) return NULL;
+    memcpy(new_memory, memory, old_size < new_size ? old_size : new_size);
+    if (is_arena_large(arena, old_size)) arena_release_large(arena, arena_large_header(memory));
+    return new_memory;
+}
+
+/* Release a block from an arena. Only large blocks are actually released; the memory of other blocks is released when
+ * the whole arena is closed. */
+static void arena_release(void *context, void *memory) {
+    ARENA *arena = context;
+    ARENA_LARGE *large;
+    for (large = arena->large; large; large = large->next)
+        if (arena_large_block(large) == memory) {
+            arena_release_large(arena, large);
+            return;
+        }
+}
+
+/* Release an arena and all the memory allocated from it. */
+static void arena_close(YIP_ALLOCATOR *allocator) {
+    ARENA *arena = (ARENA *)allocator;
+    while (arena->chunks) {
+        ARENA_CHUNK *chunk = arena->chunks;
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+    while (arena->large) arena_release_large(arena, arena->large);
+    free(arena);
+}
+
+/* Return the number of bytes held by an arena. */
+long yip_arena_size(const YIP_ALLOCATOR *allocator) {
+    const ARENA *arena = (const ARENA *)allocator;
+    const ARENA_CHUNK *chunk;
+    const ARENA_LARGE *large;
+    long size = 0;
+    if (!allocator || allocator->allocate != arena_allocate) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (chunk = arena->chunks; chunk; chunk = chunk->next) size += arena_align(sizeof(ARENA_CHUNK)) + chunk->size;
+    for (large = arena->large; large; large = large->next) size += arena_align(sizeof(ARENA_LARGE)) + large->size;
+    return size;
+}
+
+/* Return new arena allocator. */
+YIP_ALLOCATOR *yip_arena_allocator(size_t chunk_size) {
+    ARENA *arena = calloc(1, sizeof(*arena));
+    if (!arena) return NULL;
+    arena->common->allocate = arena_allocate;
+    arena->common->reallocate = arena_reallocate;
+    arena->common->release = arena_release;
+    arena->common->close = arena_close;
+    arena->common->context = arena;
+    arena->chunk_size = arena_align(chunk_size ? chunk_size : ARENA_CHUNK_SIZE);
+    return arena->common;
+}
+
+/* }}} */
+
 /* Byte sources: */
 
 /* Return the offset beyond the last available byte of the source. */
-static int end_offset(YIP_SOURCE *source) {
+static long end_offset(YIP_SOURCE *source) {
     return source->byte_offset + size_of(source->buffer);
 }
 
@@ -154,6 +447,7 @@ static const int DYNAMIC_BUFFER_SIZE = 8192;
 /* Dynamic buffered byte source. */
 typedef struct DYNAMIC_SOURCE {
     YIP_SOURCE common[1];       /* Common members. */
+    YIP_ALLOCATOR *allocator;   /* Allocator of physical buffer (and source). */
     long size;                  /* Size of physical buffer. */
     const unsigned char *base;  /* Base of physical buffer. */
 } DYNAMIC_SOURCE;
@@ -163,6 +457,7 @@ typedef struct DYNAMIC_SOURCE {
 /* Returns cast dynamic buffered byte source. Also asserts invariant always held by dynamic buffered byte sources. */
 static DYNAMIC_SOURCE *dynamic_invariant(const YIP_SOURCE *common) {
     DYNAMIC_SOURCE *source = (DYNAMIC_SOURCE *)source_invariant(common);
+    assert(source->allocator);
     if (!common->buffer->begin) {
         assert(!source->base);
         assert(!source->size);
@@ -181,17 +476,32 @@ static int dynamic_more(YIP_SOURCE *common, int size) {
         return -1;
     } else {
         DYNAMIC_SOURCE *source = dynamic_invariant(common);
+        long data_size = size_of(common->buffer);
+        long gap_size = common->buffer->begin - source->base;
         long used_size = common->buffer->end - source->base;
         long need_size = used_size + size;
+        /* Tricky: move data to start of buffer if it fits in the released gap, instead of growing the buffer.
+         * This allows using the faster memcpy (no overlap), ensures linear run-time costs (each copied byte is matched
+         * by at least one released byte) and keeps the buffer size bounded by the amount of retained data. */
+        if (need_size > source->size && gap_size && gap_size >= data_size) {
+            memcpy((void *)source->base, common->buffer->begin, data_size);
+            common->buffer->begin = source->base;
+            common->buffer->end = source->base + data_size;
+            gap_size = 0;
+            used_size = data_size;
+            need_size = used_size + size;
+        }
         if (need_size <= source->size) {
             dynamic_invariant(common);
             return size;
         } else {
-            long gap_size = common->buffer->begin - source->base;
             long need_buffers = (need_size + DYNAMIC_BUFFER_SIZE - 1) / DYNAMIC_BUFFER_SIZE;
-            source->size = need_buffers * DYNAMIC_BUFFER_SIZE;
-            source->base = realloc((void *)source->base, source->size);
-            if (!source->base) return -1;
+            long new_size = need_buffers * DYNAMIC_BUFFER_SIZE;
+            void *base = source->allocator->reallocate(source->allocator->context, (void *)source->base,
+                                                       source->size, new_size);
+            if (!base) return -1;
+            source->base = base;
+            source->size = new_size;
             common->buffer->begin = source->base + gap_size;
             common->buffer->end = source->base + used_size;
             dynamic_invariant(common);
@@ -214,19 +524,29 @@ static int dynamic_less(YIP_SOURCE *common, int size) {
         }
         common->buffer->begin += size;
         common->byte_offset += size;
-        data_size -= size;
-        /* Tricky: move data to start of buffer if it fits in the gap.
-         * This allows using the faster memcpy (no overlap) and also ensures linear run-time costs. */
-        if (common->buffer->begin - source->base >= data_size) {
-            memcpy((void *)source->base, common->buffer->begin, data_size);
-            common->buffer->begin = source->base;
-            common->buffer->end = common->buffer->begin + data_size;
-        }
+        /* Moving the remaining data is deferred to dynamic_more, and only done if there is no room for new data. */
+        if (size == data_size) common->buffer->begin = common->buffer->end = source->base;
         dynamic_invariant(common);
         return size;
     }
 }
 
+/* Release a dynamic buffered byte source. */
+static void dynamic_release(DYNAMIC_SOURCE *source) {
+    YIP_ALLOCATOR *allocator = source->allocator;
+    allocator->release(allocator->context, (void *)source->base);
+    allocator->release(allocator->context, source);
+}
+
+/* Allocate a dynamic buffered byte source of some size. */
+static DYNAMIC_SOURCE *dynamic_allocate(size_t size, YIP_ALLOCATOR *allocator) {
+    DYNAMIC_SOURCE *source;
+    allocator = allocator_or_default(allocator);
+    source = allocate_zero(allocator, size);
+    if (source) source->allocator = allocator;
+    return source;
+}
+
 /* }}} */
 
 /* STDIO byte source. Is an extension of a dynamic buffered data source. */
@@ -268,8 +588,7 @@ static int fp_close(YIP_SOURCE *common) {
         FP_READ_SOURCE *source = fp_invariant(common);
         FILE *fp = source->fp;
         int to_close = source->to_close;
-        free((void *)source->dynamic->base);
-        free(source);
+        dynamic_release(source->dynamic);
         if (to_close) return fclose(fp);
         return 0;
     }
@@ -277,9 +596,14 @@ static int fp_close(YIP_SOURCE *common) {
 
 /* Return new fp read buffered byte source. */
 YIP_SOURCE *yip_fp_source(FILE *fp, int to_close) {
+    return yip_fp_source_with_allocator(fp, to_close, NULL);
+}
+
+/* Return new fp read buffered byte source using an allocator. */
+YIP_SOURCE *yip_fp_source_with_allocator(FILE *fp, int to_close, YIP_ALLOCATOR *allocator) {
     if (!fp) return yip_buffer_source(NULL, NULL);
     else {
-        FP_READ_SOURCE *source = calloc(1, sizeof(*source));
+        FP_READ_SOURCE *source = (FP_READ_SOURCE *)dynamic_allocate(sizeof(*source), allocator);
         if (!source) return NULL;
         else {
             YIP_SOURCE *common = source->dynamic->common;
@@ -335,8 +659,7 @@ static int fd_read_close(YIP_SOURCE *common) {
         FD_READ_SOURCE *source = fd_read_invariant(common);
         int fd = source->fd;
         int to_close = source->to_close;
-        free((void *)source->dynamic->base);
-        free(source);
+        dynamic_release(source->dynamic);
         if (to_close) return close(fd);
         return 0;
     }
@@ -344,9 +667,14 @@ static int fd_read_close(YIP_SOURCE *common) {
 
 /* Return new fd read buffered byte source. */
 YIP_SOURCE *yip_fd_read_source(int fd, int to_close) {
+    return yip_fd_read_source_with_allocator(fd, to_close, NULL);
+}
+
+/* Return new fd read buffered byte source using an allocator. */
+YIP_SOURCE *yip_fd_read_source_with_allocator(int fd, int to_close, YIP_ALLOCATOR *allocator) {
     if (fd < 0) return yip_buffer_source(NULL, NULL);
     else {
-        FD_READ_SOURCE *source = calloc(1, sizeof(*source));
+        FD_READ_SOURCE *source = (FD_READ_SOURCE *)dynamic_allocate(sizeof(*source), allocator);
         if (!source) return NULL;
         else {
             YIP_SOURCE *common = source->dynamic->common;
@@ -363,6 +691,216 @@ YIP_SOURCE *yip_fd_read_source(int fd, int to_close) {
 
 /* }}} */
 
+#ifndef YIP_NO_THREADS
+
+/* Number of chunks an async source reads ahead into. */
+#define ASYNC_CHUNKS 3
+
+/* Size of each read ahead chunk, and therefore the largest single read. */
+static const int ASYNC_CHUNK_SIZE = 256 * 1024;
+
+/* A chunk of bytes read ahead by the reader thread of an async source. */
+typedef struct ASYNC_CHUNK {
+    unsigned char *data;        /* Chunk bytes (ASYNC_CHUNK_SIZE are allocated). */
+    int size;                   /* Number of bytes read into the chunk. */
+    int used;                   /* Number of bytes already moved into the source buffer. */
+} ASYNC_CHUNK;
+
+/* Read ahead UNIX I/O byte source. Is an extension of a dynamic buffered data source. A reader thread fills a ring of
+ * chunks, and more() only copies from a filled chunk, so reading overlaps parsing. The filled chunks belong to more(),
+ * the rest to the reader thread; the mutex only protects the hand over. */
+typedef struct FD_ASYNC_SOURCE {
+    DYNAMIC_SOURCE dynamic[1];  /* Dynamic byte source members. */
+    int fd;                     /* File descriptor to read from. */
+    int to_close;               /* Whether to automatically close fd. */
+    pthread_t thread;           /* Reader thread. */
+    pthread_mutex_t mutex;      /* Protects the hand over of chunks. */
+    pthread_cond_t changed;     /* Signaled when a chunk was filled or emptied. */
+    ASYNC_CHUNK chunks[ASYNC_CHUNKS]; /* Ring of read ahead chunks. */
+    int filled_count;           /* Number of filled chunks (protected). */
+    int is_done;                /* Whether the reader reached EOF or failed (protected). */
+    int read_errno;             /* Error of the failed read, or zero (protected). */
+    int next_read;              /* Index of the next chunk to read into (reader only). */
+    int read_size;              /* Size of the next read, adapted to the throughput (reader only). */
+    int next_more;              /* Index of the next chunk to copy from (more only). */
+    int is_taken;               /* Whether more() holds a filled chunk (more only). */
+} FD_ASYNC_SOURCE;
+
+/* {{{ */
+
+/* Returns cast fd async byte source. Also asserts invariant always held by fd async buffered byte sources. */
+static FD_ASYNC_SOURCE *fd_async_invariant(const YIP_SOURCE *common) {
+    FD_ASYNC_SOURCE *source = (FD_ASYNC_SOURCE *)dynamic_invariant(common);
+    assert(source->fd >= 0);
+    assert(0 <= source->next_more && source->next_more < ASYNC_CHUNKS);
+    if (source->is_taken) {
+        assert(source->chunks[source->next_more].used < source->chunks[source->next_more].size);
+    }
+    return source;
+}
+
+/* Release the mutex of an async source if the reader thread is cancelled while waiting. */
+static void fd_async_unlock(void *mutex) {
+    pthread_mutex_unlock((pthread_mutex_t *)mutex);
+}
+
+/* Reader thread of an async source. Reads grow while they fill the whole request, and shrink when they return much
+ * less, so fast sources are read in few large reads and slow pipes hand over what they have as soon as possible. */
+static void *fd_async_reader(void *data) {
+    FD_ASYNC_SOURCE *source = (FD_ASYNC_SOURCE *)data;
+    for (;;) {
+        ASYNC_CHUNK *chunk = source->chunks + source->next_read;
+        int size;
+        pthread_mutex_lock(&source->mutex);
+        pthread_cleanup_push(fd_async_unlock, &source->mutex);
+        while (source->filled_count == ASYNC_CHUNKS) pthread_cond_wait(&source->changed, &source->mutex);
+        pthread_cleanup_pop(1);
+        do size = read(source->fd, chunk->data, source->read_size);
+        while (size < 0 && errno == EINTR);
+        pthread_mutex_lock(&source->mutex);
+        if (size <= 0) {
+            source->is_done = 1;
+            source->read_errno = size < 0 ? errno : 0;
+        } else {
+            chunk->size = size;
+            chunk->used = 0;
+            source->filled_count++;
+            source->next_read = (source->next_read + 1) % ASYNC_CHUNKS;
+            if (size == source->read_size && 2 * source->read_size <= ASYNC_CHUNK_SIZE) source->read_size *= 2;
+            else if (2 * size < source->read_size && source->read_size > DYNAMIC_BUFFER_SIZE) source->read_size /= 2;
+        }
+        pthread_cond_signal(&source->changed);
+        pthread_mutex_unlock(&source->mutex);
+        if (size <= 0) return NULL;
+    }
+}
+
+/* Request more bytes for an fd async buffered byte source. This only blocks if the reader thread has not read ahead. */
+static int fd_async_more(YIP_SOURCE *common, int size) {
+    size = dynamic_more(common, size);
+    if (size < 0) return -1;
+    else {
+        FD_ASYNC_SOURCE *source = fd_async_invariant(common);
+        ASYNC_CHUNK *chunk = source->chunks + source->next_more;
+        if (!source->is_taken) {
+            pthread_mutex_lock(&source->mutex);
+            while (!source->filled_count && !source->is_done)
+                pthread_cond_wait(&source->changed, &source->mutex);
+            source->is_taken = source->filled_count > 0;
+            pthread_mutex_unlock(&source->mutex);
+            if (!source->is_taken) {
+                if (!source->read_errno) return 0;
+                errno = source->read_errno;
+                return -1;
+            }
+        }
+        if (size > chunk->size - chunk->used) size = chunk->size - chunk->used;
+        memcpy((void *)common->buffer->end, chunk->data + chunk->used, size);
+        common->buffer->end += size;
+        chunk->used += size;
+        if (chunk->used == chunk->size) {
+            source->is_taken = 0;
+            source->next_more = (source->next_more + 1) % ASYNC_CHUNKS;
+            pthread_mutex_lock(&source->mutex);
+            source->filled_count--;
+            pthread_cond_signal(&source->changed);
+            pthread_mutex_unlock(&source->mutex);
+        }
+        fd_async_invariant(common);
+        return size;
+    }
+}
+
+/* Release all the resources of an fd async buffered byte source, except for the file descriptor. */
+static void fd_async_release(FD_ASYNC_SOURCE *source, int has_thread) {
+    YIP_ALLOCATOR *allocator = source->dynamic->allocator;
+    int index;
+    if (has_thread) {
+        pthread_cancel(source->thread);
+        pthread_join(source->thread, NULL);
+        pthread_cond_destroy(&source->changed);
+        pthread_mutex_destroy(&source->mutex);
+    }
+    for (index = 0; index < ASYNC_CHUNKS; index++)
+        if (source->chunks[index].data) allocator->release(allocator->context, source->chunks[index].data);
+    dynamic_release(source->dynamic);
+}
+
+/* Close fd async buffered byte source. */
+static int fd_async_close(YIP_SOURCE *common) {
+    if (!common) {
+        errno = EINVAL;
+        return -1;
+    } else {
+        FD_ASYNC_SOURCE *source = fd_async_invariant(common);
+        int fd = source->fd;
+        int to_close = source->to_close;
+        fd_async_release(source, 1);
+        if (to_close) return close(fd);
+        return 0;
+    }
+}
+
+/* }}} */
+
+#endif /* YIP_NO_THREADS */
+
+/* Return new fd async buffered byte source. */
+YIP_SOURCE *yip_fd_async_source(int fd, int to_close) {
+    return yip_fd_async_source_with_allocator(fd, to_close, NULL);
+}
+
+/* Return new fd async buffered byte source using an allocator. */
+YIP_SOURCE *yip_fd_async_source_with_allocator(int fd, int to_close, YIP_ALLOCATOR *allocator) {
+#ifndef YIP_NO_THREADS
+    if (fd < 0) return yip_buffer_source(NULL, NULL);
+    else {
+        FD_ASYNC_SOURCE *source = (FD_ASYNC_SOURCE *)dynamic_allocate(sizeof(*source), allocator);
+        int index;
+        if (!source) return NULL;
+        for (index = 0; index < ASYNC_CHUNKS; index++) {
+            source->chunks[index].data = source->dynamic->allocator->allocate(source->dynamic->allocator->context,
+                                                                              ASYNC_CHUNK_SIZE);
+            if (!source->chunks[index].data) {
+                fd_async_release(source, 0);
+                return NULL;
+            }
+        }
+        source->fd = fd;
+        source->to_close = to_close;
+        source->read_size = DYNAMIC_BUFFER_SIZE;
+        if ((errno = pthread_mutex_init(&source->mutex, NULL))) {
+            fd_async_release(source, 0);
+            return NULL;
+        }
+        if ((errno = pthread_cond_init(&source->changed, NULL))) {
+            pthread_mutex_destroy(&source->mutex);
+            fd_async_release(source, 0);
+            return NULL;
+        }
+        if ((errno = pthread_create(&source->thread, NULL, fd_async_reader, source))) {
+            pthread_cond_destroy(&source->changed);
+            pthread_mutex_destroy(&source->mutex);
+            fd_async_release(source, 0);
+            return NULL;
+        } else {
+            YIP_SOURCE *common = source->dynamic->common;
+            common->more = fd_async_more;
+            common->less = dynamic_less;
+            common->close = fd_async_close;
+            assert(fd_async_invariant(common) == source);
+            return common;
+        }
+    }
+#else
+    (void)fd;
+    (void)to_close;
+    (void)allocator;
+    errno = ENOSYS;
+    return NULL;
+#endif /* YIP_NO_THREADS */
+}
+
 /* UNIX mmap byte source. Is an extension of a static buffered data source. */
 typedef struct FD_MMAP_SOURCE {
     YIP_SOURCE common[1];       /* Common members. */
@@ -429,1040 +967,3515 @@ YIP_SOURCE *yip_fd_map_source(int fd, int to_close) {
     }
 }
 
-/* Return new fd buffered byte source using mmap or read. */
-YIP_SOURCE *yip_fd_source(int fd, int to_close) {
-    int saved_errno = errno;
-    YIP_SOURCE *source = yip_fd_map_source(fd, to_close);
-    if (source) return source;
-    errno = saved_errno;
-    return yip_fd_read_source(fd, to_close);
-}
+/* Default size of the file window mapped ahead of the parser. */
+static const long WINDOW_SIZE = 64L * 1024 * 1024;
 
-/* Return new path buffered byte source using mmap or read. */
-YIP_SOURCE *yip_path_source(const char *path) {
-    if (!path) return yip_buffer_source(NULL, NULL);
-    if (!strcmp(path, "-")) return yip_fd_source(0, 0);
-    else {
-        int fd = open(path, O_RDONLY|O_BINARY);
-        return yip_fd_source(fd, 1);
+/* Released bytes are only unmapped once there are at least this many, to keep the system calls few. */
+static const long WINDOW_RELEASE_SIZE = 1024L * 1024;
+
+/* Maximal size of the file window, so the bytes added by fd_window_more fit in its int result even when rounded up to
+ * whole pages. */
+static const long MAX_WINDOW_SIZE = INT_MAX / 2 + 1;
+
+/* Files larger than this are parsed through a window by yip_fd_source instead of being mapped whole. */
+static const long WINDOW_FILE_SIZE = 1024L * 1024 * 1024;
+
+/* UNIX windowed mmap byte source. Only the retained bytes and a window ahead of them are mapped. The mapping is
+ * replaced by a larger one reaching further ahead when more bytes are requested, and released pages at its start are
+ * unmapped, so resident memory is bounded by the lookahead rather than the file size. */
+typedef struct FD_WINDOW_SOURCE {
+    YIP_SOURCE common[1];       /* Common members. */
+    int fd;                     /* File descriptor to read from. */
+    int to_close;               /* Whether to automatically close fd. */
+    off_t file_size;            /* Size of the whole file. */
+    long window_size;           /* Number of bytes to map ahead (multiple of pages). */
+    long page_size;             /* Size of a memory page. */
+    const unsigned char *base;  /* Start of the mapped bytes, or NULL if none are mapped. */
+    off_t map_offset;           /* File offset of the mapped bytes (multiple of pages). */
+    long map_size;              /* Number of mapped bytes. */
+} FD_WINDOW_SOURCE;
+
+/* {{{ */
+
+/* Returns cast fd window byte source. Also asserts invariant always held by fd window buffered byte sources. */
+static FD_WINDOW_SOURCE *fd_window_invariant(const YIP_SOURCE *common) {
+    FD_WINDOW_SOURCE *source = (FD_WINDOW_SOURCE *)source_invariant(common);
+    assert(source->fd >= 0);
+    assert(source->window_size > 0 && !(source->window_size % source->page_size));
+    assert(!(source->map_offset % source->page_size));
+    if (source->base) {
+        assert(source->map_offset <= common->byte_offset);
+        assert(common->buffer->begin == source->base + (common->byte_offset - source->map_offset));
+        assert(common->buffer->end <= source->base + source->map_size);
     }
+    assert(common->byte_offset + size_of(common->buffer) <= source->file_size);
+    return source;
 }
 
-/* Name of each UTF encoding. */
-static const char *encoding_names[] = {
-    "UTF-8", "UTF-16LE", "UTF-16BE", "UTF-32LE", "UTF-32BE"
-};
+/* Map a new window covering the retained bytes and at least "size" more, and unmap the old one. */
+static int fd_window_map(FD_WINDOW_SOURCE *source, long size) {
+    YIP_SOURCE *common = source->common;
+    off_t end_offset = common->byte_offset + size_of(common->buffer);
+    off_t map_offset = common->byte_offset - common->byte_offset % source->page_size;
+    off_t map_end = end_offset + (size > source->window_size ? size : source->window_size);
+    long data_size = size_of(common->buffer);
+    long map_size, fresh_offset;
+    void *base;
+    if (map_end > source->file_size) map_end = source->file_size;
+    map_size = map_end - map_offset;
+    base = mmap(NULL, map_size, PROT_READ, MAP_SHARED, source->fd, map_offset);
+    if (base == MAP_FAILED) return -1;
+    /* The hints are only an optimization, so their failure is ignored. */
+    fresh_offset = end_offset - map_offset;
+    fresh_offset -= fresh_offset % source->page_size;
+    posix_madvise(base, map_size, POSIX_MADV_SEQUENTIAL);
+    posix_madvise((char *)base + fresh_offset, map_size - fresh_offset, POSIX_MADV_WILLNEED);
+    if (source->map_size && munmap((void *)source->base, source->map_size) < 0) {
+        munmap(base, map_size);
+        return -1;
+    }
+    source->base = base;
+    source->map_offset = map_offset;
+    source->map_size = map_size;
+    common->buffer->begin = source->base + (common->byte_offset - map_offset);
+    common->buffer->end = common->buffer->begin + data_size;
+    return 0;
+}
 
-/* Returns name of the encoding (e.g. "UTF8"). */
-const char *yip_encoding_name(YIP_ENCODING encoding) {
-    if (encoding < 0 || numof(encoding_names) <= encoding) {
+/* Request more bytes for an fd window byte source. All the mapped bytes are always exposed, so this maps a further
+ * window. */
+static int fd_window_more(YIP_SOURCE *common, int size) {
+    if (!common || size < 0) {
         errno = EINVAL;
-        return NULL;
+        return -1;
+    } else {
+        FD_WINDOW_SOURCE *source = fd_window_invariant(common);
+        long added;
+        if (common->byte_offset + size_of(common->buffer) == source->file_size || !size) return 0;
+        if (fd_window_map(source, size) < 0) return -1;
+        added = source->base + source->map_size - common->buffer->end;
+        common->buffer->end += added;
+        fd_window_invariant(common);
+        return added;
     }
-    return encoding_names[encoding];
 }
 
-/* Deduce the encoding based on the first few input bytes */
-static int detect_encoding(YIP_SOURCE *source) {
-    if (source->more(source, 4) < 0) return -1;
+/* Release bytes from an fd window byte source, unmapping the pages before them. */
+static int fd_window_less(YIP_SOURCE *common, int size) {
+    if (buffer_less(common, size) < 0) return -1;
     else {
-        unsigned char byte_0    = (size_of(source->buffer) > 0 ? source->buffer->begin[0] : 0xAA);
-        unsigned char byte_1    = (size_of(source->buffer) > 1 ? source->buffer->begin[1] : 0xAA);
-        unsigned char byte_2    = (size_of(source->buffer) > 2 ? source->buffer->begin[2] : 0xAA);
-        unsigned char byte_3    = (size_of(source->buffer) > 3 ? source->buffer->begin[3] : 0xAA);
-        unsigned long byte_01   = (byte_0 << 8)  |  byte_1;
-        unsigned long byte_012  = (byte_0 << 16) | (byte_1 << 8)  |  byte_2;
-        unsigned long byte_123  =                  (byte_1 << 16) | (byte_2 << 8) | byte_3;
-        unsigned long byte_0123 = (byte_0 << 24) | (byte_1 << 16) | (byte_2 << 8) | byte_3;
-        if (byte_0123 == 0x0000FEFF) return YIP_UTF32BE;
-        if (byte_012  == 0x000000  ) return YIP_UTF32BE;
-        if (byte_0123 == 0xFFFE0000) return YIP_UTF32LE;
-        if ( byte_123 ==   0x000000) return YIP_UTF32LE;
-        if (byte_01   == 0xFEFF    ) return YIP_UTF16BE;
-        if (byte_0    == 0x00      ) return YIP_UTF16BE;
-        if (byte_01   == 0xFFFE    ) return YIP_UTF16LE;
-        if ( byte_1   ==   0x00    ) return YIP_UTF16BE;
-        if (byte_012  == 0xEFBBBF  ) return YIP_UTF8;
-        else                         return YIP_UTF8;
+        FD_WINDOW_SOURCE *source = (FD_WINDOW_SOURCE *)common;
+        long release_size = source->base ? common->buffer->begin - source->base : 0;
+        release_size -= release_size % source->page_size;
+        if (release_size >= WINDOW_RELEASE_SIZE) {
+            if (munmap((void *)source->base, release_size) < 0) return -1;
+            source->base += release_size;
+            source->map_offset += release_size;
+            source->map_size -= release_size;
+        }
+        fd_window_invariant(common);
+        return size;
     }
 }
 
-/* Returns type of a YEAST token code. */
-YIP_CODE_TYPE yip_code_type(YIP_CODE code) {
-    switch (code) {
-    case YIP_BEGIN_ALIAS:
-    case YIP_BEGIN_ANCHOR:
-    case YIP_BEGIN_COMMENT:
-    case YIP_BEGIN_DIRECTIVE:
-    case YIP_BEGIN_DOCUMENT:
-    case YIP_BEGIN_ESCAPE:
-    case YIP_BEGIN_HANDLE:
-    case YIP_BEGIN_MAPPING:
-    case YIP_BEGIN_NODE:
-    case YIP_BEGIN_PAIR:
-    case YIP_BEGIN_PROPERTIES:
-    case YIP_BEGIN_SCALAR:
-    case YIP_BEGIN_SEQUENCE:
-    case YIP_BEGIN_TAG:
-        return YIP_BEGIN;
-    case YIP_END_ALIAS:
-    case YIP_END_ANCHOR:
-    case YIP_END_COMMENT:
-    case YIP_END_DIRECTIVE:
-    case YIP_END_DOCUMENT:
-    case YIP_END_ESCAPE:
-    case YIP_END_HANDLE:
-    case YIP_END_MAPPING:
-    case YIP_END_NODE:
-    case YIP_END_PAIR:
-    case YIP_END_PROPERTIES:
-    case YIP_END_SCALAR:
-    case YIP_END_SEQUENCE:
-    case YIP_END_TAG:
-        return YIP_END;
-    case YIP_BREAK:
-    case YIP_DOCUMENT_END:
-    case YIP_DOCUMENT_START:
-    case YIP_INDENT:
-    case YIP_INDICATOR:
-    case YIP_LINE_FEED:
-    case YIP_LINE_FOLD:
-    case YIP_META:
-    case YIP_TEXT:
-    case YIP_UNPARSED:
-    case YIP_WHITE:
-        return YIP_MATCH;
-    case YIP_BOM:
-    case YIP_COMMENT:
-    case YIP_DONE:
-    case YIP_ERROR:
-        return YIP_FAKE;
-    default:
+/* Close fd window byte source. */
+static int fd_window_close(YIP_SOURCE *common) {
+    if (!common) {
         errno = EINVAL;
         return -1;
+    } else {
+        FD_WINDOW_SOURCE *source = fd_window_invariant(common);
+        int fd = source->fd;
+        int to_close = source->to_close;
+        int status = source->map_size ? munmap((void *)source->base, source->map_size) : 0;
+        free(source);
+        if (to_close && close(fd) < 0) return -1;
+        return status;
     }
 }
 
-/* Returns the paired token code. */
-YIP_CODE yip_code_pair(YIP_CODE code) {
-    switch (code) {
-    case YIP_BEGIN_ALIAS:       return YIP_END_ALIAS;
-    case YIP_BEGIN_ANCHOR:      return YIP_END_ANCHOR;
-    case YIP_BEGIN_COMMENT:     return YIP_END_COMMENT;
-    case YIP_BEGIN_DIRECTIVE:   return YIP_END_DIRECTIVE;
-    case YIP_BEGIN_DOCUMENT:    return YIP_END_DOCUMENT;
-    case YIP_BEGIN_ESCAPE:      return YIP_END_ESCAPE;
-    case YIP_BEGIN_HANDLE:      return YIP_END_HANDLE;
-    case YIP_BEGIN_MAPPING:     return YIP_END_MAPPING;
-    case YIP_BEGIN_NODE:        return YIP_END_NODE;
-    case YIP_BEGIN_PAIR:        return YIP_END_PAIR;
-    case YIP_BEGIN_PROPERTIES:  return YIP_END_PROPERTIES;
-    case YIP_BEGIN_SCALAR:      return YIP_END_SCALAR;
-    case YIP_BEGIN_SEQUENCE:    return YIP_END_SEQUENCE;
-    case YIP_BEGIN_TAG:         return YIP_END_TAG;
-    case YIP_END_ALIAS:         return YIP_BEGIN_ALIAS;
-    case YIP_END_ANCHOR:        return YIP_BEGIN_ANCHOR;
-    case YIP_END_COMMENT:       return YIP_BEGIN_COMMENT;
-    case YIP_END_DIRECTIVE:     return YIP_BEGIN_DIRECTIVE;
-    case YIP_END_DOCUMENT:      return YIP_BEGIN_DOCUMENT;
-    case YIP_END_ESCAPE:        return YIP_BEGIN_ESCAPE;
-    case YIP_END_HANDLE:        return YIP_BEGIN_HANDLE;
-    case YIP_END_MAPPING:       return YIP_BEGIN_MAPPING;
-    case YIP_END_NODE:          return YIP_BEGIN_NODE;
-    case YIP_END_PAIR:          return YIP_BEGIN_PAIR;
-    case YIP_END_PROPERTIES:    return YIP_BEGIN_PROPERTIES;
-    case YIP_END_SCALAR:        return YIP_BEGIN_SCALAR;
-    case YIP_END_SEQUENCE:      return YIP_BEGIN_SEQUENCE;
-    case YIP_END_TAG:           return YIP_BEGIN_TAG;
-    default:
+/* }}} */
+
+/* Return new fd window byte source. */
+YIP_SOURCE *yip_fd_window_source(int fd, int to_close, long window_size) {
+    if (window_size > MAX_WINDOW_SIZE) {
+        errno = EINVAL;
+        return NULL;
+    } else if (fd < 0) return yip_buffer_source(NULL, NULL);
+    else {
+        off_t size = lseek(fd, 0, SEEK_END);
+        if (size < 0) return NULL;
+        else {
+            FD_WINDOW_SOURCE *source = calloc(1, sizeof(*source));
+            if (!source) return NULL;
+            else {
+                YIP_SOURCE *common = source->common;
+                common->more = fd_window_more;
+                common->less = fd_window_less;
+                common->close = fd_window_close;
+                source->fd = fd;
+                source->to_close = to_close;
+                source->file_size = size;
+                source->page_size = sysconf(_SC_PAGESIZE);
+                if (window_size <= 0) window_size = WINDOW_SIZE;
+                source->window_size = (window_size + source->page_size - 1) / source->page_size * source->page_size;
+                if (size && fd_window_map(source, 0) < 0) {
+                    free(source);
+                    return NULL;
+                }
+                if (size) common->buffer->end = source->base + source->map_size;
+                assert(fd_window_invariant(common) == source);
+                return common;
+            }
+        }
+    }
+}
+
+/* Pushed bytes source. Is an extension of a dynamic buffered data source. */
+typedef struct FEED_SOURCE {
+    DYNAMIC_SOURCE dynamic[1];  /* Dynamic byte source members. */
+    int is_last;                /* Whether the last bytes were fed. */
+} FEED_SOURCE;
+
+/* {{{ */
+
+/* Returns cast feed byte source. Also asserts invariant always held by feed buffered byte sources. */
+static FEED_SOURCE *feed_invariant(const YIP_SOURCE *common) {
+    FEED_SOURCE *source = (FEED_SOURCE *)dynamic_invariant(common);
+    assert(source->is_last == 0 || source->is_last == 1);
+    return source;
+}
+
+/* Request more bytes for a feed buffered byte source. Bytes are only added by feeding them, so until the last bytes
+ * were fed, this fails with EAGAIN. */
+static int feed_more(YIP_SOURCE *common, int size) {
+    if (!common || size < 0) {
+        errno = EINVAL;
+        return -1;
+    } else {
+        FEED_SOURCE *source = feed_invariant(common);
+        if (source->is_last) return 0;
+        errno = EAGAIN;
+        return -1;
+    }
+}
+
+/* Append bytes to a feed buffered byte source. */
+static int feed_bytes(YIP_SOURCE *common, const void *bytes, int size, int is_last) {
+    FEED_SOURCE *source = feed_invariant(common);
+    if (source->is_last || size < 0 || (size && !bytes)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (size) {
+        if (dynamic_more(common, size) < 0) return -1;
+        memcpy((void *)common->buffer->end, bytes, size);
+        common->buffer->end += size;
+    }
+    source->is_last = !!is_last;
+    feed_invariant(common);
+    return 0;
+}
+
+/* Close feed buffered byte source. */
+static int feed_close(YIP_SOURCE *common) {
+    if (!common) {
         errno = EINVAL;
         return -1;
+    } else {
+        FEED_SOURCE *source = feed_invariant(common);
+        dynamic_release(source->dynamic);
+        return 0;
+    }
+}
+
+/* Return new feed buffered byte source. */
+YIP_SOURCE *yip_feed_source(void) {
+    return yip_feed_source_with_allocator(NULL);
+}
+
+/* Return new feed buffered byte source using an allocator. */
+YIP_SOURCE *yip_feed_source_with_allocator(YIP_ALLOCATOR *allocator) {
+    FEED_SOURCE *source = (FEED_SOURCE *)dynamic_allocate(sizeof(*source), allocator);
+    if (!source) return NULL;
+    else {
+        YIP_SOURCE *common = source->dynamic->common;
+        common->more = feed_more;
+        common->less = dynamic_less;
+        common->close = feed_close;
+        assert(feed_invariant(common) == source);
+        return common;
     }
 }
 
 /* }}} */
 
-/* Typed stack. */
-#define TYPEDEF_STACK(TYPE, NAME) \
-typedef struct NAME { \
-    TYPE *begin;  /* Pointer to bottom of stack. */ \
-    TYPE *end;    /* Pointer beyond last allocated member. */ \
-    TYPE *top;    /* Pointer to top element of stack or NULL. */ \
-} NAME
+#if defined(YIP_ZLIB) || defined(YIP_ZSTD)
 
-/* Stack element function. */
-typedef void (*STACK_FUNCTION)(void *data, void *element);
+/* Number of compressed bytes to ask for at a time. */
+static const int COMPRESSED_READ_SIZE = 65536;
 
-/* Size of element in a typed stack. */
-#define STACK_TYPE_SIZE(STACK) sizeof(*(STACK)->begin)
+/* Decompressing byte source. Is an extension of a dynamic buffered data source, and wraps a source of compressed bytes.
+ * Each compression format provides a step function which decompresses as much of the available compressed bytes as
+ * fits in the room made for the decompressed bytes. */
+typedef struct DECOMPRESS_SOURCE {
+    DYNAMIC_SOURCE dynamic[1];  /* Dynamic byte source members. */
+    YIP_SOURCE *compressed;     /* Source of compressed bytes. */
+    int is_frame_end;           /* Whether the compressed bytes so far end at the end of a frame (gzip member etc.). */
+    int (*step)(struct DECOMPRESS_SOURCE *source, unsigned char *out, long *out_size,
+                const unsigned char *in, long *in_size);
+                                /* Decompress bytes, updating sizes to the amounts produced and consumed. Returns
+                                 * whether the bytes ended a frame, or -1 on error. */
+    int (*release)(struct DECOMPRESS_SOURCE *source);
+                                /* Release the format-specific decompression state. */
+} DECOMPRESS_SOURCE;
 
-/* Number of used elements in a (typed) stack. */
-#define depth_of(STACK) (1 + (STACK)->top - (STACK)->begin)
+/* {{{ */
 
-/* Offset of top element in a stack. */
-#define top_offset(STACK) ((char *)(STACK)->top - (char *)(STACK)->begin)
+/* Returns cast decompressing byte source. Also asserts invariant always held by decompressing byte sources. */
+static DECOMPRESS_SOURCE *decompress_invariant(const YIP_SOURCE *common) {
+    DECOMPRESS_SOURCE *source = (DECOMPRESS_SOURCE *)dynamic_invariant(common);
+    source_invariant(source->compressed);
+    assert(source->is_frame_end == 0 || source->is_frame_end == 1);
+    assert(source->step);
+    assert(source->release);
+    return source;
+}
 
-/* Untyped stack for generic code. */
-TYPEDEF_STACK(void, VOID_STACK);
+/* Request more bytes for a decompressing byte source. Compressed bytes are only fetched when decompression can't make
+ * progress without them, and are released from the compressed source as soon as they are consumed. */
+static int decompress_more(YIP_SOURCE *common, int size) {
+    size = dynamic_more(common, size);
+    if (size <= 0) return size;
+    else {
+        DECOMPRESS_SOURCE *source = decompress_invariant(common);
+        YIP_SOURCE *compressed = source->compressed;
+        for (;;) {
+            long in_size = size_of(compressed->buffer);
+            long out_size = size;
+            /* Even without compressed bytes, there may be pending decompressed bytes, unless a frame just ended. */
+            if (in_size || !source->is_frame_end) {
+                int is_frame_end = source->step(source, (unsigned char *)common->buffer->end, &out_size,
+                                                compressed->buffer->begin, &in_size);
+                if (is_frame_end < 0) return -1;
+                if (in_size && compressed->less(compressed, in_size) < 0) return -1;
+                source->is_frame_end = is_frame_end;
+                if (out_size) {
+                    common->buffer->end += out_size;
+                    decompress_invariant(common);
+                    return out_size;
+                }
+                if (in_size) continue;
+            }
+            in_size = compressed->more(compressed, COMPRESSED_READ_SIZE);
+            if (in_size < 0) return -1;
+            if (!in_size) {
+                if (source->is_frame_end && !size_of(compressed->buffer)) return 0;
+                /* Truncated input, or trailing bytes which are not a frame. */
+                errno = EIO;
+                return -1;
+            }
+        }
+    }
+}
 
-/* Apply function to all stack elements. */
-#define stack_apply(STACK, FUNCTION, DATA) \
-    generic_stack_apply((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK), (STACK_FUNCTION)(FUNCTION), (void *)(DATA))
-static void generic_stack_apply(const VOID_STACK *stack, size_t type_size, STACK_FUNCTION function, void *data) {
-    void *element = stack->begin;
-    while (element <= stack->top) {
-        function(data, element);
-        element += type_size;
+/* Close decompressing byte source. This also closes the compressed source. */
+static int decompress_close(YIP_SOURCE *common) {
+    if (!common) {
+        errno = EINVAL;
+        return -1;
+    } else {
+        DECOMPRESS_SOURCE *source = decompress_invariant(common);
+        YIP_SOURCE *compressed = source->compressed;
+        int status = source->release(source);
+        dynamic_release(source->dynamic);
+        if (compressed->close(compressed) < 0) return -1;
+        return status;
     }
 }
 
-/* Asserts invariant always held by stacks. */
-#define stack_invariant(STACK, INVARIANT, DATA) \
-    generic_stack_invariant((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK), (STACK_FUNCTION)(INVARIANT), (void *)(DATA))
-static void generic_stack_invariant(const VOID_STACK *stack, size_t type_size, STACK_FUNCTION invariant, void *data) {
-    assert(stack);
-    assert(type_size > 0);
-    assert(stack->begin);
-    assert(stack->end);
-    assert(stack->top);
-    assert(stack->begin <= stack->top);
-    assert(stack->top < stack->end);
-    assert(!(size_of(stack) % type_size));
-    assert(!(top_offset(stack) % type_size));
-    if (invariant) generic_stack_apply(stack, type_size, invariant, data);
-    else           assert(!data);
+/* Allocate a decompressing byte source of some size, taking ownership of the compressed source. */
+static DECOMPRESS_SOURCE *decompress_allocate(size_t size, YIP_SOURCE *compressed, YIP_ALLOCATOR *allocator) {
+    DECOMPRESS_SOURCE *source;
+    if (!compressed) return NULL;
+    source = (DECOMPRESS_SOURCE *)dynamic_allocate(size, allocator);
+    if (!source) {
+        int saved_errno = errno;
+        compressed->close(compressed);
+        errno = saved_errno;
+        return NULL;
+    } else {
+        YIP_SOURCE *common = source->dynamic->common;
+        common->more = decompress_more;
+        common->less = dynamic_less;
+        common->close = decompress_close;
+        source->compressed = compressed;
+        return source;
+    }
 }
 
-/* Initialize a stack with one allocated element. Returns 0 or -1 with errno. */
-#define stack_init(STACK, SIZE) \
-    generic_stack_init((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK), (SIZE))
-static int generic_stack_init(VOID_STACK *stack, size_t type_size, int init_size) {
-    assert(init_size > 0);
-    size_t size = init_size * type_size;
-    stack->begin = malloc(size);
-    if (!stack->begin) return -1;
-    stack->end = stack->begin + size;
-    stack->top = stack->begin;
-    generic_stack_invariant(stack, type_size, NULL, NULL);
-    return 0;
+/* Give up on a decompressing byte source whose format-specific state could not be created. */
+static YIP_SOURCE *decompress_abort(DECOMPRESS_SOURCE *source, int error) {
+    YIP_SOURCE *compressed = source->compressed;
+    dynamic_release(source->dynamic);
+    compressed->close(compressed);
+    errno = error;
+    return NULL;
 }
 
-/* Release all resources used by a stack. */
-#define stack_close(STACK) \
-    generic_stack_close((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK))
-static void generic_stack_close(VOID_STACK *stack, size_t type_size) {
-    generic_stack_invariant(stack, type_size, NULL, NULL);
-    free(stack->begin);
+/* }}} */
+
+#endif /* YIP_ZLIB || YIP_ZSTD */
+
+#ifdef YIP_ZLIB
+
+/* Gzip (or zlib) decompressing byte source. Is an extension of a decompressing byte source. */
+typedef struct GZIP_SOURCE {
+    DECOMPRESS_SOURCE decompress[1];    /* Decompressing byte source members. */
+    z_stream stream[1];                 /* Inflation state. */
+} GZIP_SOURCE;
+
+/* {{{ */
+
+/* Allocate inflation state using the source allocator. */
+static voidpf gzip_allocate(voidpf opaque, uInt items, uInt size) {
+    YIP_ALLOCATOR *allocator = opaque;
+    return allocator->allocate(allocator->context, (size_t)items * size);
 }
 
-/* Allocate space for a new uninitialized top element. Return 0 or -1 with errno. */
-#define stack_push(STACK) \
-    generic_stack_push((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK))
-static int generic_stack_push(VOID_STACK *stack, size_t type_size) {
-    generic_stack_invariant(stack, type_size, NULL, NULL);
-    stack->top += type_size;
-    if (stack->top == stack->end) {
-        int size = size_of(stack);
-        stack->begin = realloc(stack->begin, 2 * size);
-        if (!stack->begin) return -1;
-        stack->top = stack->begin + size;
-        stack->end = stack->begin + 2 * size;
+/* Release inflation state using the source allocator. */
+static void gzip_release_memory(voidpf opaque, voidpf memory) {
+    YIP_ALLOCATOR *allocator = opaque;
+    allocator->release(allocator->context, memory);
+}
+
+/* Inflate gzip bytes. A gzip file may contain several members, which are simply concatenated. */
+static int gzip_step(DECOMPRESS_SOURCE *common, unsigned char *out, long *out_size,
+                     const unsigned char *in, long *in_size) {
+    GZIP_SOURCE *source = (GZIP_SOURCE *)common;
+    int status;
+    if (common->is_frame_end && *in_size && inflateReset(source->stream) != Z_OK) {
+        errno = EIO;
+        return -1;
     }
-    generic_stack_invariant(stack, type_size, NULL, NULL);
-    return 0;
+    source->stream->next_in = (Bytef *)in;
+    source->stream->avail_in = *in_size;
+    source->stream->next_out = out;
+    source->stream->avail_out = *out_size;
+    status = inflate(source->stream, Z_NO_FLUSH);
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) {
+        errno = status == Z_MEM_ERROR ? ENOMEM : EIO;
+        return -1;
+    }
+    *in_size -= source->stream->avail_in;
+    *out_size -= source->stream->avail_out;
+    return status == Z_STREAM_END;
 }
 
-/* Release top element. Must not release the bottom-most element. */
-#define stack_pop(STACK) \
-    generic_stack_pop((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK))
-static void generic_stack_pop(VOID_STACK *stack, size_t type_size) {
-    generic_stack_invariant(stack, type_size, NULL, NULL);
-    assert(top_offset(stack) >= 0);
-    stack->top -= type_size;
-    generic_stack_invariant(stack, type_size, NULL, NULL);
+/* Release inflation state. */
+static int gzip_release(DECOMPRESS_SOURCE *common) {
+    GZIP_SOURCE *source = (GZIP_SOURCE *)common;
+    inflateEnd(source->stream);
+    return 0;
 }
 
-/* Release bottom elements. Must not release the top-most element.
-#define stack_shift(STACK, ELEMENTS) \
-    generic_stack_shift((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK), ELEMENTS)
-static void generic_stack_shift(VOID_STACK *stack, size_t type_size, int elements) {
-    int shift_size = elements * type_size;
-    int tail_size = top_offset(stack) + type_size - shift_size;
-    generic_stack_invariant(stack, type_size, NULL, NULL);
-    assert(shift_size >= 0);
-    assert(shift_size >= type_size);
-    assert(!(shift_size % type_size));
-    assert(!(tail_size % type_size));
-    memmove(stack->begin, stack->begin + shift_size, tail_size);
-    stack->top = stack->begin + tail_size - type_size;
-    generic_stack_invariant(stack, type_size, NULL, NULL);
-} */
+/* }}} */
 
-/* Return from an action/machine invocation. */
-typedef enum RETURN {
-    RETURN_ERROR = -1,  /* Unexpected error aborted action execution. */
-    RETURN_DONE = 0,    /* Completed action execution created no token(s) to be returned to called. */
-    RETURN_TOKEN = 1    /* Completed action execution created token(s) to be returned to caller. */
-} RETURN;
+#endif /* YIP_ZLIB */
 
-/* Choice points. */
-typedef enum CHOICE {
-    CHOICE_ESCAPE,  /* Escape sequences top level choice point. */
-    CHOICE_ESCAPED  /* Escape sequences nested choice point. */
-} CHOICE;
+/* Return new gzip decompressing byte source. */
+YIP_SOURCE *yip_gzip_source(YIP_SOURCE *compressed) {
+    return yip_gzip_source_with_allocator(compressed, NULL);
+}
 
-/* Error message for each choice. */
-static const char *choices_error[] = {
-    "Commit to 'escape' was made outside it",
-    "Commit to 'escaped' was made outside it"
-};
+/* Return new gzip decompressing byte source using an allocator. */
+YIP_SOURCE *yip_gzip_source_with_allocator(YIP_SOURCE *compressed, YIP_ALLOCATOR *allocator) {
+#ifdef YIP_ZLIB
+    GZIP_SOURCE *source = (GZIP_SOURCE *)decompress_allocate(sizeof(*source), compressed, allocator);
+    if (!source) return NULL;
+    else {
+        source->decompress->step = gzip_step;
+        source->decompress->release = gzip_release;
+        source->stream->zalloc = gzip_allocate;
+        source->stream->zfree = gzip_release_memory;
+        source->stream->opaque = source->decompress->dynamic->allocator;
+        /* Maximal window, and automatic detection of gzip and zlib headers. */
+        switch (inflateInit2(source->stream, 15 + 32)) {
+        case Z_OK:
+            assert(decompress_invariant(source->decompress->dynamic->common) == source->decompress);
+            return source->decompress->dynamic->common;
+        case Z_MEM_ERROR:
+            return decompress_abort(source->decompress, ENOMEM);
+        default:
+            return decompress_abort(source->decompress, EINVAL);
+        }
+    }
+#else
+    if (compressed) compressed->close(compressed);
+    (void)allocator;
+    errno = ENOSYS;
+    return NULL;
+#endif /* YIP_ZLIB */
+}
 
-/* Machine implementation. */
-typedef RETURN (*MACHINE)(YIP *yip);
+#ifdef YIP_ZSTD
 
-/* Generic struct type for looking machines up by name. */
-typedef struct MACHINE_BY_NAME {
-    const char *name; /* Machine (production) name. */
-    MACHINE machine;  /* Machine (production) implementation. */
-} MACHINE_BY_NAME;
+/* Zstandard decompressing byte source. Is an extension of a decompressing byte source. */
+typedef struct ZSTD_SOURCE {
+    DECOMPRESS_SOURCE decompress[1];    /* Decompressing byte source members. */
+    ZSTD_DStream *stream;               /* Decompression state. */
+} ZSTD_SOURCE;
 
-/* An input character. */
-typedef struct CHAR {
-    YIP_TOKEN token[1];     /* Matched character as a token; code is Unicode point. */
-    long long int mask;     /* 1 << character class of the character, or -1. */
-} CHAR;
+/* {{{ */
 
-/* Stack frame for backtracking. */
-typedef struct FRAME {
-    CHAR prev[1];           /* Previous character. */
-    CHAR curr[1];           /* Current character. */
-    int tokens_depth;       /* Depth of tokens stack. */
-    int codes_depth;        /* Depth of codes stack. */
-} FRAME;
+/* Decompress zstd bytes. A zstd file may contain several frames, which are simply concatenated. */
+static int zstd_step(DECOMPRESS_SOURCE *common, unsigned char *out, long *out_size,
+                     const unsigned char *in, long *in_size) {
+    ZSTD_SOURCE *source = (ZSTD_SOURCE *)common;
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    size_t status;
+    input.src = in;
+    input.size = *in_size;
+    input.pos = 0;
+    output.dst = out;
+    output.size = *out_size;
+    output.pos = 0;
+    status = ZSTD_decompressStream(source->stream, &output, &input);
+    if (ZSTD_isError(status)) {
+        errno = EIO;
+        return -1;
+    }
+    *in_size = input.pos;
+    *out_size = output.pos;
+    return status == 0;
+}
 
-/* Stack of nested token codes. */
-TYPEDEF_STACK(YIP_CODE, CODE_STACK);
+/* Release decompression state. */
+static int zstd_release(DECOMPRESS_SOURCE *common) {
+    ZSTD_SOURCE *source = (ZSTD_SOURCE *)common;
+    ZSTD_freeDStream(source->stream);
+    return 0;
+}
 
-/* Stack of backtracking states. */
-TYPEDEF_STACK(FRAME, FRAME_STACK);
+/* }}} */
 
-/* Stack of collected tokens. */
-TYPEDEF_STACK(YIP_TOKEN, TOKEN_STACK);
+#endif /* YIP_ZSTD */
 
-/* YIP parser object. */
-struct YIP {
-    CODE_STACK codes[1];      /* Stack of nested tokens. */
-    TOKEN_STACK tokens[1];    /* Stack of collected tokens. */
-    FRAME_STACK frames[1];    /* Stack for backtracking. */
-    MACHINE machine;          /* State machine implementation. */
-    YIP_SOURCE *source;       /* Byte source to parse. */
-    YIP_ENCODING encoding;    /* Detected source encoding. */
-    int to_close;             /* Whether to automatically close source. */
-    int did_see_eof;          /* Did the source report EOF? */
-    int state;                /* Current state. */
-    int next_return_token;    /* Next token to return to caller. */
-    int i;                    /* Loops counter. */
-    int n;                    /* Indentation level. */
+/* Return new zstd decompressing byte source. */
+YIP_SOURCE *yip_zstd_source(YIP_SOURCE *compressed) {
+    return yip_zstd_source_with_allocator(compressed, NULL);
+}
+
+/* Return new zstd decompressing byte source using an allocator. The zstd decompression state itself is allocated by
+ * the zstd library. */
+YIP_SOURCE *yip_zstd_source_with_allocator(YIP_SOURCE *compressed, YIP_ALLOCATOR *allocator) {
+#ifdef YIP_ZSTD
+    ZSTD_SOURCE *source = (ZSTD_SOURCE *)decompress_allocate(sizeof(*source), compressed, allocator);
+    if (!source) return NULL;
+    else {
+        source->decompress->step = zstd_step;
+        source->decompress->release = zstd_release;
+        source->stream = ZSTD_createDStream();
+        if (!source->stream) return decompress_abort(source->decompress, ENOMEM);
+        assert(decompress_invariant(source->decompress->dynamic->common) == source->decompress);
+        return source->decompress->dynamic->common;
+    }
+#else
+    if (compressed) compressed->close(compressed);
+    (void)allocator;
+    errno = ENOSYS;
+    return NULL;
+#endif /* YIP_ZSTD */
+}
+
+/* Return a decompressing byte source wrapping a source if its first bytes are the magic bytes of some supported
+ * compression format, or the source itself otherwise. */
+YIP_SOURCE *yip_decompress_source(YIP_SOURCE *source) {
+    return yip_decompress_source_with_allocator(source, NULL);
+}
+
+/* Return a decompressing byte source wrapping a source if it is compressed using an allocator. */
+YIP_SOURCE *yip_decompress_source_with_allocator(YIP_SOURCE *source, YIP_ALLOCATOR *allocator) {
+    if (!source) return NULL;
+    while (size_of(source->buffer) < 4) {
+        int size = source->more(source, 4 - size_of(source->buffer));
+        if (size < 0) {
+            int saved_errno = errno;
+            source->close(source);
+            errno = saved_errno;
+            return NULL;
+        }
+        if (!size) break;
+    }
+    /* Neither magic is valid YAML text (they start with a control character or an invalid UTF-8 sequence). */
+#ifdef YIP_ZLIB
+    if (size_of(source->buffer) >= 2 && source->buffer->begin[0] == 0x1F && source->buffer->begin[1] == 0x8B)
+        return yip_gzip_source_with_allocator(source, allocator);
+#endif /* YIP_ZLIB */
+#ifdef YIP_ZSTD
+    if (size_of(source->buffer) >= 4 && source->buffer->begin[0] == 0x28 && source->buffer->begin[1] == 0xB5
+     && source->buffer->begin[2] == 0x2F && source->buffer->begin[3] == 0xFD)
+        return yip_zstd_source_with_allocator(source, allocator);
+#endif /* YIP_ZSTD */
+    (void)allocator;
+    return source;
+}
+
+/* Return new fd buffered byte source using mmap or read. */
+YIP_SOURCE *yip_fd_source(int fd, int to_close) {
+    return yip_fd_source_with_allocator(fd, to_close, NULL);
+}
+
+/* Return new fd buffered byte source using mmap or read using an allocator. */
+YIP_SOURCE *yip_fd_source_with_allocator(int fd, int to_close, YIP_ALLOCATOR *allocator) {
+    int saved_errno = errno;
+    off_t size = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+    YIP_SOURCE *source = size > WINDOW_FILE_SIZE ? yip_fd_window_source(fd, to_close, 0)
+                                                 : yip_fd_map_source(fd, to_close);
+    if (source) return source;
+    errno = saved_errno;
+    return yip_fd_read_source_with_allocator(fd, to_close, allocator);
+}
+
+/* Return new path buffered byte source using mmap or read. */
+YIP_SOURCE *yip_path_source(const char *path) {
+    return yip_path_source_with_allocator(path, NULL);
+}
+
+/* Return new path buffered byte source using mmap or read using an allocator. */
+YIP_SOURCE *yip_path_source_with_allocator(const char *path, YIP_ALLOCATOR *allocator) {
+    if (!path) return yip_buffer_source(NULL, NULL);
+    if (!strcmp(path, "-")) return yip_decompress_source_with_allocator(yip_fd_source_with_allocator(0, 0, allocator),
+                                                                        allocator);
+    else {
+        int fd = open(path, O_RDONLY|O_BINARY);
+        return yip_decompress_source_with_allocator(yip_fd_source_with_allocator(fd, 1, allocator), allocator);
+    }
+}
+
+/* Name of each UTF encoding. */
+static const char *encoding_names[] = {
+    "UTF-8", "UTF-16LE", "UTF-16BE", "UTF-32LE", "UTF-32BE"
 };
 
-/* Easy access of YIP members. */
-#define Codes (yip->codes)
-#define Code (*yip->codes->top)
-#define Tokens (yip->tokens)
-#define Token (yip->tokens->top)
-#define Frames (yip->frames)
-#define Frame (yip->frames->top)
-#define Curr_char (yip->frames->top->curr)
-#define Prev_char (yip->frames->top->prev)
-#define Curr (yip->frames->top->curr->token)
-#define Prev (yip->frames->top->prev->token)
-#define Machine (yip->machine)
-#define Source (yip->source)
-#define Buffer (yip->source->buffer)
-#define Encoding (yip->encoding)
-#define To_close (yip->to_close)
-#define Did_see_eof (yip->did_see_eof)
-#define State (yip->state)
-#define Next_return_token (yip->next_return_token)
-#define I (yip->i)
-#define N (yip->n)
+/* Returns name of the encoding (e.g. "UTF8"). */
+const char *yip_encoding_name(YIP_ENCODING encoding) {
+    if (encoding < 0 || numof(encoding_names) <= encoding) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return encoding_names[encoding];
+}
+
+/* Deduce the encoding based on the first few input bytes */
+static int detect_encoding(YIP_SOURCE *source) {
+    if (size_of(source->buffer) < 4 && source->more(source, 4) < 0) return -1;
+    else {
+        unsigned char byte_0    = (size_of(source->buffer) > 0 ? source->buffer->begin[0] : 0xAA);
+        unsigned char byte_1    = (size_of(source->buffer) > 1 ? source->buffer->begin[1] : 0xAA);
+        unsigned char byte_2    = (size_of(source->buffer) > 2 ? source->buffer->begin[2] : 0xAA);
+        unsigned char byte_3    = (size_of(source->buffer) > 3 ? source->buffer->begin[3] : 0xAA);
+        unsigned long byte_01   = ((unsigned long)byte_0 << 8)  |  byte_1;
+        unsigned long byte_012  = ((unsigned long)byte_0 << 16) | ((unsigned long)byte_1 << 8)  |  byte_2;
+        unsigned long byte_123  =                                 ((unsigned long)byte_1 << 16) | (byte_2 << 8) | byte_3;
+        unsigned long byte_0123 = ((unsigned long)byte_0 << 24) | ((unsigned long)byte_1 << 16) | (byte_2 << 8) | byte_3;
+        if (byte_0123 == 0x0000FEFF) return YIP_UTF32BE;
+        if (byte_012  == 0x000000  ) return YIP_UTF32BE;
+        if (byte_0123 == 0xFFFE0000) return YIP_UTF32LE;
+        if ( byte_123 ==   0x000000) return YIP_UTF32LE;
+        if (byte_01   == 0xFEFF    ) return YIP_UTF16BE;
+        if (byte_0    == 0x00      ) return YIP_UTF16BE;
+        if (byte_01   == 0xFFFE    ) return YIP_UTF16LE;
+        if ( byte_1   ==   0x00    ) return YIP_UTF16BE;
+        if (byte_012  == 0xEFBBBF  ) return YIP_UTF8;
+        else                         return YIP_UTF8;
+    }
+}
+
+/* Returns type of a YEAST token code. */
+YIP_CODE_TYPE yip_code_type(YIP_CODE code) {
+    switch (code) {
+    case YIP_BEGIN_ALIAS:
+    case YIP_BEGIN_ANCHOR:
+    case YIP_BEGIN_COMMENT:
+    case YIP_BEGIN_DIRECTIVE:
+    case YIP_BEGIN_DOCUMENT:
+    case YIP_BEGIN_ESCAPE:
+    case YIP_BEGIN_HANDLE:
+    case YIP_BEGIN_MAPPING:
+    case YIP_BEGIN_NODE:
+    case YIP_BEGIN_PAIR:
+    case YIP_BEGIN_PROPERTIES:
+    case YIP_BEGIN_SCALAR:
+    case YIP_BEGIN_SEQUENCE:
+    case YIP_BEGIN_TAG:
+        return YIP_BEGIN;
+    case YIP_END_ALIAS:
+    case YIP_END_ANCHOR:
+    case YIP_END_COMMENT:
+    case YIP_END_DIRECTIVE:
+    case YIP_END_DOCUMENT:
+    case YIP_END_ESCAPE:
+    case YIP_END_HANDLE:
+    case YIP_END_MAPPING:
+    case YIP_END_NODE:
+    case YIP_END_PAIR:
+    case YIP_END_PROPERTIES:
+    case YIP_END_SCALAR:
+    case YIP_END_SEQUENCE:
+    case YIP_END_TAG:
+        return YIP_END;
+    case YIP_BREAK:
+    case YIP_DOCUMENT_END:
+    case YIP_DOCUMENT_START:
+    case YIP_INDENT:
+    case YIP_INDICATOR:
+    case YIP_LINE_FEED:
+    case YIP_LINE_FOLD:
+    case YIP_META:
+    case YIP_TEXT:
+    case YIP_UNPARSED:
+    case YIP_WHITE:
+        return YIP_MATCH;
+    case YIP_BOM:
+    case YIP_COMMENT:
+    case YIP_DONE:
+    case YIP_ERROR:
+        return YIP_FAKE;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/* Returns the paired token code. */
+YIP_CODE yip_code_pair(YIP_CODE code) {
+    switch (code) {
+    case YIP_BEGIN_ALIAS:       return YIP_END_ALIAS;
+    case YIP_BEGIN_ANCHOR:      return YIP_END_ANCHOR;
+    case YIP_BEGIN_COMMENT:     return YIP_END_COMMENT;
+    case YIP_BEGIN_DIRECTIVE:   return YIP_END_DIRECTIVE;
+    case YIP_BEGIN_DOCUMENT:    return YIP_END_DOCUMENT;
+    case YIP_BEGIN_ESCAPE:      return YIP_END_ESCAPE;
+    case YIP_BEGIN_HANDLE:      return YIP_END_HANDLE;
+    case YIP_BEGIN_MAPPING:     return YIP_END_MAPPING;
+    case YIP_BEGIN_NODE:        return YIP_END_NODE;
+    case YIP_BEGIN_PAIR:        return YIP_END_PAIR;
+    case YIP_BEGIN_PROPERTIES:  return YIP_END_PROPERTIES;
+    case YIP_BEGIN_SCALAR:      return YIP_END_SCALAR;
+    case YIP_BEGIN_SEQUENCE:    return YIP_END_SEQUENCE;
+    case YIP_BEGIN_TAG:         return YIP_END_TAG;
+    case YIP_END_ALIAS:         return YIP_BEGIN_ALIAS;
+    case YIP_END_ANCHOR:        return YIP_BEGIN_ANCHOR;
+    case YIP_END_COMMENT:       return YIP_BEGIN_COMMENT;
+    case YIP_END_DIRECTIVE:     return YIP_BEGIN_DIRECTIVE;
+    case YIP_END_DOCUMENT:      return YIP_BEGIN_DOCUMENT;
+    case YIP_END_ESCAPE:        return YIP_BEGIN_ESCAPE;
+    case YIP_END_HANDLE:        return YIP_BEGIN_HANDLE;
+    case YIP_END_MAPPING:       return YIP_BEGIN_MAPPING;
+    case YIP_END_NODE:          return YIP_BEGIN_NODE;
+    case YIP_END_PAIR:          return YIP_BEGIN_PAIR;
+    case YIP_END_PROPERTIES:    return YIP_BEGIN_PROPERTIES;
+    case YIP_END_SCALAR:        return YIP_BEGIN_SCALAR;
+    case YIP_END_SEQUENCE:      return YIP_BEGIN_SEQUENCE;
+    case YIP_END_TAG:           return YIP_BEGIN_TAG;
+    default:
+        errno = EINVAL;
+        return -1;
+    }
+}
+
+/* }}} */
+
+/* Typed stack. */
+#define TYPEDEF_STACK(TYPE, NAME) \
+typedef struct NAME { \
+    TYPE *begin;  /* Pointer to bottom of stack. */ \
+    TYPE *end;    /* Pointer beyond last allocated member. */ \
+    TYPE *top;    /* Pointer to top element of stack or NULL. */ \
+    YIP_ALLOCATOR *allocator; /* Allocator of stack memory. */ \
+} NAME
+
+/* Stack element function. */
+typedef void (*STACK_FUNCTION)(void *data, void *element);
+
+/* Size of element in a typed stack. */
+#define STACK_TYPE_SIZE(STACK) sizeof(*(STACK)->begin)
+
+/* Number of used elements in a (typed) stack. */
+#define depth_of(STACK) (1 + (STACK)->top - (STACK)->begin)
+
+/* Offset of top element in a stack. */
+#define top_offset(STACK) ((char *)(STACK)->top - (char *)(STACK)->begin)
+
+/* Untyped stack for generic code. */
+TYPEDEF_STACK(void, VOID_STACK);
+
+/* Apply function to all stack elements. */
+#define stack_apply(STACK, FUNCTION, DATA) \
+    generic_stack_apply((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK), (STACK_FUNCTION)(FUNCTION), (void *)(DATA))
+static void generic_stack_apply(const VOID_STACK *stack, size_t type_size, STACK_FUNCTION function, void *data) {
+    void *element = stack->begin;
+    while (element <= stack->top) {
+        function(data, element);
+        element += type_size;
+    }
+}
+
+/* Asserts invariant always held by stacks. */
+#define stack_invariant(STACK, INVARIANT, DATA) \
+    generic_stack_invariant((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK), (STACK_FUNCTION)(INVARIANT), (void *)(DATA))
+static void generic_stack_invariant(const VOID_STACK *stack, size_t type_size, STACK_FUNCTION invariant, void *data) {
+    assert(stack);
+    assert(type_size > 0);
+    assert(stack->begin);
+    assert(stack->end);
+    assert(stack->top);
+    assert(stack->begin <= stack->top);
+    assert(stack->top < stack->end);
+    assert(stack->allocator);
+    assert(!(size_of(stack) % type_size));
+    assert(!(top_offset(stack) % type_size));
+    if (invariant) generic_stack_apply(stack, type_size, invariant, data);
+    else           assert(!data);
+}
+
+/* Initialize a stack with one allocated element. Returns 0 or -1 with errno. */
+#define stack_init(STACK, SIZE, ALLOCATOR) \
+    generic_stack_init((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK), (SIZE), (ALLOCATOR))
+static int generic_stack_init(VOID_STACK *stack, size_t type_size, int init_size, YIP_ALLOCATOR *allocator) {
+    size_t size = init_size * type_size;
+    assert(init_size > 0);
+    assert(allocator);
+    stack->allocator = allocator;
+    stack->begin = allocator->allocate(allocator->context, size);
+    if (!stack->begin) return -1;
+    stack->end = stack->begin + size;
+    stack->top = stack->begin;
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+    return 0;
+}
+
+/* Release all resources used by a stack. */
+#define stack_close(STACK) \
+    generic_stack_close((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK))
+static void generic_stack_close(VOID_STACK *stack, size_t type_size) {
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+    stack->allocator->release(stack->allocator->context, stack->begin);
+}
+
+/* Allocate space for a new uninitialized top element. Return 0 or -1 with errno. */
+#define stack_push(STACK) \
+    generic_stack_push((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK))
+static int generic_stack_push(VOID_STACK *stack, size_t type_size) {
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+    stack->top += type_size;
+    if (stack->top == stack->end) {
+        int size = size_of(stack);
+        void *begin = stack->allocator->reallocate(stack->allocator->context, stack->begin, size, 2 * size);
+        if (!begin) {
+            stack->top -= type_size;
+            return -1;
+        }
+        stack->begin = begin;
+        stack->top = stack->begin + size;
+        stack->end = stack->begin + 2 * size;
+    }
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+    return 0;
+}
+
+/* Release all but the bottom-most element, keeping the allocated memory. */
+#define stack_clear(STACK) \
+    generic_stack_clear((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK))
+static void generic_stack_clear(VOID_STACK *stack, size_t type_size) {
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+    stack->top = stack->begin;
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+}
+
+/* Release top element. Must not release the bottom-most element. */
+#define stack_pop(STACK) \
+    generic_stack_pop((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK))
+static void generic_stack_pop(VOID_STACK *stack, size_t type_size) {
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+    assert(top_offset(stack) >= 0);
+    stack->top -= type_size;
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+}
+
+/* Release bottom elements. Must not release the top-most element. */
+#define stack_shift(STACK, ELEMENTS) \
+    generic_stack_shift((VOID_STACK *)(STACK), STACK_TYPE_SIZE(STACK), ELEMENTS)
+static void generic_stack_shift(VOID_STACK *stack, size_t type_size, int elements) {
+    int shift_size = elements * type_size;
+    int tail_size = top_offset(stack) + type_size - shift_size;
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+    assert(shift_size >= (int)type_size);
+    assert(tail_size >= (int)type_size);
+    assert(!(shift_size % type_size));
+    assert(!(tail_size % type_size));
+    memmove(stack->begin, stack->begin + shift_size, tail_size);
+    stack->top = stack->begin + tail_size - type_size;
+    generic_stack_invariant(stack, type_size, NULL, NULL);
+}
+
+/* Return from an action/machine invocation. */
+typedef enum RETURN {
+    RETURN_ERROR = -1,  /* Unexpected error aborted action execution. */
+    RETURN_DONE = 0,    /* Completed action execution created no token(s) to be returned to called. */
+    RETURN_TOKEN = 1    /* Completed action execution created token(s) to be returned to caller. */
+} RETURN;
+
+/* Choice points. */
+typedef enum CHOICE {
+    CHOICE_ESCAPE,  /* Escape sequences top level choice point. */
+    CHOICE_ESCAPED  /* Escape sequences nested choice point. */
+} CHOICE;
+
+/* Error message for each choice. */
+static const char *choices_error[] = {
+    "Commit to 'escape' was made outside it",
+    "Commit to 'escaped' was made outside it"
+};
+
+/* Machine implementation. */
+typedef RETURN (*MACHINE)(YIP *yip);
+
+/* Generic struct type for looking machines up by name. */
+typedef struct MACHINE_BY_NAME {
+    const char *name;       /* Machine (production) name. */
+    MACHINE machine;        /* Machine (production) implementation for any encoding. */
+    MACHINE utf8_machine;   /* Machine (production) implementation specialized for UTF8. */
+} MACHINE_BY_NAME;
+
+/* A token being collected. Unlike a YIP_TOKEN, this holds no pointers into the source buffer, so it remains valid
+ * when the buffer is moved. */
+typedef struct TOKEN {
+    const char *text;       /* Fixed text of fake tokens, or NULL for tokens of source bytes. */
+    long byte_size;         /* Number of token bytes. */
+    long byte_offset;       /* Zero based offset in source bytes. */
+    long char_offset;       /* Zero based offset in source characters. */
+#ifndef YIP_LAZY_POSITIONS
+    long line;              /* One based source line number. */
+    long line_char;         /* Zero based source character in line. */
+#endif /* YIP_LAZY_POSITIONS */
+    YIP_ENCODING encoding;  /* Encoding used in token bytes. */
+    YIP_CODE code;          /* Parsed token code. */
+} TOKEN;
+
+/* An input character. This holds only what characters need (they have no text, and are in the source encoding), so
+ * the frames holding them are cheap to copy. */
+typedef struct CHAR {
+    long byte_offset;       /* Zero based offset in source bytes. */
+    long char_offset;       /* Zero based offset in source characters. */
+#ifndef YIP_LAZY_POSITIONS
+    long line;              /* One based source line number. */
+    long line_char;         /* Zero based source character in line. */
+#endif /* YIP_LAZY_POSITIONS */
+    long long int mask;     /* 1 << character class of the character, or -1. */
+    int code;               /* Unicode point, or EOF, INVALID_CODE or NO_CODE. */
+    int byte_size;          /* Number of character bytes. */
+} CHAR;
+
+/* The previous input character. Only its code and class mask are needed, to carry the start of line mark over invalid
+ * characters, so this is all a frame keeps of it. Implementing prev_char would need the whole character instead. */
+typedef struct PREV_CHAR {
+    long long int mask;     /* 1 << character class of the character, or -1. */
+    int code;               /* Unicode point, or INVALID_CODE or NO_CODE. */
+} PREV_CHAR;
+
+/* Stack frame for backtracking. */
+typedef struct FRAME {
+    PREV_CHAR prev[1];      /* Previous character. */
+    CHAR curr[1];           /* Current character. */
+    int tokens_depth;       /* Depth of tokens stack. */
+    int codes_depth;        /* Depth of codes stack. */
+#ifdef YIP_LAZY_POSITIONS
+    int lines_depth;        /* Depth of line starts index. */
+#endif /* YIP_LAZY_POSITIONS */
+} FRAME;
+
+/* A decoded input character, cached for replay after backtracking. */
+typedef struct CACHED_CHAR {
+    int code;               /* Unicode point of the character. */
+    int size;               /* Number of bytes of the character. */
+    long long int mask;     /* 1 << character class of the character. */
+} CACHED_CHAR;
+
+/* Stack of nested token codes. */
+TYPEDEF_STACK(YIP_CODE, CODE_STACK);
+
+/* Stack of backtracking states. */
+TYPEDEF_STACK(FRAME, FRAME_STACK);
+
+/* Stack of collected tokens. */
+TYPEDEF_STACK(TOKEN, TOKEN_STACK);
+
+/* Cache of consecutive decoded characters. */
+TYPEDEF_STACK(CACHED_CHAR, CHAR_CACHE);
+
+/* Character offsets of line starts, in source order. */
+TYPEDEF_STACK(long, LINE_INDEX);
+
+/* YIP parser object. */
+struct YIP {
+    YIP_ALLOCATOR *allocator; /* Allocator of parser memory. */
+    CODE_STACK codes[1];      /* Stack of nested tokens. */
+    TOKEN_STACK tokens[1];    /* Stack of collected tokens. */
+    FRAME_STACK frames[1];    /* Stack for backtracking. */
+    CHAR_CACHE chars[1];      /* Decoded characters from the oldest frame onward. */
+#ifdef YIP_LAZY_POSITIONS
+    LINE_INDEX lines[1];      /* Start of each line parsed so far (the bottom one is the first line). */
+    long first_line;          /* Line number of the bottom line start. */
+#endif /* YIP_LAZY_POSITIONS */
+    long chars_offset;        /* Character offset of the bottom cached character. */
+    long saved_decodes;       /* Number of characters taken from the cache instead of decoded. */
+    int max_frames_depth;     /* Maximal depth of the backtracking stack. */
+    YIP_LIMITS limits[1];     /* Bounds on the work done by the parser (zero for none). */
+    int max_tokens_depth;     /* Maximal number of collected tokens. */
+    long max_lookahead;       /* Maximal number of bytes read ahead of the oldest frame. */
+    long max_chars_per_byte;  /* Maximal number of characters examined per input byte, rounded up. */
+    long rescanned_chars;     /* Number of characters backtracked over, which are examined again. */
+    long furthest_offset;     /* Furthest byte offset backtracked from. */
+    long lookahead_limit;     /* Byte offset beyond which next_char checks the limits. */
+    const char *limit_error;  /* Text of the exceeded limit error, or NULL. */
+    CODE_STACK groups[1];     /* Codes of the groups returned to the caller and not yet ended. */
+#if YIP_CHECK_LEVEL == YIP_CHECK_SAMPLED
+    long check_steps;         /* Number of machine steps since all the stacks were last checked. */
+#endif /* YIP_CHECK_LEVEL */
+#ifdef YIP_COUNT_STATS
+    YIP_STATS stats[1];       /* Runtime statistics. */
+    YIP_MACHINE_STATS *machine_stats; /* Runtime statistics of each machine. */
+#endif /* YIP_COUNT_STATS */
+#ifdef YIP_TRACE
+    YIP_TRACE_EVENT *trace_events;    /* Ring buffer of recent trace events, if tracing. */
+    int trace_capacity;               /* Number of events the ring buffer holds. */
+    long trace_count;                 /* Number of events recorded since tracing started. */
+    int trace_machine;                /* Index of the last entered machine. */
+    unsigned long long trace_ticks;   /* Trace clock when tracing started. */
+    clock_t trace_clock;              /* CPU time when tracing started. */
+#endif /* YIP_TRACE */
+    char token_filter[128];   /* Whether to drop tokens of each code instead of returning them. */
+    char skip_filter[128];    /* Token filter to restore once the skipped group ends. */
+    YIP_CODE skip_code;       /* Begin code of the skipped group. */
+    int skip_depth;           /* Number of skipped groups not yet ended, or zero if not skipping. */
+    int skip_errors;          /* Number of errors skipped so far. */
+    int is_batching;          /* Whether tokens returned in the current batch still point to the input. */
+    YIP_INDEX_ENTRY *index_entries; /* Recorded entry points. */
+    int index_capacity;       /* Number of allocated entry points. */
+    int index_count;          /* Number of recorded entry points. */
+    int index_errno;          /* Error which stopped recording entry points, if any. */
+    int index_depth;          /* Number of returned groups enclosing the next returned token. */
+    int index_max_depth;      /* Maximal depth of recorded entry points. */
+    int is_indexing;          /* Whether to record entry points. */
+    char index_codes[128];    /* Whether to record entry points for begin tokens of each code. */
+    YIP_TOKEN result[1];      /* Last token returned to the caller. */
+    char error_text[24];      /* Text of the last unexpected character error. */
+    const MACHINE_BY_NAME *production; /* State machine implementations of the parsed production. */
+    MACHINE machine;          /* State machine implementation for the source encoding. */
+    YIP_SOURCE *source;       /* Byte source to parse. */
+    YIP_ENCODING encoding;    /* Detected source encoding. */
+    int to_close;             /* Whether to automatically close source. */
+    int did_see_eof;          /* Did the source report EOF? */
+    int state;                /* Current state. */
+    int next_return_token;    /* Next token to return to caller. */
+    int i;                    /* Loops counter. */
+    int n;                    /* Indentation level. */
+    long long run_mask;       /* Class mask the run bitmap was built for. */
+    unsigned char run_bits[16]; /* Run bitmap by low nibble, one bit per high nibble. */
+};
+
+/* Easy access of YIP members. */
+#define Allocator (yip->allocator)
+#define Codes (yip->codes)
+#define Code (*yip->codes->top)
+#define Tokens (yip->tokens)
+#define Token (yip->tokens->top)
+#define Frames (yip->frames)
+#define Frame (yip->frames->top)
+#define Chars (yip->chars)
+#define Chars_offset (yip->chars_offset)
+#define Lines (yip->lines)
+#define First_line (yip->first_line)
+#define Saved_decodes (yip->saved_decodes)
+#define Max_frames_depth (yip->max_frames_depth)
+#define Limits (yip->limits)
+#define Max_tokens_depth (yip->max_tokens_depth)
+#define Max_lookahead (yip->max_lookahead)
+#define Max_chars_per_byte (yip->max_chars_per_byte)
+#define Rescanned_chars (yip->rescanned_chars)
+#define Furthest_offset (yip->furthest_offset)
+#define Lookahead_limit (yip->lookahead_limit)
+#define Limit_error (yip->limit_error)
+#define Groups (yip->groups)
+#define Stats (yip->stats)
+#define Machine_stats (yip->machine_stats)
+#define Trace_events (yip->trace_events)
+#define Trace_capacity (yip->trace_capacity)
+#define Trace_count (yip->trace_count)
+#define Trace_machine (yip->trace_machine)
+#define Trace_ticks (yip->trace_ticks)
+#define Trace_clock (yip->trace_clock)
+#define Token_filter (yip->token_filter)
+#define Skip_filter (yip->skip_filter)
+#define Skip_code (yip->skip_code)
+#define Skip_depth (yip->skip_depth)
+#define Skip_errors (yip->skip_errors)
+#define Is_batching (yip->is_batching)
+#define Index_entries (yip->index_entries)
+#define Index_capacity (yip->index_capacity)
+#define Index_count (yip->index_count)
+#define Index_errno (yip->index_errno)
+#define Index_depth (yip->index_depth)
+#define Index_max_depth (yip->index_max_depth)
+#define Is_indexing (yip->is_indexing)
+#define Index_codes (yip->index_codes)
+#define Result (yip->result)
+#define Error_text (yip->error_text)
+#define Curr (yip->frames->top->curr)
+#define Prev (yip->frames->top->prev)
+#define Production (yip->production)
+#define Machine (yip->machine)
+#define Source (yip->source)
+#define Buffer (yip->source->buffer)
+#define Encoding (yip->encoding)
+#define To_close (yip->to_close)
+#define Did_see_eof (yip->did_see_eof)
+#define State (yip->state)
+#define Next_return_token (yip->next_return_token)
+#define I (yip->i)
+#define N (yip->n)
+#define Run_mask (yip->run_mask)
+#define Run_bits (yip->run_bits)
+
+#include "table.i"
+#include "classify.i"
+
+/* {{{ */
+
+#if YIP_CHECK_LEVEL != YIP_CHECK_OFF
+
+/* Assert invariant always held by tokens. */
+static void token_invariant(const YIP *yip, const TOKEN *token) {
+    assert(token->byte_offset >= 0);
+    assert(token->byte_size >= 0);
+    if (token->code != NO_CODE) {
+        assert(token->char_offset >= 0);
+#ifndef YIP_LAZY_POSITIONS
+        assert(token->line >= 1);
+        assert(token->line_char >= 0);
+#endif /* YIP_LAZY_POSITIONS */
+    }
+    assert(token->byte_offset <= Source->byte_offset + size_of(Buffer));
+    assert(token->char_offset <= token->byte_offset);
+    if (!token->text && token->byte_offset == Curr->byte_offset && token->code != NO_CODE) {
+        assert(token->char_offset == Curr->char_offset);
+#ifndef YIP_LAZY_POSITIONS
+        assert(token->line == Curr->line);
+        assert(token->line_char == Curr->line_char);
+#endif /* YIP_LAZY_POSITIONS */
+        assert(!token->byte_size || token->byte_size == Curr->byte_size);
+        assert(token->encoding == Encoding);
+    }
+    if (token->byte_size) assert(' ' < token->code && token->code <= '~');
+    if (yip_code_type(token->code) != YIP_FAKE) {
+        assert(!token->text);
+        assert(token->byte_offset + token->byte_size <= end_offset(Source));
+        assert(token->encoding == Encoding);
+    }
+}
+
+/* Assert invariant always held by characters. */
+static void char_invariant(const YIP *yip, const CHAR *character) {
+    assert(character->byte_offset >= 0);
+    assert(character->byte_size >= 0);
+    if (character->code != NO_CODE) {
+        assert(character->char_offset >= 0);
+#ifndef YIP_LAZY_POSITIONS
+        assert(character->line >= 1);
+        assert(character->line_char >= 0);
+#endif /* YIP_LAZY_POSITIONS */
+    }
+    assert(character->byte_offset <= Source->byte_offset + size_of(Buffer));
+    assert(character->char_offset <= character->byte_offset);
+    if (character->byte_offset == Curr->byte_offset && character->code != NO_CODE) {
+        assert(character->char_offset == Curr->char_offset);
+#ifndef YIP_LAZY_POSITIONS
+        assert(character->line == Curr->line);
+        assert(character->line_char == Curr->line_char);
+#endif /* YIP_LAZY_POSITIONS */
+        assert(!character->byte_size || character->byte_size == Curr->byte_size);
+    }
+    if (!character->byte_size) assert(character->code == NO_CODE || character->code == EOF);
+    else {
+        assert(character->code >= 0 || character->code == INVALID_CODE);
+        assert(character->byte_offset + character->byte_size <= end_offset(Source));
+    }
+}
+
+/* Assert invariant always held by stack frames. */
+static void frame_invariant(const YIP *yip, const FRAME *frame) {
+    const CHAR *curr = frame->curr;
+    const PREV_CHAR *prev = frame->prev;
+    char_invariant(yip, curr);
+    assert(prev->code >= 0 || prev->code == INVALID_CODE || prev->code == NO_CODE);
+    if (curr->code == NO_CODE) assert(prev->code == NO_CODE);
+    if (frame == Frame) {
+        assert(frame->tokens_depth == -1);
+        assert(frame->codes_depth == -1);
+#ifdef YIP_LAZY_POSITIONS
+        assert(frame->lines_depth == -1);
+#endif /* YIP_LAZY_POSITIONS */
+    } else {
+        assert(frame->tokens_depth > 0);
+        assert(frame->codes_depth > 0);
+        assert(frame->tokens_depth <= depth_of(Tokens));
+        assert(frame->codes_depth <= depth_of(Codes));
+#ifdef YIP_LAZY_POSITIONS
+        assert(frame->lines_depth > 0);
+        assert(frame->lines_depth <= depth_of(Lines));
+#endif /* YIP_LAZY_POSITIONS */
+    }
+}
+
+/*
+#define HERE fprintf(stderr, "%s: %d: %s:\n", __FILE__, __LINE__, __FUNCTION__)
+#define yip_invariant(Y) yip__invariant(Y, __FILE__, __LINE__, __FUNCTION__)
+*/
+
+/* Asserts the part of the invariant always held by parsers which takes O(1) time to check. */
+static void cheap_invariant(const YIP *yip/*, const char *file, int line, const char *function*/) {
+    /*fprintf(stderr, "%s: %d: %s:", file, line, function);*/
+    assert(yip);
+    assert(Source);
+    assert(Machine);
+    source_invariant(Source);
+    if (Curr->code == NO_CODE) return; /* Not started yet. */
+    stack_invariant(Codes, NULL, NULL);
+    stack_invariant(Tokens, NULL, NULL);
+    stack_invariant(Frames, NULL, NULL);
+    stack_invariant(Chars, NULL, NULL);
+    stack_invariant(Groups, NULL, NULL);
+    token_invariant(yip, Token);
+    frame_invariant(yip, Frame);
+#ifdef YIP_LAZY_POSITIONS
+    stack_invariant(Lines, NULL, NULL);
+    assert(*Lines->begin >= 0 && First_line >= 1);
+    assert(*Lines->top <= Curr->char_offset);
+#endif /* YIP_LAZY_POSITIONS */
+    assert(Chars_offset >= -1);
+    if (yip_code_type(Token->code) != YIP_FAKE) assert(Token->byte_offset + Token->byte_size == Curr->byte_offset);
+    assert(Next_return_token <= depth_of(Tokens));
+    assert(Next_return_token >= 0 || Token->code == YIP_UNPARSED || Token->code == Code);
+    /*fprintf(stderr, " OK\n");*/
+}
+
+#endif /* YIP_CHECK_LEVEL */
+#if YIP_CHECK_LEVEL == YIP_CHECK_FULL || YIP_CHECK_LEVEL == YIP_CHECK_SAMPLED
+
+/* Asserts invariant always held by parsers, walking all the stacks. */
+static void full_invariant(const YIP *yip) {
+    cheap_invariant(yip);
+    if (Curr->code == NO_CODE) return; /* Not started yet. */
+    stack_invariant(Tokens, token_invariant, yip);
+    stack_invariant(Frames, frame_invariant, yip);
+}
+
+#endif /* YIP_CHECK_LEVEL */
+
+/* Asserts invariant always held by parsers, as well as the check level allows. Steps of the machines may walk all the
+ * stacks even if other checks don't. */
+#if YIP_CHECK_LEVEL == YIP_CHECK_OFF
+#   define yip_invariant(Y) ((void)0)
+#   define step_invariant(Y) ((void)0)
+#elif YIP_CHECK_LEVEL == YIP_CHECK_CHEAP
+#   define yip_invariant(Y) cheap_invariant(Y)
+#   define step_invariant(Y) cheap_invariant(Y)
+#elif YIP_CHECK_LEVEL == YIP_CHECK_FULL
+#   define yip_invariant(Y) full_invariant(Y)
+#   define step_invariant(Y) full_invariant(Y)
+#elif YIP_CHECK_LEVEL == YIP_CHECK_SAMPLED
+#   define yip_invariant(Y) cheap_invariant(Y)
+#   define step_invariant(Y) \
+        (++(Y)->check_steps < YIP_CHECK_SAMPLE ? cheap_invariant(Y) : ((Y)->check_steps = 0, full_invariant(Y)))
+#else
+#   error "YIP_CHECK_LEVEL must be one of YIP_CHECK_OFF, YIP_CHECK_CHEAP, YIP_CHECK_FULL or YIP_CHECK_SAMPLED"
+#endif /* YIP_CHECK_LEVEL */
+
+/* Consume the next byte from a buffer ending at "end" into a buffer starting at "*begin". */
+static int next_byte(const unsigned char **begin, const unsigned char *end) {
+    if (*begin >= end) return -1;
+    else {
+        int code = **begin;
+        ++*begin;
+        return code;
+    }
+}
+
+/* Consume a UTF8 character from the buffer starting at "*begin" and ending at "end". */
+int yip_decode_utf8(const unsigned char **begin, const unsigned char *end) {
+    int code;
+    int continuations;
+    code = next_byte(begin, end);
+    if (code < 0) return INVALID_CODE;
+    if (!(code & 0x80)) return code;        /* 0xxxxxxx. */
+    if ((code & 0xE0) == 0xC0) {            /* 110xxxxx 10xxxxxx X 1 */
+        code &= 0x1F;
+        continuations = 1;
+    } else if ((code & 0xF0) == 0xE0) {     /* 1110xxxx 10xxxxxx X 2 */
+        code &= 0xF;
+        continuations = 2;
+    } else if ((code & 0xF8) == 0xF0) {     /* 11110xxx 10xxxxxx X 3 */
+        code &= 0x7;
+        continuations = 3;
+    } else if ((code & 0xFC) == 0xF8) {     /* 111110xx 10xxxxxx X 4 */
+        code &= 0x3;
+        continuations = 4;
+    } else if ((code & 0xFE) == 0xFC) {     /* 1111110x 10xxxxxx X 5 */
+        code &= 0x1;
+        continuations = 5;
+    } else return INVALID_CODE;
+    while (continuations-- > 0) {
+        if (*begin >= end) return INVALID_CODE;
+        else {
+            int next = next_byte(begin, end);
+            if (next < 0) return INVALID_CODE;
+            if ((next & 0xC0) != 0x80) return INVALID_CODE;
+            code <<= 6;
+            code |= next & 0x3F;
+        }
+    }
+    return code;
+}
+
+/* Consume a UTF16LE character from the buffer starting at "*begin" and ending at "end". */
+int yip_decode_utf16le(const unsigned char **begin, const unsigned char *end) {
+    int code0 = next_byte(begin, end);
+    if (code0 < 0) return INVALID_CODE;
+    else {
+        int code1 = next_byte(begin, end);
+        if (code1 < 0) return INVALID_CODE;
+        else {
+            int code01 = code0 | code1 << 8;
+            if (0xDC00 <= code01 && code01 < 0xE000) return INVALID_CODE;
+            if (code01 < 0xD800 || 0xDC00 <= code01) return code01;
+            else {
+                int code2 = next_byte(begin, end);
+                if (code2 < 0) return INVALID_CODE;
+                else {
+                    int code3 = next_byte(begin, end);
+                    if (code3 < 0) return INVALID_CODE;
+                    else {
+                        int code23 = code2 | code3 << 8;
+                        if (code23 < 0xDC00 || 0xE000 <= code23) return INVALID_CODE;
+                        return (code01 << 10) + code23 + 0x10000 - (0xD800 << 10) - 0xDC00;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Consume a UTF16BE character from the buffer starting at "*begin" and ending at "end". */
+int yip_decode_utf16be(const unsigned char **begin, const unsigned char *end) {
+    int code0 = next_byte(begin, end);
+    if (code0 < 0) return INVALID_CODE;
+    else {
+        int code1 = next_byte(begin, end);
+        if (code1 < 0) return INVALID_CODE;
+        else {
+            int code01 = code0 << 8 | code1;
+            if (0xDC00 <= code01 && code01 < 0xE000) return INVALID_CODE;
+            if (code01 < 0xD800 || 0xDC00 <= code01) return code01;
+            else {
+                int code2 = next_byte(begin, end);
+                if (code2 < 0) return INVALID_CODE;
+                else {
+                    int code3 = next_byte(begin, end);
+                    if (code3 < 0) return INVALID_CODE;
+                    else {
+                        int code23 = code2 << 8 | code3;
+                        if (code23 < 0xDC00 || 0xE000 <= code23) return INVALID_CODE;
+                        return (code01 << 10) + code23 + 0x10000 - (0xD800 << 10) - 0xDC00;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* Consume a UTF32LE character from the buffer starting at "*begin" and ending at "end". */
+int yip_decode_utf32le(const unsigned char **begin, const unsigned char *end) {
+    int code0 = next_byte(begin, end);
+    if (code0 < 0) return INVALID_CODE;
+    else {
+        int code1 = next_byte(begin, end);
+        if (code1 < 0) return INVALID_CODE;
+        else {
+            int code2 = next_byte(begin, end);
+            if (code2 < 0) return INVALID_CODE;
+            else {
+                int code3 = next_byte(begin, end);
+                if (code3 < 0) return INVALID_CODE;
+                else {
+                    return code0 | code1 << 8 | code2 << 16 | code3 << 24;
+                }
+            }
+        }
+    }
+}
+
+/* Consume a UTF32BE character from the buffer starting at "*begin" and ending at "end". */
+int yip_decode_utf32be(const unsigned char **begin, const unsigned char *end) {
+    int code0 = next_byte(begin, end);
+    if (code0 < 0) return INVALID_CODE;
+    else {
+        int code1 = next_byte(begin, end);
+        if (code1 < 0) return INVALID_CODE;
+        else {
+            int code2 = next_byte(begin, end);
+            if (code2 < 0) return INVALID_CODE;
+            else {
+                int code3 = next_byte(begin, end);
+                if (code3 < 0) return INVALID_CODE;
+                else {
+                    return code0 << 24 | code1 << 16 | code2 << 8 | code3;
+                }
+            }
+        }
+    }
+}
+
+/* Consume a Unicode character from the buffer starting at "*begin" and ending at "end". */
+int yip_decode(YIP_ENCODING encoding, const unsigned char **begin, const unsigned char *end) {
+    switch (encoding) {
+    case YIP_UTF8:    return yip_decode_utf8(begin, end);
+    case YIP_UTF16LE: return yip_decode_utf16le(begin, end);
+    case YIP_UTF16BE: return yip_decode_utf16be(begin, end);
+    case YIP_UTF32LE: return yip_decode_utf32le(begin, end);
+    case YIP_UTF32BE: return yip_decode_utf32be(begin, end);
+    default:          assert(0); errno = EINVAL; return INVALID_CODE;
+    }
+}
+
+/* Pointer to a source byte given its offset. Only bytes still in the source buffer can be accessed. */
+static const unsigned char *source_pointer(const YIP *yip, long byte_offset) {
+    assert(Source->byte_offset <= byte_offset && byte_offset <= end_offset(Source));
+    return Source->buffer->begin + (byte_offset - Source->byte_offset);
+}
+
+/* Maximal number of bytes in a single character (UTF8 goes up to 6 bytes). */
+static const int MAX_UTF_SIZE = 6;
+
+/* Append a decoded character to the cache, unless it is already there. Characters no frame can backtrack to are
+ * discarded first, so the cache only grows while backtracking is possible. A character not following the cached ones
+ * restarts the cache. */
+static int cache_char(YIP *yip, long char_offset, int code, int size, long long mask) {
+    if (char_offset >= Chars_offset && char_offset - Chars_offset < depth_of(Chars)) return 0;
+    if (depth_of(Frames) == 1 || char_offset - Chars_offset != depth_of(Chars)) {
+        Chars->top = Chars->begin;
+        Chars_offset = char_offset;
+    } else {
+        if (Chars->top + 1 == Chars->end) {
+            long unused = Frames->begin->curr->char_offset - Chars_offset;
+            if (unused >= depth_of(Chars)) unused = depth_of(Chars) - 1;
+            if (unused > 0) {
+                stack_shift(Chars, (int)unused);
+                Chars_offset += unused;
+            }
+        }
+        if (stack_push(Chars) < 0) return -1;
+    }
+    Chars->top->code = code;
+    Chars->top->size = size;
+    Chars->top->mask = mask;
+    return 0;
+}
+
+#ifdef YIP_TRACE
+/* Record a trace event in the ring buffer, overwriting the oldest one when it is full. */
+static void trace_event(YIP *yip, YIP_TRACE_KIND kind, int value) {
+    YIP_TRACE_EVENT *event = Trace_events + Trace_count++ % Trace_capacity;
+    event->ticks = TRACE_TICKS();
+    event->byte_offset = Curr->byte_offset;
+    event->value = value;
+    event->machine = Trace_machine;
+    event->kind = kind;
+}
+#endif /* YIP_TRACE */
+
+/* Ask the source for more bytes, counting the requests and whether the source buffer moved. */
+static int source_more(YIP *yip, int size) {
+#ifdef YIP_COUNT_STATS
+    const unsigned char *begin = Buffer->begin;
+    long end = end_offset(Source);
+    if (Source->more(Source, size) < 0) return -1;
+    Stats->more_calls++;
+    Stats->more_bytes += end_offset(Source) - end;
+    if (Buffer->begin != begin) Stats->rebases++;
+    return 0;
+#else
+    return Source->more(Source, size);
+#endif /* YIP_COUNT_STATS */
+}
+
+/* Number of bytes added to the input read so far when counting the characters examined per byte, so backtracking
+ * near the start of the input does not exceed the limit. */
+static const long EXAMINED_BYTES_ALLOWANCE = 4096;
+
+/* Record that a limit was exceeded and fail, so the machine returns and the parser gives up (see run_machine). Until
+ * then, every following next_char fails as well. */
+static int exceed_limit(YIP *yip, const char *text) {
+    if (!Limit_error) Limit_error = text;
+    Lookahead_limit = -1;
+    errno = ERANGE;
+    return -1;
+}
+
+/* Set the byte offset beyond which next_char exceeds the lookahead limit, whenever the oldest frame is pushed, moved
+ * or popped. Once a limit was exceeded this is left alone. */
+static void set_lookahead_limit(YIP *yip) {
+    if (Limit_error) return;
+    if (depth_of(Frames) == 1 || !Limits->max_lookahead) Lookahead_limit = LONG_MAX;
+    else Lookahead_limit = Frames->begin->curr->byte_offset + Limits->max_lookahead;
+}
+
+/* Record how far the parser read ahead of the oldest frame. */
+static void count_lookahead(YIP *yip) {
+    long lookahead = Curr->byte_offset - Frames->begin->curr->byte_offset;
+    if (lookahead > Max_lookahead) Max_lookahead = lookahead;
+}
+
+/* Number of characters examined per input byte, rounded up. Every character is examined once when it is first read,
+ * and once more for each time the parser backtracked over it. */
+static long chars_per_byte(const YIP *yip) {
+    long bytes = (Curr->byte_offset > Furthest_offset ? Curr->byte_offset : Furthest_offset) + EXAMINED_BYTES_ALLOWANCE;
+    return (Curr->char_offset + 1 + Rescanned_chars + bytes - 1) / bytes;
+}
+
+/* Count the characters about to be backtracked over. Exceeding the limit of characters examined per byte fails the
+ * following next_char. */
+static void count_rescan(YIP *yip) {
+    long per_byte;
+    Rescanned_chars += Curr->char_offset - Frame[-1].curr->char_offset;
+    if (Curr->byte_offset > Furthest_offset) Furthest_offset = Curr->byte_offset;
+    per_byte = chars_per_byte(yip);
+    if (per_byte > Max_chars_per_byte) Max_chars_per_byte = per_byte;
+    if (Limits->max_chars_per_byte && per_byte > Limits->max_chars_per_byte && !Limit_error) {
+        Limit_error = "Examined characters limit exceeded";
+        Lookahead_limit = -1;
+    }
+}
+
+/* Move to the next input character. The encoding is a constant in specialized variants, so the decoder dispatch
+ * is resolved at compile time. */
+/* Keep the current character as the previous one, before moving to the next. */
+static ALWAYS_INLINE void keep_prev_char(YIP *yip) {
+    Prev->code = Curr->code;
+    Prev->mask = Curr->mask;
+}
+
+static ALWAYS_INLINE int encoding_next_char(YIP *yip, YIP_ENCODING encoding) {
+    if (Curr->code != NO_CODE) yip_invariant(yip);
+    if (Curr->code == EOF) return 0;
+    assert(Token->byte_offset + Token->byte_size == Curr->byte_offset);
+    assert(Token->code != NO_CODE || Curr->code == NO_CODE);
+    if (Curr->byte_offset > Lookahead_limit) return exceed_limit(yip, "Lookahead limit exceeded");
+    /* Tricky: read more bytes before changing anything, so this can be invoked again if the source asks to wait for
+     * more input (EAGAIN). */
+    if (!Did_see_eof && Curr->byte_offset + Curr->byte_size + MAX_UTF_SIZE > end_offset(Source)
+     && source_more(yip, DYNAMIC_BUFFER_SIZE) < 0) return -1;
+    keep_prev_char(yip);
+    Curr->byte_offset += Curr->byte_size;
+    Curr->char_offset++;
+    ADVANCE_LINE_CHAR(Curr, 1);
+    Curr->byte_size = 0;
+    Token->byte_size = Curr->byte_offset - Token->byte_offset;
+    if (Curr->byte_offset == end_offset(Source)) {
+        Did_see_eof = 1;
+        Curr->code = EOF;
+        Curr->mask = code_mask(Curr->code);
+    } else if (Curr->char_offset - Chars_offset < depth_of(Chars) && Curr->char_offset >= Chars_offset) {
+        const CACHED_CHAR *cached = Chars->begin + (Curr->char_offset - Chars_offset);
+        Curr->code = cached->code;
+        Curr->byte_size = cached->size;
+        Curr->mask = cached->mask;
+        Saved_decodes++;
+    } else {
+        const unsigned char *begin = source_pointer(yip, Curr->byte_offset);
+        const unsigned char *end = begin;
+        if (encoding != YIP_UTF8) Curr->code = yip_decode(encoding, &end, Source->buffer->end);
+        else if (*begin < 0x80) Curr->code = *end++;
+        else Curr->code = yip_decode_utf8(&end, Source->buffer->end);
+        Curr->byte_size = end - begin;
+        Curr->mask = code_mask(Curr->code);
+        COUNT(decoded_chars, 1);
+        if (cache_char(yip, Curr->char_offset, Curr->code, Curr->byte_size, Curr->mask) < 0) return -1;
+    }
+    if ((Prev->code < 0 || Prev->code == 0xFFFF) && Prev->mask & START_OF_LINE_MASK) Curr->mask |= START_OF_LINE_MASK;
+    if (Prev->code != NO_CODE) yip_invariant(yip);
+    return 0;
+}
+
+/* Move to the next input character in any encoding. */
+static int next_char(YIP *yip) {
+    return encoding_next_char(yip, Encoding);
+}
+
+/* Move to the next input character in a UTF8 source. */
+static int next_char_utf8(YIP *yip) {
+    assert(Encoding == YIP_UTF8);
+    return encoding_next_char(yip, YIP_UTF8);
+}
+
+/* Rebuild the run bitmap for a new class mask. Only ASCII characters are ever placed in a run. */
+static void set_run_mask(YIP *yip, long long mask) {
+    int code;
+    Run_mask = mask;
+    memset(Run_bits, 0, sizeof(Run_bits));
+    for (code = 0; code < 0x80; code++)
+        if (code_mask(code) & mask) Run_bits[code & 0xF] |= 1 << (code >> 4);
+}
+
+/* Is a byte an ASCII character in the run bitmap? */
+#define is_run_byte(BITS, BYTE) ((BYTE) < 0x80 && ((BITS)[(BYTE) & 0xF] >> ((BYTE) >> 4) & 1))
+
+/* Number of leading bytes in a buffer which are ASCII characters in the run bitmap.
+ * Each vector block looks up both nibbles of every byte in the bitmap at once. */
+static long scan_run(const unsigned char *bits, const unsigned char *begin, const unsigned char *end) {
+    const unsigned char *next = begin;
+#if defined(__AVX2__)
+    const __m256i low_nibble = _mm256_set1_epi8(0xF);
+    const __m256i low_bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)bits));
+    const __m256i high_bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0,
+                                               1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    while (end - next >= 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)next);
+        __m256i low = _mm256_shuffle_epi8(low_bits, _mm256_and_si256(bytes, low_nibble));
+        __m256i high = _mm256_shuffle_epi8(high_bits, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_nibble));
+        __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256());
+        unsigned int misses = _mm256_movemask_epi8(miss);
+        if (misses) return next - begin + __builtin_ctz(misses);
+        next += 32;
+    }
+#elif defined(__SSSE3__)
+    const __m128i low_nibble = _mm_set1_epi8(0xF);
+    const __m128i low_bits = _mm_loadu_si128((const __m128i *)bits);
+    const __m128i high_bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 0, 0, 0, 0, 0, 0, 0, 0);
+    while (end - next >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)next);
+        __m128i low = _mm_shuffle_epi8(low_bits, _mm_and_si128(bytes, low_nibble));
+        __m128i high = _mm_shuffle_epi8(high_bits, _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble));
+        __m128i miss = _mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128());
+        unsigned int misses = _mm_movemask_epi8(miss);
+        if (misses) return next - begin + __builtin_ctz(misses);
+        next += 16;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const unsigned char high_table[16] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+    const uint8x16_t low_nibble = vdupq_n_u8(0xF);
+    const uint8x16_t low_bits = vld1q_u8(bits);
+    const uint8x16_t high_bits = vld1q_u8(high_table);
+    while (end - next >= 16) {
+        uint8x16_t bytes = vld1q_u8(next);
+        uint8x16_t low = vqtbl1q_u8(low_bits, vandq_u8(bytes, low_nibble));
+        uint8x16_t high = vqtbl1q_u8(high_bits, vshrq_n_u8(bytes, 4));
+        if (vmaxvq_u8(vceqq_u8(vandq_u8(low, high), vdupq_n_u8(0)))) break;
+        next += 16;
+    }
+#endif
+    while (next < end && is_run_byte(bits, *next)) next++;
+    return next - begin;
+}
+
+/* Skip over the next "count" ASCII characters without decoding them.
+ * Exactly the same as invoking next_char "count" times, assuming no bytes need to be read for this. */
+static int skip_chars(YIP *yip, long count) {
+    const unsigned char *last = source_pointer(yip, Curr->byte_offset + Curr->byte_size) + count - 1;
+    long index;
+    assert(count > 0);
+    assert(Encoding == YIP_UTF8);
+    assert(0 <= Curr->code && Curr->code < 0x80);
+    assert(last + MAX_UTF_SIZE < Source->buffer->end);
+    COUNT(decoded_chars, count);
+    if (depth_of(Frames) > 1)
+        for (index = 0; index < count; index++)
+            if (cache_char(yip, Curr->char_offset + 1 + index, last[index + 1 - count], 1, code_mask(last[index + 1 - count])) < 0)
+                return -1;
+    keep_prev_char(yip);
+    if (count > 1) {
+        Prev->code = last[-1];
+        Prev->mask = code_mask(Prev->code);
+    }
+    Curr->byte_offset += Curr->byte_size + count - 1;
+    Curr->char_offset += count;
+    ADVANCE_LINE_CHAR(Curr, count);
+    Curr->byte_size = 1;
+    Curr->code = *last;
+    Curr->mask = code_mask(Curr->code);
+    Token->byte_size = Curr->byte_offset - Token->byte_offset;
+    return 0;
+}
+
+/* Skip over the following characters as long as they match the class mask, decoding each directly from the buffer.
+ * Exactly the same as invoking next_char for each, assuming no bytes need to be read for this. In a UTF8 source this
+ * stops at the next ASCII character, to leave it to the block classification of skip_chars. Recovering from errors
+ * skips the rest of the line this way, which is the common case for non-ASCII text and for UTF16 and UTF32 sources. */
+static ALWAYS_INLINE int skip_decoded_chars(YIP *yip, long long mask, YIP_ENCODING encoding) {
+    const unsigned char *begin = source_pointer(yip, Curr->byte_offset + Curr->byte_size);
+    const unsigned char *limit = Source->buffer->end - MAX_UTF_SIZE;
+    const unsigned char *next = begin;
+    const unsigned char *last = NULL;
+    int code = Curr->code, prev_code = Curr->code;
+    long long code_mask_bits = Curr->mask, prev_mask = Curr->mask;
+    long count = 0;
+    /* Stop where next_char would propagate the start of line mark to the following character. */
+    while (next < limit && code >= 0 && code != 0xFFFF && (encoding != YIP_UTF8 || *next >= 0x80)) {
+        const unsigned char *end = next;
+        int next_code = encoding == YIP_UTF8 ? yip_decode_utf8(&end, Source->buffer->end)
+                                             : yip_decode(encoding, &end, Source->buffer->end);
+        long long next_mask = code_mask(next_code);
+        if (!(next_mask & mask)) break;
+        if (depth_of(Frames) > 1 && cache_char(yip, Curr->char_offset + 1 + count, next_code, end - next, next_mask) < 0)
+            return -1;
+        prev_code = code;
+        prev_mask = code_mask_bits;
+        last = next;
+        code = next_code;
+        code_mask_bits = next_mask;
+        next = end;
+        count++;
+    }
+    if (!count) return 0;
+    COUNT(decoded_chars, count);
+    keep_prev_char(yip);
+    if (count > 1) {
+        Prev->code = prev_code;
+        Prev->mask = prev_mask;
+    }
+    Curr->byte_offset += Curr->byte_size + (last - begin);
+    Curr->char_offset += count;
+    ADVANCE_LINE_CHAR(Curr, count);
+    Curr->byte_size = next - last;
+    Curr->code = code;
+    Curr->mask = code_mask_bits;
+    Token->byte_size = Curr->byte_offset - Token->byte_offset;
+    return 0;
+}
+
+/* Move past all the following input characters as long as they match the class mask.
+ * Runs of ASCII characters in a UTF8 source are classified a block at a time and skipped without decoding, and other
+ * runs are decoded directly from the buffer. */
+static ALWAYS_INLINE int encoding_next_chars(YIP *yip, long long mask, YIP_ENCODING encoding) {
+    yip_invariant(yip);
+    while (Curr->mask & mask) {
+        if (Curr->byte_offset + Curr->byte_size + MAX_UTF_SIZE < end_offset(Source)) {
+            if (encoding == YIP_UTF8 && 0 <= Curr->code && Curr->code < 0x80) {
+                long size;
+                if (mask != Run_mask) set_run_mask(yip, mask);
+                size = scan_run(Run_bits, source_pointer(yip, Curr->byte_offset + Curr->byte_size),
+                                Source->buffer->end - MAX_UTF_SIZE);
+                if (size > 1 && skip_chars(yip, size - 1) < 0) return -1;
+            } else if (skip_decoded_chars(yip, mask, encoding) < 0) return -1;
+        }
+        if (encoding_next_char(yip, encoding) < 0) return -1;
+    }
+    yip_invariant(yip);
+    return 0;
+}
+
+/* Move past all the following input characters in any encoding as long as they match the class mask. */
+static int next_chars(YIP *yip, long long mask) {
+    return encoding_next_chars(yip, mask, Encoding);
+}
+
+/* Move past all the following input characters in a UTF8 source as long as they match the class mask. */
+static int next_chars_utf8(YIP *yip, long long mask) {
+    assert(Encoding == YIP_UTF8);
+    return encoding_next_chars(yip, mask, YIP_UTF8);
+}
+
+/* Move to the previous character. */
+/* TODO:
+static void prev_char(YIP *yip) {
+    yip_invariant(yip);
+    assert(Prev->code != NO_CODE);
+    *Curr = *Prev;
+    Token->byte_size = Curr->byte_offset - Token->byte_offset;
+    yip_invariant(yip);
+}
+*/
+
+/* Move to the next input line. Returns 0 or -1 with errno. */
+static int next_line(YIP *yip) {
+#ifdef YIP_LAZY_POSITIONS
+    if (stack_push(Lines) < 0) return -1;
+    *Lines->top = Curr->char_offset;
+#else
+    Curr->line_char = 0;
+    Curr->line++;
+#endif /* YIP_LAZY_POSITIONS */
+    Curr->mask |= START_OF_LINE_MASK;
+    return 0;
+}
+
+#ifdef YIP_LAZY_POSITIONS
+/* Drop the line starts before the current line once the input before the current character is released. No frame or
+ * valid token is before it, so only the current line start is needed to compute later positions. */
+static void trim_lines(YIP *yip) {
+    assert(depth_of(Frames) == 1);
+    if (depth_of(Lines) > 1) {
+        First_line += depth_of(Lines) - 1;
+        stack_shift(Lines, depth_of(Lines) - 1);
+    }
+}
+#endif /* YIP_LAZY_POSITIONS */
+
+/* Start collecting a token with no bytes yet at the current character. */
+static void reset_token(YIP *yip, YIP_CODE code) {
+    Token->text = NULL;
+    Token->byte_size = 0;
+    Token->byte_offset = Curr->byte_offset;
+    Token->char_offset = Curr->char_offset;
+#ifndef YIP_LAZY_POSITIONS
+    Token->line = Curr->line;
+    Token->line_char = Curr->line_char;
+#endif /* YIP_LAZY_POSITIONS */
+    Token->encoding = Encoding;
+    Token->code = code;
+}
+
+/* Detect the encoding and move to the first input character, unless this was already done. When the source asks to
+ * wait for more input (EAGAIN), this is done on a later invocation instead. */
+static int start(YIP *yip) {
+    if (Curr->code != NO_CODE) return 0;
+    if (Encoding < 0) {
+        if ((Encoding = detect_encoding(Source)) < 0) {
+            if (errno != EAGAIN) errno = EILSEQ;
+            return -1;
+        }
+        Token->encoding = Encoding;
+        Machine = Encoding == YIP_UTF8 ? Production->utf8_machine : Production->machine;
+    }
+    if (next_char(yip) < 0) return -1;
+    reset_token(yip, YIP_UNPARSED);
+    yip_invariant(yip);
+    return 0;
+}
+
+#ifdef YIP_COUNT_STATS
+static int machines_count(void);
+static void clear_stats(YIP *yip);
+#endif /* YIP_COUNT_STATS */
+
+/* Rewind all the parsing state to the start of the source, keeping the allocated stacks. */
+static void rewind_parser(YIP *yip) {
+    stack_clear(Codes);
+    stack_clear(Tokens);
+    stack_clear(Frames);
+    stack_clear(Chars);
+    stack_clear(Groups);
+#ifdef YIP_LAZY_POSITIONS
+    stack_clear(Lines);
+    *Lines->top = 0;
+    First_line = 1;
+    Frame->lines_depth = -1;
+#endif /* YIP_LAZY_POSITIONS */
+    Next_return_token = -1;
+    Did_see_eof = 0;
+    State = 0;
+    I = NO_INDENT;
+    Encoding = -1;
+    Machine = Production->machine;
+    Saved_decodes = 0;
+    Max_frames_depth = 1;
+    Max_tokens_depth = 1;
+    Max_lookahead = 0;
+    Max_chars_per_byte = 0;
+    Rescanned_chars = 0;
+    Furthest_offset = 0;
+    Lookahead_limit = LONG_MAX;
+    Limit_error = NULL;
+    memset(Token_filter, 0, sizeof(Token_filter));
+    Skip_depth = 0;
+    Result->code = YIP_DONE;
+    memset(Index_codes, 0, sizeof(Index_codes));
+    Is_indexing = 0;
+    Index_count = 0;
+    Index_errno = 0;
+    Index_depth = 0;
+#ifdef YIP_COUNT_STATS
+    clear_stats(yip);
+#endif /* YIP_COUNT_STATS */
+#ifdef YIP_TRACE
+    Trace_count = 0;
+    Trace_machine = 0;
+#endif /* YIP_TRACE */
+    Code = YIP_UNPARSED;
+    *Groups->top = YIP_DONE;
+    Chars_offset = -1;
+    Chars->top->code = NO_CODE;
+    Chars->top->size = 0;
+    Chars->top->mask = 0;
+    Frame->tokens_depth = -1;
+    Frame->codes_depth = -1;
+    Curr->byte_offset = 0;
+    Curr->char_offset = -1;
+#ifndef YIP_LAZY_POSITIONS
+    Curr->line = 1;
+    Curr->line_char = -1;
+#endif /* YIP_LAZY_POSITIONS */
+    Curr->byte_size = 0;
+    Curr->code = NO_CODE;
+    Curr->mask = START_OF_LINE_MASK;
+    keep_prev_char(yip);
+    reset_token(yip, NO_CODE);
+}
+
+/* Release what was given to a parser which could not be created. */
+static void abort_init(YIP_SOURCE *source, int to_close, YIP_ALLOCATOR *allocator) {
+    int saved_errno = errno;
+    if (source && to_close) source->close(source);
+    if (allocator->close) allocator->close(allocator);
+    errno = saved_errno;
+}
+
+/* Start parsing at an entry point instead of at the start of the source. The source bytes before the entry are
+ * released without being decoded, and the positions continue from those of the entry. */
+static int rewind_to_entry(YIP *yip, const YIP_INDEX_ENTRY *entry) {
+    if (entry->byte_offset < Source->byte_offset || entry->char_offset < entry->line_char || entry->line < 1
+     || entry->line_char < 0 || entry->encoding < YIP_UTF8 || entry->encoding > YIP_UTF32BE) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (Source->byte_offset < entry->byte_offset) {
+        long size = entry->byte_offset - Source->byte_offset;
+        if (!size_of(Source->buffer)) {
+            int status = Source->more(Source, DYNAMIC_BUFFER_SIZE);
+            if (status < 0) return -1;
+            if (!status) {
+                errno = EINVAL;
+                return -1;
+            }
+        }
+        if (size > size_of(Source->buffer)) size = size_of(Source->buffer);
+        if (Source->less(Source, size) < 0) return -1;
+    }
+    Encoding = entry->encoding;
+    Machine = Encoding == YIP_UTF8 ? Production->utf8_machine : Production->machine;
+    Curr->byte_offset = entry->byte_offset;
+    Curr->char_offset = entry->char_offset - 1;
+#ifdef YIP_LAZY_POSITIONS
+    *Lines->top = entry->char_offset - entry->line_char;
+    First_line = entry->line;
+#else
+    Curr->line = entry->line;
+    Curr->line_char = entry->line_char - 1;
+#endif /* YIP_LAZY_POSITIONS */
+    if (entry->line_char) Curr->mask = 0;
+    keep_prev_char(yip);
+    reset_token(yip, NO_CODE);
+    return 0;
+}
+
+/* Initialize YIP parser object, starting at an entry point if there is one. */
+static YIP *yip_init(YIP_SOURCE *source, int to_close, const MACHINE_BY_NAME *machine, const YIP_PRODUCTION *production,
+                     const YIP_INDEX_ENTRY *entry, YIP_ALLOCATOR *allocator) {
+    if (!source || !machine) {
+        errno = EINVAL;
+        abort_init(source, to_close, allocator);
+        return NULL;
+    } else {
+        YIP *yip = (YIP *)allocate_zero(allocator, sizeof(*yip));
+        if (!yip) {
+            abort_init(source, to_close, allocator);
+            return NULL;
+        }
+        Allocator = allocator;
+        Source = source;
+        Production = machine;
+        Machine = machine->machine;
+        To_close = to_close;
+        N = production && production->n ? atoi(production->n) : NO_INDENT;
+        if (stack_init(Codes, production ? 1 : 128, Allocator) < 0
+         || stack_init(Tokens, production ? 1 : 128, Allocator) < 0
+         || stack_init(Frames, production ? 1 : 128, Allocator) < 0
+         || stack_init(Chars, production ? 1 : 128, Allocator) < 0
+         || stack_init(Groups, production ? 1 : 128, Allocator) < 0
+#ifdef YIP_LAZY_POSITIONS
+         || stack_init(Lines, production ? 1 : 128, Allocator) < 0
+#endif /* YIP_LAZY_POSITIONS */
+#ifdef YIP_COUNT_STATS
+         || !(Machine_stats = (YIP_MACHINE_STATS *)Allocator->allocate(Allocator->context,
+                                                                      machines_count() * sizeof(*Machine_stats)))
+#endif /* YIP_COUNT_STATS */
+        ) {
+            yip_close(yip);
+            return NULL;
+        }
+        rewind_parser(yip);
+        if ((entry && rewind_to_entry(yip, entry) < 0) || (start(yip) < 0 && errno != EAGAIN)) {
+            yip_close(yip);
+            return NULL;
+        }
+        return yip;
+    }
+}
+
+/* Push a collected token, unless this exceeds the limit. */
+static int push_token(YIP *yip) {
+    if (Limits->max_tokens_depth && depth_of(Tokens) >= Limits->max_tokens_depth)
+        return exceed_limit(yip, "Collected tokens limit exceeded");
+    if (stack_push(Tokens) < 0) return -1;
+    if (depth_of(Tokens) > Max_tokens_depth) Max_tokens_depth = depth_of(Tokens);
+    COUNT_MAX(max_tokens_depth, depth_of(Tokens));
+    return 0;
+}
+
+/* Complete the collected token, and start collecting the next one. At the outermost level the token is returned to the
+ * caller right away; otherwise it is kept until backtracking is no longer possible. Tokens the caller asked not to see
+ * are dropped instead, and at the outermost level their bytes are released right away (unless earlier tokens of the
+ * current batch still point to them), as they would have been had they been returned. */
+static RETURN complete_token(YIP *yip) {
+    assert(0 <= Token->code && Token->code < numof(Token_filter));
+    if (Token_filter[Token->code]) {
+        if (depth_of(Frames) == 1 && depth_of(Tokens) > 1) {
+            /* Only return the token collected before this one (see fake_token). */
+            stack_pop(Tokens);
+            Next_return_token = 0;
+            yip_invariant(yip);
+            return RETURN_TOKEN;
+        }
+        reset_token(yip, Code);
+        if (depth_of(Frames) == 1 && !Is_batching) {
+            if (Curr->byte_offset > Source->byte_offset
+             && Source->less(Source, Curr->byte_offset - Source->byte_offset) < 0) return RETURN_ERROR;
+#ifdef YIP_LAZY_POSITIONS
+            trim_lines(yip);
+#endif /* YIP_LAZY_POSITIONS */
+        }
+        yip_invariant(yip);
+        return RETURN_DONE;
+    }
+    if (depth_of(Frames) == 1) {
+        assert(depth_of(Tokens) <= 2);
+        Next_return_token = 0;
+        yip_invariant(yip);
+        return RETURN_TOKEN;
+    }
+    if (push_token(yip) < 0) return RETURN_ERROR;
+    reset_token(yip, Code);
+    yip_invariant(yip);
+    return RETURN_DONE;
+}
+
+/* Start collecting characters to a new token. */
+static RETURN begin_token(YIP *yip, YIP_CODE code) {
+    yip_invariant(yip);
+    assert(Next_return_token < 0);
+    assert(yip_code_type(code) == YIP_MATCH || code == YIP_BOM);
+    if (stack_push(Codes) < 0) return RETURN_ERROR;
+    COUNT_MAX(max_codes_depth, depth_of(Codes));
+    Code = code;
+    if (!Token->byte_size) {
+        Token->code = code;
+        yip_invariant(yip);
+        return RETURN_DONE;
+    }
+    return complete_token(yip);
+}
+
+/* End collecting characters to a token. */
+static RETURN end_token(YIP *yip, YIP_CODE code) {
+    yip_invariant(yip);
+    assert(Next_return_token < 0);
+    assert(code == Token->code || code == YIP_UNPARSED);
+    if (depth_of(Codes) == 1) assert(Code == YIP_UNPARSED);
+    else stack_pop(Codes);
+    if (!Token->byte_size) {
+        Token->code = Code;
+        yip_invariant(yip);
+        return RETURN_DONE;
+    }
+    Token->code = code;
+    if (Token->code == YIP_BOM) {
+        Token->text = encoding_names[Token->encoding] + 1;
+        Token->byte_size = strlen(Token->text);
+        Token->encoding = YIP_UTF8;
+    }
+    return complete_token(yip);
+}
+
+/* Return a fake token to the caller. */
+static RETURN fake_token(YIP *yip, YIP_CODE code, const char *text) {
+    yip_invariant(yip);
+    assert(Next_return_token < 0);
+    if (text) assert(yip_code_type(code) == YIP_FAKE);
+    else      assert(code == YIP_DONE || yip_code_type(code) == YIP_BEGIN || yip_code_type(code) == YIP_END);
+    if (Token->byte_size) {
+        /* The collected bytes are a token of their own, unless they are to be dropped. */
+        if (!Token_filter[Token->code] && push_token(yip) < 0) return RETURN_ERROR;
+        reset_token(yip, code);
+    }
+    Token->code = code;
+    if (text) {
+        Token->text = text;
+        Token->byte_size = strlen(text);
+    }
+    return complete_token(yip);
+}
+
+/* Return an empty token to the caller. */
+static RETURN empty_token(YIP *yip, YIP_CODE code) {
+    return fake_token(yip, code, NULL);
+}
+
+/* Return an error for an unexpected input character. */
+static RETURN unexpected(YIP *yip) {
+    if (Curr->code == INVALID_CODE) return fake_token(yip, YIP_ERROR, "Invalid byte sequence");
+    if (Curr->code == EOF)          return fake_token(yip, YIP_ERROR, "Unexpected end of input");
+    if (Curr->code == '\'')         return fake_token(yip, YIP_ERROR, "Unexpected \"'\"");
+    if (' ' <= Curr->code && Curr->code <= '~') sprintf(Error_text, "Unexpected '%c'", Curr->code);
+    else if (Curr->code <= 0xFF)                sprintf(Error_text, "Unexpected '\\x%02x'", Curr->code);
+    else if (Curr->code <= 0xFFFF)              sprintf(Error_text, "Unexpected '\\u%04x'", Curr->code);
+    else                                        sprintf(Error_text, "Unexpected '\\U%08x'", Curr->code);
+    return fake_token(yip, YIP_ERROR, Error_text);
+}
+
+/* Prevent further named backtracking. */
+static RETURN commit(YIP *yip, CHOICE choice) {
+    return fake_token(yip, YIP_ERROR, choices_error[choice]);
+}
+
+/* Push current state for backtracking. */
+static int push_state(YIP *yip) {
+    yip_invariant(yip);
+    assert(!Token->byte_size);
+    assert(Token->code == YIP_UNPARSED);
+    if (Limits->max_frames_depth && depth_of(Frames) >= Limits->max_frames_depth)
+        return exceed_limit(yip, "Backtracking depth limit exceeded");
+    if (stack_push(Frames) < 0) return -1;
+    Frame[0] = Frame[-1];
+    Frame[-1].tokens_depth = depth_of(Tokens);
+    Frame[-1].codes_depth = depth_of(Codes);
+#ifdef YIP_LAZY_POSITIONS
+    Frame[-1].lines_depth = depth_of(Lines);
+#endif /* YIP_LAZY_POSITIONS */
+    if (depth_of(Frames) > Max_frames_depth) Max_frames_depth = depth_of(Frames);
+    if (depth_of(Frames) == 2) set_lookahead_limit(yip);
+    COUNT(push_states, 1);
+    COUNT_MAX(max_frames_depth, depth_of(Frames));
+    TRACE(YIP_TRACE_PUSH, depth_of(Frames));
+    yip_invariant(yip);
+    return 0;
+}
+
+/* Update the state for backtracking. */
+static RETURN set_state(YIP *yip) {
+    yip_invariant(yip);
+    assert(depth_of(Frames) > 1);
+    assert(!Token->byte_size);
+    assert(Token->code == YIP_UNPARSED);
+    if (depth_of(Frames) == 2) count_lookahead(yip);
+    Frame[-1] = Frame[0];
+    if (depth_of(Frames) == 2) set_lookahead_limit(yip);
+    Frame[-1].codes_depth = depth_of(Codes);
+#ifdef YIP_LAZY_POSITIONS
+    Frame[-1].lines_depth = depth_of(Lines);
+#endif /* YIP_LAZY_POSITIONS */
+    if (depth_of(Frames) > 1 || depth_of(Tokens) == 1) {
+        Frame[-1].tokens_depth = depth_of(Tokens);
+        yip_invariant(yip);
+        return RETURN_DONE;
+    }
+    Frame[-1].tokens_depth = 1;
+    stack_pop(Tokens);
+    Next_return_token = 0;
+    yip_invariant(yip);
+    return RETURN_TOKEN;
+}
+
+/* Backtrack to a previous state. */
+static void reset_state(YIP *yip) {
+    yip_invariant(yip);
+    assert(!Token->byte_size);
+    assert(Token->code == YIP_UNPARSED);
+    assert(depth_of(Frames) > 1);
+    COUNT(reset_states, 1);
+    COUNT(rescanned_bytes, Curr->byte_offset - Frame[-1].curr->byte_offset);
+    count_lookahead(yip);
+    count_rescan(yip);
+    TRACE(YIP_TRACE_RESET, depth_of(Frames));
+    Frame[0] = Frame[-1];
+    Codes->top = Codes->begin + Frame->codes_depth - 1;
+    Token = Tokens->begin + Frame->tokens_depth - 1;
+#ifdef YIP_LAZY_POSITIONS
+    Lines->top = Lines->begin + Frame->lines_depth - 1;
+    Frame->lines_depth = -1;
+#endif /* YIP_LAZY_POSITIONS */
+    reset_token(yip, Code);
+    Frame->tokens_depth = -1;
+    Frame->codes_depth = -1;
+    yip_invariant(yip);
+}
+
+/* End backtracking keeping the current state. */
+static RETURN pop_state(YIP *yip) {
+    yip_invariant(yip);
+    assert(!Token->byte_size);
+    assert(Token->code == YIP_UNPARSED);
+    assert(depth_of(Frames) > 1);
+    COUNT(pop_states, 1);
+    TRACE(YIP_TRACE_POP, depth_of(Frames) - 1);
+    if (depth_of(Frames) == 2) count_lookahead(yip);
+    Frame[-1] = Frame[0];
+    Frame--;
+    Frame->tokens_depth = -1;
+    Frame->codes_depth = -1;
+#ifdef YIP_LAZY_POSITIONS
+    Frame->lines_depth = -1;
+#endif /* YIP_LAZY_POSITIONS */
+    if (depth_of(Frames) == 1) set_lookahead_limit(yip);
+    if (depth_of(Frames) > 1 || depth_of(Tokens) == 1) {
+        yip_invariant(yip);
+        return RETURN_DONE;
+    }
+    stack_pop(Tokens);
+    Next_return_token = 0;
+    yip_invariant(yip);
+    return RETURN_TOKEN;
+}
+
+/* Test whether current state has changed from pushed state. */
+static int is_same_state(YIP *yip) {
+    yip_invariant(yip);
+    assert(depth_of(Frames) > 1);
+    return Curr->byte_offset == Frame[-1].curr->byte_offset;
+}
+
+/* }}} */
 
-#include "table.i"
-#include "classify.i"
+#ifdef YIP_TABLE_BACKEND
+
+/* Action executed when entering a state of a table machine. */
+typedef enum TABLE_ACTION {
+    TABLE_NO_ACTION,            /* Nothing to execute. */
+    TABLE_BEGIN_TOKEN,          /* begin_token(argument). */
+    TABLE_END_TOKEN,            /* end_token(argument). */
+    TABLE_EMPTY_TOKEN,          /* empty_token(argument). */
+    TABLE_UNEXPECTED,           /* unexpected(). */
+    TABLE_NEXT_CHAR,            /* next_char(). */
+    TABLE_NEXT_LINE,            /* next_line(). */
+    TABLE_COMMIT,               /* commit(argument). */
+    TABLE_RESET_COUNTER,        /* Reset the loops counter. */
+    TABLE_INCREMENT_COUNTER,    /* Increment the loops counter. */
+    TABLE_PUSH_STATE,           /* push_state(). */
+    TABLE_SET_STATE,            /* set_state(). */
+    TABLE_POP_STATE,            /* pop_state(). */
+    TABLE_RESET_STATE           /* reset_state(). */
+} TABLE_ACTION;
+
+/* Condition for taking a transition of a table machine. */
+typedef enum TABLE_KIND {
+    TABLE_ALWAYS,               /* Always taken. */
+    TABLE_COUNTER_LESS_THAN_N,  /* Taken if I < N. */
+    TABLE_COUNTER_LESS_EQUAL_N, /* Taken if I <= N. */
+    TABLE_IS_SAME_STATE,        /* Taken if is_same_state(). */
+    TABLE_CLASSES,              /* Taken if the current character is in the mask. */
+    TABLE_CLASSES_RUN           /* Same, but first skips a run of characters in the mask. */
+} TABLE_KIND;
+
+/* Transition of a table machine. */
+typedef struct TABLE_TRANSITION {
+    short kind;                 /* Condition for taking the transition (TABLE_KIND). */
+    short target;               /* Target state of the transition. */
+    long long int mask;         /* Classes mask of TABLE_CLASSES and TABLE_CLASSES_RUN. */
+} TABLE_TRANSITION;
+
+/* State of a table machine. */
+typedef struct TABLE_STATE {
+    unsigned char action;       /* Action executed when entering the state (TABLE_ACTION). */
+    short argument;             /* Token code or choice of the action. */
+    short next;                 /* State to resume at after the action returned a token. */
+    short first;                /* Index of the first transition of the state. */
+    short count;                /* Number of transitions of the state. */
+} TABLE_STATE;
+
+/* Table machine. */
+typedef struct TABLE_MACHINE {
+    const TABLE_STATE *states;              /* States of the machine. */
+    const TABLE_TRANSITION *transitions;    /* Transitions of all the states. */
+} TABLE_MACHINE;
 
 /* {{{ */
 
-/* Assert invariant always held by tokens (or characaters posing as tokens). */
-static void token_char_invariant(const YIP *yip, const YIP_TOKEN *token) {
-    assert(token->byte_offset >= 0);
-    if (token->code != NO_CODE) {
-        assert(token->char_offset >= 0);
-        assert(token->line >= 1);
-        assert(token->line_char >= 0);
+/* Run a table machine. This is the same as the generated switch code of the machine, but the code is shared by all
+ * machines and only the (much smaller) tables are specific to each one. */
+static ALWAYS_INLINE RETURN encoding_run_table(YIP *yip, const TABLE_MACHINE *machine, YIP_ENCODING encoding) {
+    for (;;) {
+        const TABLE_STATE *state = machine->states + State;
+        const TABLE_TRANSITION *transition = machine->transitions + state->first;
+        const TABLE_TRANSITION *end = transition + state->count;
+        RETURN status = RETURN_DONE;
+        step_invariant(yip);
+        TRACE(YIP_TRACE_STATE, State);
+        switch (state->action) {
+        case TABLE_NO_ACTION:           break;
+        case TABLE_BEGIN_TOKEN:         status = begin_token(yip, state->argument); break;
+        case TABLE_END_TOKEN:           status = end_token(yip, state->argument); break;
+        case TABLE_EMPTY_TOKEN:         status = empty_token(yip, state->argument); break;
+        case TABLE_UNEXPECTED:          status = unexpected(yip); break;
+        case TABLE_NEXT_CHAR:           if (encoding_next_char(yip, encoding) < 0) status = RETURN_ERROR; break;
+        case TABLE_NEXT_LINE:           if (next_line(yip) < 0) status = RETURN_ERROR; break;
+        case TABLE_COMMIT:              status = commit(yip, state->argument); break;
+        case TABLE_RESET_COUNTER:       I = 0; break;
+        case TABLE_INCREMENT_COUNTER:   I++; break;
+        case TABLE_PUSH_STATE:          if (push_state(yip) < 0) status = RETURN_ERROR; break;
+        case TABLE_SET_STATE:           status = set_state(yip); break;
+        case TABLE_POP_STATE:           status = pop_state(yip); break;
+        case TABLE_RESET_STATE:         reset_state(yip); break;
+        default:
+            assert(0);
+            errno = EFAULT;
+            return RETURN_ERROR;
+        }
+        switch (status) {
+        case RETURN_TOKEN:
+            State = state->next;
+            yip_invariant(yip);
+            return RETURN_TOKEN;
+        case RETURN_DONE:
+            break;
+        default:
+            assert(0);
+            errno = EFAULT;
+        case RETURN_ERROR:
+            return RETURN_ERROR;
+        }
+        for (; transition < end; transition++) {
+            int is_taken;
+            switch (transition->kind) {
+            case TABLE_ALWAYS:                  is_taken = 1; break;
+            case TABLE_COUNTER_LESS_THAN_N:     is_taken = I < N; break;
+            case TABLE_COUNTER_LESS_EQUAL_N:    is_taken = I <= N; break;
+            case TABLE_IS_SAME_STATE:           is_taken = is_same_state(yip); break;
+            case TABLE_CLASSES_RUN:
+                if (encoding_next_chars(yip, transition->mask, encoding) < 0) return RETURN_ERROR;
+                /* Fall through. */
+            case TABLE_CLASSES:                 is_taken = !!(Curr->mask & transition->mask); break;
+            default:
+                assert(0);
+                errno = EFAULT;
+                return RETURN_ERROR;
+            }
+            if (is_taken) break;
+        }
+        assert(transition < end);
+        State = transition->target;
     }
-    assert(token->byte_offset <= Source->byte_offset + size_of(Buffer));
-    assert(token->char_offset <= token->byte_offset);
-    assert(token->buffer->begin);
-    if (token->buffer->begin == Curr->buffer->begin && token->code != NO_CODE) {
-        assert(token->byte_offset == Curr->byte_offset);
-        assert(token->char_offset == Curr->char_offset);
-        assert(token->line == Curr->line);
-        assert(token->line_char == Curr->line_char);
-        assert(!size_of(token->buffer) || token->buffer->end == Curr->buffer->end);
-        assert(token->encoding == Encoding);
+}
+
+/* Run a table machine for any encoding. */
+static RETURN run_table(YIP *yip, const TABLE_MACHINE *machine) {
+    return encoding_run_table(yip, machine, Encoding);
+}
+
+/* Run a table machine for a UTF8 source. */
+static RETURN run_table_utf8(YIP *yip, const TABLE_MACHINE *machine) {
+    assert(Encoding == YIP_UTF8);
+    return encoding_run_table(yip, machine, YIP_UTF8);
+}
+
+/* }}} */
+
+#include "tables.i"
+
+#else /* YIP_TABLE_BACKEND */
+
+/* Machines for any encoding. */
+#define MACHINE_VARIANT(NAME) NAME
+#include "functions.i"
+#undef MACHINE_VARIANT
+
+/* Machines specialized for UTF8 sources. */
+#define MACHINE_VARIANT(NAME) NAME##_utf8
+#define next_char(YIP) next_char_utf8(YIP)
+#define next_chars(YIP, MASK) next_chars_utf8(YIP, MASK)
+#include "functions.i"
+#undef next_chars
+#undef next_char
+#undef MACHINE_VARIANT
+
+#endif /* YIP_TABLE_BACKEND */
+
+#include "by_name.i"
+
+#if defined(YIP_COUNT_STATS) || defined(YIP_TRACE)
+/* Number of state machines. */
+static int machines_count(void) {
+    return numof(all_machine_stats) - 1;
+}
+#endif /* YIP_COUNT_STATS || YIP_TRACE */
+#ifdef YIP_COUNT_STATS
+
+/* Clear all the runtime statistics. */
+static void clear_stats(YIP *yip) {
+    memset(Stats, 0, sizeof(*Stats));
+    Stats->max_tokens_depth = Stats->max_frames_depth = Stats->max_codes_depth = 1;
+    Stats->machines_count = machines_count();
+    Stats->machines = Machine_stats;
+    memcpy(Machine_stats, all_machine_stats, Stats->machines_count * sizeof(*Machine_stats));
+}
+#endif /* YIP_COUNT_STATS */
+
+/* {{{ */
+
+/* Locate production list by parameters. */
+static const MACHINE_BY_NAME *machine_by_parameters(const YIP_PRODUCTION *production) {
+    if (!production->n && !production->t) return machines;
+    if ( production->n && !production->t) return machines_with_n;
+    if (!production->n &&  production->t) return machines_with_t;
+    if (production->n  &&  production->t) return machines_with_nt;
+    errno = EINVAL;
+    return NULL;
+}
+
+/* Locate production machine by name. */
+static const MACHINE_BY_NAME *machine_by_name(const MACHINE_BY_NAME *by_name, const char *name, const char *context) {
+    int name_length = strlen(name);
+    int context_length = context ? (int)strlen(context) : -1;
+    for (; by_name->name; by_name++) {
+        if (context) {
+            int by_name_length = strlen(by_name->name);
+            if (by_name_length == name_length + 1 + context_length
+             && !strncmp(by_name->name, name, name_length)
+             && !strcmp(by_name->name + name_length + 1, context)) {
+                return by_name;
+            }
+        } else if (!strcmp(by_name->name, name)) {
+            return by_name;
+        }
     }
+    return NULL;
 }
 
-/* Assert invariant always held by tokens. */
-static void token_invariant(const YIP *yip, const YIP_TOKEN *token) {
-    token_char_invariant(yip, token);
-    if (size_of(token->buffer)) assert(' ' < token->code && token->code <= '~');
-    if (yip_code_type(token->code) != YIP_FAKE) {
-        assert(token->byte_offset + size_of(token->buffer) <= Source->byte_offset + size_of(Source->buffer));
-        assert(token->encoding == Encoding);
-        assert(token->buffer->begin >= Source->buffer->begin);
-        assert(token->buffer->end <= Source->buffer->end);
-        assert(token->byte_offset - Source->byte_offset == token->buffer->begin - Source->buffer->begin);
+/* Initialize a YIP parser object for a production with no parameters. */
+YIP *yip_test(YIP_SOURCE *source, int to_close, const YIP_PRODUCTION *production) {
+    return yip_test_with_allocator(source, to_close, production, NULL);
+}
+
+/* Initialize a YIP parser object for a production with no parameters using an allocator. */
+YIP *yip_test_with_allocator(YIP_SOURCE *source, int to_close, const YIP_PRODUCTION *production,
+                             YIP_ALLOCATOR *allocator) {
+    return yip_test_at_with_allocator(source, to_close, production, NULL, allocator);
+}
+
+/* Initialize a YIP parser object for a production, starting at an entry point of the source. */
+YIP *yip_test_at(YIP_SOURCE *source, int to_close, const YIP_PRODUCTION *production, const YIP_INDEX_ENTRY *entry) {
+    return yip_test_at_with_allocator(source, to_close, production, entry, NULL);
+}
+
+/* Initialize a YIP parser object for a production, starting at an entry point of the source (if not NULL) using an
+ * allocator. */
+YIP *yip_test_at_with_allocator(YIP_SOURCE *source, int to_close, const YIP_PRODUCTION *production,
+                                const YIP_INDEX_ENTRY *entry, YIP_ALLOCATOR *allocator) {
+    const MACHINE_BY_NAME *by_name = machine_by_parameters(production);
+    allocator = allocator_or_default(allocator);
+    if (!by_name) {
+        abort_init(source, to_close, allocator);
+        return NULL;
+    } else {
+        const MACHINE_BY_NAME *machine = machine_by_name(by_name, production->name, production->c);
+        if (!machine) {
+            abort_init(source, to_close, allocator);
+            return NULL;
+        }
+        return yip_init(source, to_close, machine, production, entry, allocator);
+    }
+}
+
+/* Release a YIP parser object and release all allocated resources. */
+int yip_close(YIP *yip) {
+    YIP_SOURCE *source = Source;
+    int to_close = To_close;
+    YIP_ALLOCATOR *allocator = Allocator;
+    int status = 0;
+    if (Source) yip_invariant(yip); /* Parsers kept in a pool have no source. */
+    stack_close(Codes);
+    stack_close(Frames);
+    stack_close(Tokens);
+    stack_close(Chars);
+    stack_close(Groups);
+#ifdef YIP_LAZY_POSITIONS
+    stack_close(Lines);
+#endif /* YIP_LAZY_POSITIONS */
+#ifdef YIP_COUNT_STATS
+    if (Machine_stats) allocator->release(allocator->context, Machine_stats);
+#endif /* YIP_COUNT_STATS */
+#ifdef YIP_TRACE
+    if (Trace_events) allocator->release(allocator->context, Trace_events);
+#endif /* YIP_TRACE */
+    if (Index_entries) allocator->release(allocator->context, Index_entries);
+    allocator->release(allocator->context, yip);
+    if (to_close) status = source->close(source);
+    if (allocator->close) {
+        int saved_errno = errno;
+        allocator->close(allocator);
+        errno = saved_errno;
+    }
+    return status;
+}
+
+/* Detach the source from a parser, closing it if needed. */
+static int detach_source(YIP *yip) {
+    YIP_SOURCE *source = Source;
+    int to_close = To_close;
+    Source = NULL;
+    To_close = 0;
+    if (source && to_close) return source->close(source);
+    return 0;
+}
+
+/* Reuse a YIP parser object for parsing a new source. */
+int yip_reset(YIP *yip, YIP_SOURCE *source, int to_close) {
+    if (!yip || !source) {
+        errno = EINVAL;
+        return -1;
+    } else {
+        int status = detach_source(yip);
+        Source = source;
+        To_close = to_close;
+        rewind_parser(yip);
+        if (start(yip) < 0 && errno != EAGAIN) return -1;
+        return status;
+    }
+}
+
+/* Pool of idle YIP parser objects. */
+struct YIP_POOL {
+    YIP_PRODUCTION production[1];   /* Production of all the parsers. */
+    YIP **idle;                     /* Idle parsers. */
+    int idle_count;                 /* Number of idle parsers. */
+    int max_idle;                   /* Maximal number of idle parsers. */
+};
+
+/* Return new pool of YIP parser objects. */
+YIP_POOL *yip_pool(const YIP_PRODUCTION *production, int max_idle) {
+    if (!production || max_idle < 0) {
+        errno = EINVAL;
+        return NULL;
+    } else {
+        YIP_POOL *pool = calloc(1, sizeof(*pool));
+        if (!pool) return NULL;
+        pool->idle = malloc((max_idle ? max_idle : 1) * sizeof(*pool->idle));
+        if (!pool->idle) {
+            free(pool);
+            return NULL;
+        }
+        *pool->production = *production;
+        pool->max_idle = max_idle;
+        return pool;
+    }
+}
+
+/* Take a YIP parser object from a pool (creating it if needed) for parsing a source. */
+YIP *yip_pool_take(YIP_POOL *pool, YIP_SOURCE *source, int to_close) {
+    if (!pool || !source) {
+        errno = EINVAL;
+        return NULL;
+    } else if (!pool->idle_count) return yip_test(source, to_close, pool->production);
+    else {
+        YIP *yip = pool->idle[--pool->idle_count];
+        if (yip_reset(yip, source, to_close) < 0) {
+            int saved_errno = errno;
+            yip_close(yip);
+            errno = saved_errno;
+            return NULL;
+        }
+        return yip;
+    }
+}
+
+/* Return a YIP parser object to a pool. */
+int yip_pool_give(YIP_POOL *pool, YIP *yip) {
+    if (!pool || !yip) {
+        errno = EINVAL;
+        return -1;
+    } else {
+        int status = detach_source(yip);
+        if (pool->idle_count < pool->max_idle) pool->idle[pool->idle_count++] = yip;
+        else if (yip_close(yip) < 0) status = -1;
+        return status;
+    }
+}
+
+/* Release a pool and all the idle YIP parser objects in it. */
+int yip_pool_close(YIP_POOL *pool) {
+    int status = 0;
+    if (!pool) {
+        errno = EINVAL;
+        return -1;
+    }
+    while (pool->idle_count)
+        if (yip_close(pool->idle[--pool->idle_count]) < 0) status = -1;
+    free(pool->idle);
+    free(pool);
+    return status;
+}
+
+/* Convert a collected token to the form returned to the caller, pointing into the current source buffer. */
+static const YIP_TOKEN *result_token(YIP *yip, const TOKEN *token) {
+    Result->buffer->begin = token->text ? (const unsigned char *)token->text : source_pointer(yip, token->byte_offset);
+    Result->buffer->end = Result->buffer->begin + token->byte_size;
+    Result->byte_offset = token->byte_offset;
+    Result->char_offset = token->char_offset;
+#ifdef YIP_LAZY_POSITIONS
+    Result->line = -1;
+    Result->line_char = -1;
+#else
+    Result->line = token->line;
+    Result->line_char = token->line_char;
+#endif /* YIP_LAZY_POSITIONS */
+    Result->encoding = token->encoding;
+    Result->code = token->code;
+    return Result;
+}
+
+/* Record an entry point if a returned token is one of the recorded begin tokens. Running out of memory stops the
+ * recording rather than the parsing, and is reported when the entry points are accessed. */
+static const YIP_TOKEN *index_token(YIP *yip, const YIP_TOKEN *token) {
+    switch (yip_code_type(token->code)) {
+    case YIP_BEGIN:
+        if (Index_codes[token->code] && Index_depth <= Index_max_depth && !Index_errno) {
+            YIP_INDEX_ENTRY *entry;
+            if (Index_count == Index_capacity) {
+                int capacity = Index_capacity ? 2 * Index_capacity : 64;
+                YIP_INDEX_ENTRY *entries = (YIP_INDEX_ENTRY *)(Index_entries
+                    ? Allocator->reallocate(Allocator->context, Index_entries, Index_capacity * sizeof(*entries),
+                                            capacity * sizeof(*entries))
+                    : Allocator->allocate(Allocator->context, capacity * sizeof(*entries)));
+                if (!entries) {
+                    Index_errno = errno;
+                    Index_depth++;
+                    return token;
+                }
+                Index_entries = entries;
+                Index_capacity = capacity;
+            }
+            entry = Index_entries + Index_count++;
+            entry->byte_offset = token->byte_offset;
+            yip_token_position(yip, token, &entry->line, &entry->line_char, &entry->char_offset);
+            entry->encoding = Encoding;
+            entry->code = token->code;
+            entry->depth = Index_depth;
+        }
+        Index_depth++;
+        break;
+    case YIP_END:
+        Index_depth--;
+        break;
+    default:
+        break;
+    }
+    return token;
+}
+
+/* Return the next prepared token to the caller. */
+static const YIP_TOKEN *next_token(YIP *yip) {
+    const TOKEN *token = Tokens->begin + Next_return_token;
+    yip_invariant(yip);
+    assert(depth_of(Frames) == 1);
+    assert(Next_return_token >= 0);
+    TRACE(YIP_TRACE_TOKEN, token->code);
+    if (token->code == YIP_DONE) return result_token(yip, token);
+    switch (yip_code_type(token->code)) {
+    case YIP_BEGIN:
+        if (stack_push(Groups) < 0) return NULL;
+        *Groups->top = token->code;
+        break;
+    case YIP_END:
+        if (depth_of(Groups) > 1 && *Groups->top == yip_code_pair(token->code)) stack_pop(Groups);
+        break;
+    default:
+        break;
+    }
+    Next_return_token++;
+    yip_invariant(yip);
+    if (Is_indexing) return index_token(yip, result_token(yip, token));
+    return result_token(yip, token);
+}
+
+/* Reset after returning the last token. */
+static void last_token(YIP *yip) {
+    yip_invariant(yip);
+    assert(depth_of(Frames) == 1);
+    Next_return_token = -1;
+    Token = Tokens->begin;
+    reset_token(yip, Code);
+    yip_invariant(yip);
+}
+
+/* Release source bytes (and lazily tracked line starts) after the caller is done with all returned tokens. Since no
+ * token or frame refers to the input before the current character any more, memory is bounded by the lookahead rather
+ * than by the input size. */
+static int release_input(YIP *yip) {
+    yip_invariant(yip);
+    assert(depth_of(Frames) == 1);
+    assert(Next_return_token < 0);
+    if (Curr->byte_offset > Source->byte_offset && Source->less(Source, Curr->byte_offset - Source->byte_offset) < 0)
+        return -1;
+#ifdef YIP_LAZY_POSITIONS
+    trim_lines(yip);
+#endif /* YIP_LAZY_POSITIONS */
+    yip_invariant(yip);
+    return 0;
+}
+
+/* Drop tokens of some codes and/or types instead of returning them. A group's begin and end codes must be dropped
+ * together, and the final token must not be dropped, so the returned tokens remain properly nested and terminated. */
+int yip_set_token_filter(YIP *yip, const char *codes, int types) {
+    int saved_errno = errno;
+    char filter[128];
+    int code;
+    if (!yip || (types & ~((1 << YIP_FAKE) | (1 << YIP_BEGIN) | (1 << YIP_END) | (1 << YIP_MATCH)))) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(filter, 0, sizeof(filter));
+    for (; codes && *codes; codes++) {
+        if (*codes < 0 || yip_code_type(*codes) < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+        filter[(int)*codes] = 1;
+    }
+    for (code = 1; code < numof(filter); code++) {
+        YIP_CODE_TYPE type = yip_code_type(code);
+        if (type >= 0 && (types & (1 << type))) filter[code] = 1;
+    }
+    filter[YIP_DONE] = 0;
+    for (code = 0; code < numof(filter); code++) {
+        YIP_CODE_TYPE type = yip_code_type(code);
+        if ((type == YIP_BEGIN || type == YIP_END) && filter[code] != filter[yip_code_pair(code)]) {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    memcpy(Token_filter, filter, sizeof(filter));
+    errno = saved_errno;
+    return 0;
+}
+
+/* Compute the line position of a returned token. When lines are tracked lazily, the line is found by a binary search
+ * for the last line start at or before the token. Several lines may start at the same character (in the same way
+ * next_line may be invoked several times there), and then the token belongs to the last one. */
+int yip_token_position(const YIP *yip, const YIP_TOKEN *token, long *line, long *line_char, long *char_offset) {
+    if (!yip || !token || token->char_offset < 0) {
+        errno = EINVAL;
+        return -1;
+    } else {
+#ifdef YIP_LAZY_POSITIONS
+        long low = 0;
+        long high = depth_of(Lines);
+        while (high - low > 1) {
+            long middle = low + (high - low) / 2;
+            if (Lines->begin[middle] <= token->char_offset) low = middle;
+            else                                            high = middle;
+        }
+        if (line) *line = low + First_line;
+        if (line_char) *line_char = token->char_offset - Lines->begin[low];
+#else
+        if (line) *line = token->line;
+        if (line_char) *line_char = token->line_char;
+#endif /* YIP_LAZY_POSITIONS */
+        if (char_offset) *char_offset = token->char_offset;
+        return 0;
+    }
+}
+
+/* Return the number of characters taken from the cache instead of being decoded again. */
+long yip_saved_decodes(const YIP *yip) {
+    yip_invariant(yip);
+    return Saved_decodes;
+}
+
+/* Bound the work done by the parser, or remove all bounds if there are no limits. */
+int yip_set_limits(YIP *yip, const YIP_LIMITS *limits) {
+    if (!yip || (limits && (limits->max_frames_depth < 0 || limits->max_tokens_depth < 0
+                         || limits->max_lookahead < 0 || limits->max_chars_per_byte < 0))) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (limits) *Limits = *limits;
+    else memset(Limits, 0, sizeof(*Limits));
+    set_lookahead_limit(yip);
+    return 0;
+}
+
+/* Return the maximal value reached for each limit, including the current lookahead. */
+int yip_limits_usage(const YIP *yip, YIP_LIMITS *usage) {
+    if (!yip || !usage) {
+        errno = EINVAL;
+        return -1;
+    }
+    yip_invariant(yip);
+    usage->max_frames_depth = Max_frames_depth;
+    usage->max_tokens_depth = Max_tokens_depth;
+    usage->max_lookahead = Max_lookahead;
+    if (depth_of(Frames) > 1 && Curr->byte_offset - Frames->begin->curr->byte_offset > usage->max_lookahead)
+        usage->max_lookahead = Curr->byte_offset - Frames->begin->curr->byte_offset;
+    usage->max_chars_per_byte = Max_chars_per_byte > chars_per_byte(yip) ? Max_chars_per_byte : chars_per_byte(yip);
+    return 0;
+}
+
+/* Return the runtime statistics of the parser. */
+const YIP_STATS *yip_get_stats(const YIP *yip) {
+#ifdef YIP_COUNT_STATS
+    yip_invariant(yip);
+    return Stats;
+#else
+    (void)yip;
+    errno = ENOSYS;
+    return NULL;
+#endif /* YIP_COUNT_STATS */
+}
+
+#ifdef YIP_TRACE
+
+/* Names of the trace event kinds, for the dump. */
+static const char *trace_kind_names[] = { "enter", "exit", "state", "push", "reset", "pop", "token" };
+
+#endif /* YIP_TRACE */
+
+/* Start or stop recording trace events. */
+int yip_trace(YIP *yip, int capacity) {
+#ifdef YIP_TRACE
+    if (!yip || capacity < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (Trace_events) Allocator->release(Allocator->context, Trace_events);
+    Trace_events = NULL;
+    Trace_capacity = 0;
+    Trace_count = 0;
+    if (capacity) {
+        Trace_events = (YIP_TRACE_EVENT *)Allocator->allocate(Allocator->context, capacity * sizeof(*Trace_events));
+        if (!Trace_events) return -1;
+        Trace_capacity = capacity;
+        Trace_ticks = TRACE_TICKS();
+        Trace_clock = clock();
     }
+    return 0;
+#else
+    (void)yip;
+    (void)capacity;
+    errno = ENOSYS;
+    return -1;
+#endif /* YIP_TRACE */
 }
 
-/* Assert invariant always held by characters posing as tokens. */
-static void char_invariant(const YIP *yip, const YIP_TOKEN *token) {
-    token_char_invariant(yip, token);
-    if (!size_of(token->buffer)) assert(token->code == NO_CODE || token->code == EOF);
-    else {
-        assert(token->code >= 0 || token->code == INVALID_CODE);
-        assert(token->byte_offset + size_of(token->buffer) <= Source->byte_offset + size_of(Source->buffer));
-        assert(token->encoding == Encoding);
-        assert(token->buffer->begin >= Source->buffer->begin);
-        assert(token->buffer->end <= Source->buffer->end);
-        assert(token->byte_offset - Source->byte_offset == token->buffer->begin - Source->buffer->begin);
+/* Return the number of recorded trace events still held in the ring buffer. */
+int yip_trace_count(const YIP *yip) {
+#ifdef YIP_TRACE
+    return Trace_count < Trace_capacity ? (int)Trace_count : Trace_capacity;
+#else
+    (void)yip;
+    return 0;
+#endif /* YIP_TRACE */
+}
+
+/* Return a recorded trace event, the oldest one held being at index zero. */
+const YIP_TRACE_EVENT *yip_trace_event(const YIP *yip, int index) {
+#ifdef YIP_TRACE
+    if (index < 0 || index >= yip_trace_count(yip)) {
+        errno = EINVAL;
+        return NULL;
     }
+    return Trace_events + (Trace_count - yip_trace_count(yip) + index) % Trace_capacity;
+#else
+    (void)yip;
+    (void)index;
+    errno = ENOSYS;
+    return NULL;
+#endif /* YIP_TRACE */
 }
 
-/* Assert invariant always held by stack frames. */
-static void frame_invariant(const YIP *yip, const FRAME *frame) {
-    const CHAR *curr_char = frame->curr;
-    const CHAR *prev_char = frame->prev;
-    const YIP_TOKEN *curr = curr_char->token;
-    const YIP_TOKEN *prev = prev_char->token;
-    char_invariant(yip, curr);
-    char_invariant(yip, prev);
-    if (curr->buffer->begin == prev->buffer->begin) {
-        if (!size_of(curr->buffer)) assert(!size_of(prev->buffer));
-        else if (size_of(prev->buffer)) assert(!memcmp(curr_char, prev_char, sizeof(*curr_char)));
+/* Write the recorded trace events in the Chrome trace event JSON format. Machines are shown as nested durations, all
+ * other events as instants; a machine exit whose entry was already overwritten is skipped. */
+int yip_trace_dump(const YIP *yip, FILE *fp) {
+#ifdef YIP_TRACE
+    const char *separator = "\n";
+    double ticks_per_us;
+    int depth = 0;
+    int index;
+    if (!yip || !fp) {
+        errno = EINVAL;
+        return -1;
     }
-    if (frame == Frame) {
-        assert(frame->tokens_depth == -1);
-        assert(frame->codes_depth == -1);
-    } else {
-        assert(frame->tokens_depth > 0);
-        assert(frame->codes_depth > 0);
-        assert(frame->tokens_depth <= depth_of(Tokens));
-        assert(frame->codes_depth <= depth_of(Codes));
+#ifdef TRACE_CYCLES
+    {
+        double seconds = (double)(clock() - Trace_clock) / CLOCKS_PER_SEC;
+        ticks_per_us = seconds > 0 ? (TRACE_TICKS() - Trace_ticks) / (seconds * 1e6) : 1e3;
+    }
+#else
+    ticks_per_us = CLOCKS_PER_SEC / 1e6;
+#endif /* TRACE_CYCLES */
+    fprintf(fp, "{\"traceEvents\":[");
+    for (index = 0; index < yip_trace_count(yip); index++) {
+        const YIP_TRACE_EVENT *event = yip_trace_event(yip, index);
+        const char *machine = event->machine < machines_count() ? all_machine_stats[event->machine].name : "limit";
+        double us = (event->ticks - Trace_ticks) / ticks_per_us;
+        if (event->kind == YIP_TRACE_EXIT && !depth) continue;
+        fputs(separator, fp);
+        separator = ",\n";
+        switch (event->kind) {
+        case YIP_TRACE_ENTER:
+            depth++;
+            fprintf(fp, "{\"name\":\"%s\",\"ph\":\"B\",\"ts\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"byte\":%ld}}",
+                    machine, us, event->byte_offset);
+            break;
+        case YIP_TRACE_EXIT:
+            depth--;
+            fprintf(fp, "{\"name\":\"%s\",\"ph\":\"E\",\"ts\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"byte\":%ld,\"status\":%d}}",
+                    machine, us, event->byte_offset, event->value);
+            break;
+        default:
+            assert(event->kind < numof(trace_kind_names));
+            fprintf(fp, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":1,"
+                    "\"args\":{\"machine\":\"%s\",\"byte\":%ld,\"value\":%d}}",
+                    trace_kind_names[event->kind], us, machine, event->byte_offset, event->value);
+            break;
+        }
     }
+    fprintf(fp, "\n]}\n");
+    return ferror(fp) ? -1 : 0;
+#else
+    (void)yip;
+    (void)fp;
+    errno = ENOSYS;
+    return -1;
+#endif /* YIP_TRACE */
 }
 
-/*
-#define HERE fprintf(stderr, "%s: %d: %s:\n", __FILE__, __LINE__, __FUNCTION__)
-#define yip_invariant(Y) yip__invariant(Y, __FILE__, __LINE__, __FUNCTION__)
-*/
-
-/* Asserts invariant always held by parsers. */
-static void yip_invariant(const YIP *yip/*, const char *file, int line, const char *function*/) {
-    /*fprintf(stderr, "%s: %d: %s:", file, line, function);*/
-    assert(yip);
-    assert(Source);
-    assert(Machine);
-    source_invariant(Source);
-    stack_invariant(Codes, NULL, NULL);
-    stack_invariant(Tokens, token_invariant, yip);
-    stack_invariant(Frames, frame_invariant, yip);
-    if (yip_code_type(Token->code) != YIP_FAKE) assert(Token->buffer->end == Curr->buffer->begin);
-    assert(Next_return_token <= depth_of(Tokens));
-    assert(Next_return_token >= 0 || Token->code == YIP_UNPARSED || Token->code == Code);
-    /*fprintf(stderr, " OK\n");*/
+/* Start recording entry points at returned begin tokens of some codes, or stop if there are no codes. */
+int yip_index(YIP *yip, const char *codes, int max_depth) {
+    char index_codes[128];
+    int is_indexing = 0;
+    if (!yip || max_depth < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    memset(index_codes, 0, sizeof(index_codes));
+    for (; codes && *codes; codes++) {
+        if (*codes < 0 || yip_code_type(*codes) != YIP_BEGIN) {
+            errno = EINVAL;
+            return -1;
+        }
+        index_codes[(int)*codes] = 1;
+        is_indexing = 1;
+    }
+    memcpy(Index_codes, index_codes, sizeof(index_codes));
+    Is_indexing = is_indexing;
+    Index_max_depth = max_depth;
+    Index_count = 0;
+    Index_errno = 0;
+    Index_depth = 0;
+    return 0;
 }
 
-/* Consume the next byte from a buffer ending at "end" into a buffer starting at "*begin". */
-static int next_byte(const unsigned char **begin, const unsigned char *end) {
-    if (*begin >= end) return -1;
-    else {
-        int code = **begin;
-        ++*begin;
-        return code;
+/* Return the number of recorded entry points, or -1 with errno if recording failed. */
+int yip_index_count(const YIP *yip) {
+    if (!yip) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (Index_errno) {
+        errno = Index_errno;
+        return -1;
     }
+    return Index_count;
 }
 
-/* Consume a UTF8 character from the buffer starting at "*begin" and ending at "end". */
-int yip_decode_utf8(const unsigned char **begin, const unsigned char *end) {
-    int code;
-    int continuations;
-    code = next_byte(begin, end);
-    if (code < 0) return INVALID_CODE;
-    if (!(code & 0x80)) return code;        /* 0xxxxxxx. */
-    if ((code & 0xE0) == 0xC0) {            /* 110xxxxx 10xxxxxx X 1 */
-        code &= 0x1F;
-        continuations = 1;
-    } else if ((code & 0xF0) == 0xE0) {     /* 1110xxxx 10xxxxxx X 2 */
-        code &= 0xF;
-        continuations = 2;
-    } else if ((code & 0xF8) == 0xF0) {     /* 11110xxx 10xxxxxx X 3 */
-        code &= 0x7;
-        continuations = 3;
-    } else if ((code & 0xFC) == 0xF8) {     /* 111110xx 10xxxxxx X 4 */
-        code &= 0x3;
-        continuations = 4;
-    } else if ((code & 0xFE) == 0xFC) {     /* 1111110x 10xxxxxx X 5 */
-        code &= 0x1;
-        continuations = 5;
-    } else return INVALID_CODE;
-    while (continuations-- > 0) {
-        if (*begin >= end) return INVALID_CODE;
-        else {
-            int next = next_byte(begin, end);
-            if (next < 0) return INVALID_CODE;
-            if ((next & 0xC0) != 0x80) return INVALID_CODE;
-            code <<= 6;
-            code |= next & 0x3F;
-        }
+/* Return a recorded entry point given its index, or NULL with errno. */
+const YIP_INDEX_ENTRY *yip_index_entry(const YIP *yip, int index) {
+    if (yip_index_count(yip) < 0) return NULL;
+    if (index < 0 || index >= Index_count) {
+        errno = EINVAL;
+        return NULL;
     }
-    return code;
+    return Index_entries + index;
 }
 
-/* Consume a UTF16LE character from the buffer starting at "*begin" and ending at "end". */
-int yip_decode_utf16le(const unsigned char **begin, const unsigned char *end) {
-    int code0 = next_byte(begin, end);
-    if (code0 < 0) return INVALID_CODE;
-    else {
-        int code1 = next_byte(begin, end);
-        if (code1 < 0) return INVALID_CODE;
-        else {
-            int code01 = code0 | code1 << 8;
-            if (0xDC00 <= code01 && code01 < 0xE000) return INVALID_CODE;
-            if (code01 < 0xD800 || 0xDC00 <= code01) return code01;
-            else {
-                int code2 = next_byte(begin, end);
-                if (code2 < 0) return INVALID_CODE;
-                else {
-                    int code3 = next_byte(begin, end);
-                    if (code3 < 0) return INVALID_CODE;
-                    else {
-                        int code23 = code2 | code3 << 8;
-                        if (code23 < 0xDC00 || 0xE000 <= code23) return INVALID_CODE;
-                        return (code01 << 10) + code23 + 0x10000 - (0xD800 << 10) - 0xDC00;
-                    }
-                }
-            }
-        }
+/* Index files start with a magic number and the number of entries, followed by fixed size little endian entries. */
+static const char index_magic[4] = { 'Y', 'I', 'P', 'X' };
+#define INDEX_HEADER_SIZE 8
+#define INDEX_ENTRY_SIZE 32
+
+/* Store a number as little endian bytes. */
+static void put_index_number(unsigned char *bytes, long number, int size) {
+    unsigned long bits = (unsigned long)number;
+    while (size-- > 0) {
+        *bytes++ = (unsigned char)(bits & 0xFF);
+        bits >>= 8;
     }
 }
 
-/* Consume a UTF16BE character from the buffer starting at "*begin" and ending at "end". */
-int yip_decode_utf16be(const unsigned char **begin, const unsigned char *end) {
-    int code0 = next_byte(begin, end);
-    if (code0 < 0) return INVALID_CODE;
-    else {
-        int code1 = next_byte(begin, end);
-        if (code1 < 0) return INVALID_CODE;
-        else {
-            int code01 = code0 << 8 | code1;
-            if (0xDC00 <= code01 && code01 < 0xE000) return INVALID_CODE;
-            if (code01 < 0xD800 || 0xDC00 <= code01) return code01;
-            else {
-                int code2 = next_byte(begin, end);
-                if (code2 < 0) return INVALID_CODE;
-                else {
-                    int code3 = next_byte(begin, end);
-                    if (code3 < 0) return INVALID_CODE;
-                    else {
-                        int code23 = code2 << 8 | code3;
-                        if (code23 < 0xDC00 || 0xE000 <= code23) return INVALID_CODE;
-                        return (code01 << 10) + code23 + 0x10000 - (0xD800 << 10) - 0xDC00;
-                    }
-                }
-            }
-        }
-    }
+/* Fetch a number stored as little endian bytes. */
+static long get_index_number(const unsigned char *bytes, int size) {
+    unsigned long bits = 0;
+    while (size-- > 0) bits = bits << 8 | bytes[size];
+    return (long)bits;
 }
 
-/* Consume a UTF32LE character from the buffer starting at "*begin" and ending at "end". */
-int yip_decode_utf32le(const unsigned char **begin, const unsigned char *end) {
-    int code0 = next_byte(begin, end);
-    if (code0 < 0) return INVALID_CODE;
-    else {
-        int code1 = next_byte(begin, end);
-        if (code1 < 0) return INVALID_CODE;
-        else {
-            int code2 = next_byte(begin, end);
-            if (code2 < 0) return INVALID_CODE;
-            else {
-                int code3 = next_byte(begin, end);
-                if (code3 < 0) return INVALID_CODE;
-                else {
-                    return code0 | code1 << 8 | code2 << 16 | code3 << 24;
-                }
-            }
-        }
+/* Write the recorded entry points to an index file. */
+int yip_index_write(const YIP *yip, FILE *fp) {
+    unsigned char bytes[INDEX_ENTRY_SIZE];
+    int index;
+    if (!fp || yip_index_count(yip) < 0) {
+        if (!fp) errno = EINVAL;
+        return -1;
+    }
+    memcpy(bytes, index_magic, sizeof(index_magic));
+    put_index_number(bytes + 4, Index_count, 4);
+    if (fwrite(bytes, INDEX_HEADER_SIZE, 1, fp) != 1) return -1;
+    for (index = 0; index < Index_count; index++) {
+        const YIP_INDEX_ENTRY *entry = Index_entries + index;
+        put_index_number(bytes, entry->byte_offset, 8);
+        put_index_number(bytes + 8, entry->char_offset, 8);
+        put_index_number(bytes + 16, entry->line, 8);
+        put_index_number(bytes + 24, entry->line_char, 4);
+        put_index_number(bytes + 28, entry->encoding, 1);
+        put_index_number(bytes + 29, entry->code, 1);
+        put_index_number(bytes + 30, entry->depth, 2);
+        if (fwrite(bytes, INDEX_ENTRY_SIZE, 1, fp) != 1) return -1;
     }
+    return fflush(fp) == EOF ? -1 : 0;
 }
 
-/* Consume a UTF32BE character from the buffer starting at "*begin" and ending at "end". */
-int yip_decode_utf32be(const unsigned char **begin, const unsigned char *end) {
-    int code0 = next_byte(begin, end);
-    if (code0 < 0) return INVALID_CODE;
-    else {
-        int code1 = next_byte(begin, end);
-        if (code1 < 0) return INVALID_CODE;
-        else {
-            int code2 = next_byte(begin, end);
-            if (code2 < 0) return INVALID_CODE;
-            else {
-                int code3 = next_byte(begin, end);
-                if (code3 < 0) return INVALID_CODE;
-                else {
-                    return code0 << 24 | code1 << 16 | code2 << 8 | code3;
-                }
-            }
-        }
+/* Read bytes from an index file at some offset. A short file is not an index file. */
+static int read_index_bytes(FILE *fp, long offset, unsigned char *bytes, int size) {
+    if (fseek(fp, offset, SEEK_SET) < 0) return -1;
+    if (fread(bytes, size, 1, fp) != 1) {
+        if (!ferror(fp)) errno = EINVAL;
+        return -1;
     }
+    return 0;
 }
 
-/* Consume a Unicode character from the buffer starting at "*begin" and ending at "end". */
-int yip_decode(YIP_ENCODING encoding, const unsigned char **begin, const unsigned char *end) {
-    switch (encoding) {
-    case YIP_UTF8:    return yip_decode_utf8(begin, end);
-    case YIP_UTF16LE: return yip_decode_utf16le(begin, end);
-    case YIP_UTF16BE: return yip_decode_utf16be(begin, end);
-    case YIP_UTF32LE: return yip_decode_utf32le(begin, end);
-    case YIP_UTF32BE: return yip_decode_utf32be(begin, end);
-    default:          assert(0); errno = EINVAL; return INVALID_CODE;
+/* Read an entry point from an index file, returning the number of entries in it, or -1 with errno. */
+int yip_index_read(FILE *fp, int index, YIP_INDEX_ENTRY *entry) {
+    unsigned char bytes[INDEX_ENTRY_SIZE];
+    long count;
+    if (!fp) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (read_index_bytes(fp, 0, bytes, INDEX_HEADER_SIZE) < 0) return -1;
+    count = get_index_number(bytes + 4, 4);
+    if (memcmp(bytes, index_magic, sizeof(index_magic)) || count < 0 || count > INT_MAX) {
+        errno = EINVAL;
+        return -1;
     }
+    if (!entry) return (int)count;
+    if (index < 0 || index >= count) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (read_index_bytes(fp, INDEX_HEADER_SIZE + (long)index * INDEX_ENTRY_SIZE, bytes, INDEX_ENTRY_SIZE) < 0) return -1;
+    entry->byte_offset = get_index_number(bytes, 8);
+    entry->char_offset = get_index_number(bytes + 8, 8);
+    entry->line = get_index_number(bytes + 16, 8);
+    entry->line_char = get_index_number(bytes + 24, 4);
+    entry->encoding = (YIP_ENCODING)get_index_number(bytes + 28, 1);
+    entry->code = (YIP_CODE)get_index_number(bytes + 29, 1);
+    entry->depth = (int)get_index_number(bytes + 30, 2);
+    if (entry->encoding > YIP_UTF32BE || yip_code_type(entry->code) != YIP_BEGIN) {
+        errno = EINVAL;
+        return -1;
+    }
+    return (int)count;
 }
 
-/* Data for rebasing buffers. */
-typedef struct REBASE {
-    YIP_BUFFER before[1]; /* Buffer before rebase. */
-    YIP_BUFFER after[1];  /* Buffer after rebase. */
-} REBASE;
+/* Number of copied bytes gathered by a writer before they are written. */
+static const long WRITER_BUFFER_SIZE = 65536;
 
-static void rebase_invariant(const REBASE *rebase) {
-    assert(rebase->before->begin != rebase->after->begin);
-    assert(rebase->before->begin && rebase->before->end);
-    assert(rebase->after->begin && rebase->after->end);
-    assert(rebase->before->begin < rebase->before->end);
-    assert(rebase->after->begin < rebase->after->end);
-    assert(size_of(rebase->after) > size_of(rebase->before));
-}
+/* Maximal number of pieces gathered by a writer before they are written. */
+#define WRITER_PIECES 64
 
-/* Move a relative pointer to "the same place" after a buffer was reallocated to a new address. */
-static const unsigned char *rebase_pointer(const unsigned char *old_pointer, const REBASE *rebase) {
-    const unsigned char *new_pointer = rebase->after->begin + (old_pointer - rebase->before->begin);
-    assert(old_pointer);
-    assert(new_pointer);
-    assert(rebase->before->begin <= old_pointer && old_pointer <= rebase->before->end);
-    assert(rebase->after->begin <= new_pointer && new_pointer <= rebase->after->end);
-    return new_pointer;
-}
+/* Minimal number of token bytes written directly from the token rather than copied, when this is possible. */
+static const long WRITER_DIRECT_SIZE = 256;
 
-/* Move token's relative pointers to "the same place" after the buffer was realocated to a new address. */
-static void rebase_token(YIP_TOKEN *token, const REBASE *rebase) {
-    token->buffer->begin = rebase_pointer(token->buffer->begin, rebase);
-    token->buffer->end = rebase_pointer(token->buffer->end, rebase);
-}
+/* Maximal number of bytes written for a single token other than its (possibly escaped) bytes. */
+#define WRITER_HEADER_SIZE 128
 
-/* Move stack frame's relative pointers to "the same place" after the buffer was realocated to a new address. */
-static void rebase_frame(FRAME *frame, const REBASE *rebase) {
-    rebase_token(frame->curr->token, rebase);
-    rebase_token(frame->prev->token, rebase);
-}
+/* Maximal number of bytes in the varints written before the bytes of a binary token. */
+#define READER_HEADER_SIZE 60
 
-/* Move to the next input character. */
-static int next_char(YIP *yip) {
-    static const int MAX_UTF_SIZE = 6; /* UTF8 goes up to 6 bytes. */
-    REBASE rebase[1] = { { { { Source->buffer->begin, Source->buffer->end } }, { { NULL, NULL } } } };
-    if (Curr->code != NO_CODE) yip_invariant(yip);
-    if (Curr->code == EOF) return 0;
-    assert(Token->buffer->end == Curr->buffer->begin);
-    assert(Token->code != NO_CODE || Curr->code == NO_CODE);
-    *Prev_char = *Curr_char;
-    Curr->byte_offset += size_of(Curr->buffer);
-    Curr->char_offset++;
-    Curr->line_char++;
-    Curr->buffer->begin = Curr->buffer->end;
-    Token->buffer->end = Curr->buffer->begin;
-    if (!Did_see_eof && Curr->byte_offset + MAX_UTF_SIZE > end_offset(Source) && Source->more(Source, DYNAMIC_BUFFER_SIZE) < 0) return -1;
-    if (rebase->before->begin != Source->buffer->begin) {
-        rebase->after->begin = Source->buffer->begin;
-        rebase->after->end = Source->buffer->end;
-        rebase_invariant(rebase);
-        stack_apply(Tokens, rebase_token, rebase);
-        stack_apply(Frames, rebase_frame, rebase);
-    }
-    if (Curr->buffer->begin == Source->buffer->end) {
-        Did_see_eof = 1;
-        Curr->code = EOF;
-    } else {
-        Curr->code = yip_decode(Encoding, &Curr->buffer->end, Source->buffer->end);
+/* Binary token files start with a magic number. */
+static const char binary_magic[4] = { 'Y', 'I', 'P', 'B' };
+
+/* Writer of tokens to a file descriptor. Copied bytes are gathered in the buffer, and all the bytes are written as
+ * pieces using a single writev. */
+struct YIP_WRITER {
+    int fd;                     /* File descriptor to write to. */
+    int to_close;               /* Whether to close the file descriptor. */
+    YIP_FORMAT format;          /* Format of the written tokens. */
+    const YIP *yip;             /* Parser of the written tokens, to compute their positions, or NULL. */
+    unsigned char *buffer;      /* Copied bytes. */
+    long size;                  /* Number of copied bytes. */
+    long piece;                 /* Offset of the first copied byte not gathered as a piece yet. */
+    struct iovec pieces[WRITER_PIECES]; /* Gathered pieces. */
+    int pieces_count;           /* Number of gathered pieces. */
+    long byte_offset;           /* Byte offset of the previous binary token. */
+    long char_offset;           /* Character offset of the previous binary token. */
+    long line;                  /* Line of the previous binary token. */
+};
+
+/* Store an unsigned LEB128 varint, returning the number of bytes used. */
+static int put_varint(unsigned char *bytes, unsigned long value) {
+    int size = 0;
+    while (value >= 0x80) {
+        bytes[size++] = (unsigned char)(value | 0x80);
+        value >>= 7;
     }
-    Curr_char->mask = code_mask(Curr->code);
-    if ((Prev->code < 0 || Prev->code == 0xFFFF) && Prev_char->mask & START_OF_LINE_MASK) Curr_char->mask |= START_OF_LINE_MASK;
-    if (Prev->code != NO_CODE) yip_invariant(yip);
+    bytes[size++] = (unsigned char)value;
+    return size;
+}
+
+/* Fetch an unsigned LEB128 varint, returning 0 or -1 if it is truncated or too long. */
+static int get_varint(const unsigned char **begin, const unsigned char *end, unsigned long *value) {
+    const unsigned char *next = *begin;
+    unsigned long bits = 0;
+    int shift = 0;
+    do {
+        if (next == end || shift >= (int)sizeof(bits) * 8) return -1;
+        bits |= (unsigned long)(*next & 0x7F) << shift;
+        shift += 7;
+    } while (*next++ & 0x80);
+    *begin = next;
+    *value = bits;
     return 0;
 }
 
-/* Move to the previous character. */
-/* TODO:
-static void prev_char(YIP *yip) {
-    yip_invariant(yip);
-    assert(Prev->code != NO_CODE);
-    *Curr_char = *Prev_char;
-    Token->buffer->end = Curr->buffer->begin;
-    yip_invariant(yip);
+/* Map a signed number to an unsigned one, so small negative numbers have short varints. */
+static unsigned long zigzag(long value) {
+    return value < 0 ? ((unsigned long)~value << 1) | 1 : (unsigned long)value << 1;
 }
-*/
 
-/* Move to the next input line. */
-static void next_line(YIP *yip) {
-    Curr_char->mask |= START_OF_LINE_MASK;
-    Curr->line_char = 0;
-    Curr->line++;
+/* Map a number stored by zigzag back to the signed number. */
+static long unzigzag(unsigned long bits) {
+    return bits & 1 ? ~(long)(bits >> 1) : (long)(bits >> 1);
 }
 
-/* Initialize YIP parser object. */
-static YIP *yip_init(YIP_SOURCE *source, int to_close, MACHINE machine, const YIP_PRODUCTION *production) {
-    if (!source || !machine) {
+/* Gather the copied bytes not gathered yet as a piece. */
+static void writer_close_piece(YIP_WRITER *writer) {
+    if (writer->size == writer->piece) return;
+    assert(writer->pieces_count < WRITER_PIECES);
+    writer->pieces[writer->pieces_count].iov_base = writer->buffer + writer->piece;
+    writer->pieces[writer->pieces_count].iov_len = writer->size - writer->piece;
+    writer->pieces_count++;
+    writer->piece = writer->size;
+}
+
+/* Write all the gathered pieces, retrying after partial writes. */
+int yip_writer_flush(YIP_WRITER *writer) {
+    struct iovec *piece;
+    int count;
+    if (!writer) {
         errno = EINVAL;
-        return NULL;
-    } else {
-        YIP *yip = (YIP *)calloc(sizeof(*yip), 1);
-        if (!yip) return NULL;
-        if ((Encoding = detect_encoding(source)) < 0) {
-            errno = EILSEQ;
-            yip_close(yip);
-            return NULL;
-        }
-        Source = source;
-        Machine = machine;
-        To_close = to_close;
-        Next_return_token = -1;
-        I = NO_INDENT;
-        N = production && production->n ? atoi(production->n) : NO_INDENT;
-        Encoding = detect_encoding(Source);
-        if (Encoding < 0
-         || stack_init(Codes, production ? 1 : 128) < 0
-         || stack_init(Tokens, production ? 1 : 128) < 0
-         || stack_init(Frames, production ? 1 : 128) < 0) {
-            yip_close(yip);
-            return NULL;
+        return -1;
+    }
+    writer_close_piece(writer);
+    piece = writer->pieces;
+    count = writer->pieces_count;
+    writer->size = writer->piece = 0;
+    writer->pieces_count = 0;
+    while (count > 0) {
+        ssize_t size = writev(writer->fd, piece, count);
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            return -1;
         }
-        Code = YIP_UNPARSED;
-        Frame->tokens_depth = -1;
-        Frame->codes_depth = -1;
-        Curr->byte_offset = 0;
-        Curr->char_offset = -1;
-        Curr->line = 1;
-        Curr->line_char = -1;
-        Curr->buffer->begin = Curr->buffer->end = Source->buffer->begin;
-        Curr->encoding = Encoding;
-        Curr->code = NO_CODE;
-        Curr_char->mask = START_OF_LINE_MASK;
-        *Prev_char = *Curr_char;
-        *Token = *Curr;
-        if (next_char(yip) < 0) {
-            yip_close(yip);
-            return NULL;
+        for (; count > 0 && (size_t)size >= piece->iov_len; piece++, count--) size -= piece->iov_len;
+        if (count > 0) {
+            piece->iov_base = (char *)piece->iov_base + size;
+            piece->iov_len -= size;
         }
-        *Token = *Curr;
-        Token->code = YIP_UNPARSED;
-        Token->buffer->end = Token->buffer->begin;
-        yip_invariant(yip);
-        return yip;
     }
+    return 0;
 }
 
-/* Start collecting characters to a new token. */
-static RETURN begin_token(YIP *yip, YIP_CODE code) {
-    yip_invariant(yip);
-    assert(Next_return_token < 0);
-    assert(yip_code_type(code) == YIP_MATCH || code == YIP_BOM);
-    if (stack_push(Codes) < 0) return RETURN_ERROR;
-    Code = code;
-    if (!size_of(Token->buffer)) {
-        Token->code = code;
-        yip_invariant(yip);
-        return RETURN_DONE;
+/* Make room for copying some bytes, writing the gathered pieces if needed. */
+static int writer_reserve(YIP_WRITER *writer, long size) {
+    if (writer->size + size <= WRITER_BUFFER_SIZE && writer->pieces_count < WRITER_PIECES - 1) return 0;
+    return yip_writer_flush(writer);
+}
+
+/* Gather bytes, either copying them or (if allowed and worthwhile) as a piece of their own. */
+static int writer_bytes(YIP_WRITER *writer, const unsigned char *begin, long size, int is_direct) {
+    if (is_direct && size >= WRITER_DIRECT_SIZE) {
+        if (writer->pieces_count >= WRITER_PIECES - 2 && yip_writer_flush(writer) < 0) return -1;
+        writer_close_piece(writer);
+        writer->pieces[writer->pieces_count].iov_base = (void *)begin;
+        writer->pieces[writer->pieces_count].iov_len = size;
+        writer->pieces_count++;
+        return 0;
     }
-    if (depth_of(Frames) == 1) {
-        assert(depth_of(Tokens) == 1);
-        Next_return_token = 0;
-        yip_invariant(yip);
-        return RETURN_TOKEN;
+    while (size > 0) {
+        long part = WRITER_BUFFER_SIZE - writer->size;
+        if (!part) {
+            if (yip_writer_flush(writer) < 0) return -1;
+            continue;
+        }
+        if (part > size) part = size;
+        memcpy(writer->buffer + writer->size, begin, part);
+        writer->size += part;
+        begin += part;
+        size -= part;
     }
-    if (stack_push(Tokens) < 0) return RETURN_ERROR;
-    *Token = *Curr;
-    Token->buffer->end = Token->buffer->begin;
-    Token->code = code;
-    return RETURN_DONE;
+    return 0;
 }
 
-/* End collecting characters to a token. */
-static RETURN end_token(YIP *yip, YIP_CODE code) {
-    yip_invariant(yip);
-    assert(Next_return_token < 0);
-    assert(code == Token->code || code == YIP_UNPARSED);
-    if (depth_of(Codes) == 1) assert(Code == YIP_UNPARSED);
-    else stack_pop(Codes);
-    if (!size_of(Token->buffer)) {
-        Token->code = Code;
-        yip_invariant(yip);
-        return RETURN_DONE;
-    }
-    Token->code = code;
-    if (Token->code == YIP_BOM) {
-        Token->buffer->begin = (const unsigned char *)encoding_names[Token->encoding] + 1;
-        Token->buffer->end = Token->buffer->begin + strlen((const char *)Token->buffer->begin);
-        Token->encoding = YIP_UTF8;
+/* Gather a token as a line of textual YEAST. Runs of UTF8 bytes which need no escaping are gathered as they are. */
+static int writer_put_text(YIP_WRITER *writer, const YIP_TOKEN *token, long line, long line_char, int is_direct) {
+    const unsigned char *begin = token->buffer->begin;
+    const unsigned char *end = token->buffer->end;
+    if (token->code == YIP_DONE) return 0;
+    if (writer_reserve(writer, WRITER_HEADER_SIZE) < 0) return -1;
+    if (writer->format == YIP_YEAST_POSITIONS)
+        writer->size += sprintf((char *)writer->buffer + writer->size, "# B: %ld, C: %ld, L: %ld, c: %ld\n",
+                                token->byte_offset, token->char_offset, line, line_char);
+    writer->buffer[writer->size++] = (unsigned char)token->code;
+    while (begin && begin < end) {
+        const unsigned char *run = begin;
+        if (token->encoding == YIP_UTF8)
+            while (run < end && ' ' <= *run && *run <= '~' && (*run != '\\' || token->code == YIP_ERROR)) run++;
+        if (run > begin) {
+            if (writer_bytes(writer, begin, run - begin, is_direct) < 0) return -1;
+            begin = run;
+        } else {
+            char *text;
+            int code = yip_decode(token->encoding, &run, end);
+            if (writer_reserve(writer, 4 * MAX_UTF_SIZE) < 0) return -1;
+            text = (char *)writer->buffer + writer->size;
+            if (code < 0) while (begin < run) text += sprintf(text, "\\x%02x", *begin++);
+            else if (' ' <= code && (token->code == YIP_ERROR || code != '\\') && code <= '~') *text++ = (char)code;
+            else if (code <= 0xFF)   text += sprintf(text, "\\x%02x", code);
+            else if (code <= 0xFFFF) text += sprintf(text, "\\u%04x", code);
+            else                     text += sprintf(text, "\\U%08x", code);
+            writer->size = (unsigned char *)text - writer->buffer;
+            begin = run;
+        }
     }
-    if (depth_of(Frames) == 1) {
-        assert(depth_of(Tokens) == 1);
-        Next_return_token = 0;
-        yip_invariant(yip);
-        return RETURN_TOKEN;
+    if (writer_reserve(writer, 1) < 0) return -1;
+    writer->buffer[writer->size++] = '\n';
+    return 0;
+}
+
+/* Gather a token in the binary format. */
+static int writer_put_binary(YIP_WRITER *writer, const YIP_TOKEN *token, long line, long line_char, int is_direct) {
+    long size = token->buffer->begin ? size_of(token->buffer) : 0;
+    unsigned char *bytes;
+    if (writer_reserve(writer, WRITER_HEADER_SIZE) < 0) return -1;
+    bytes = writer->buffer + writer->size;
+    bytes += put_varint(bytes, token->code + 128ul * token->encoding);
+    bytes += put_varint(bytes, zigzag(token->byte_offset - writer->byte_offset));
+    bytes += put_varint(bytes, zigzag(token->char_offset - writer->char_offset));
+    bytes += put_varint(bytes, zigzag(line - writer->line));
+    bytes += put_varint(bytes, zigzag(line_char));
+    bytes += put_varint(bytes, size);
+    writer->size = bytes - writer->buffer;
+    writer->byte_offset = token->byte_offset;
+    writer->char_offset = token->char_offset;
+    writer->line = line;
+    return writer_bytes(writer, token->buffer->begin, size, is_direct);
+}
+
+/* Gather a token in the writer's format. Positions are computed by the parser if there is one, as they are not kept in
+ * the tokens when lines are tracked lazily. */
+static int writer_put(YIP_WRITER *writer, const YIP_TOKEN *token, int is_direct) {
+    long line = token->line;
+    long line_char = token->line_char;
+    if (token->code < 0 || yip_code_type(token->code) < 0 || token->encoding < YIP_UTF8 || token->encoding > YIP_UTF32BE) {
+        errno = EINVAL;
+        return -1;
     }
-    if (stack_push(Tokens) < 0) return RETURN_ERROR;
-    *Token = *Curr;
-    Token->buffer->end = Token->buffer->begin;
-    Token->code = Code;
-    yip_invariant(yip);
-    return RETURN_DONE;
+    if (writer->format != YIP_YEAST && writer->yip && yip_token_position(writer->yip, token, &line, &line_char, NULL) < 0)
+        return -1;
+    if (writer->format == YIP_YEAST_BINARY) return writer_put_binary(writer, token, line, line_char, is_direct);
+    return writer_put_text(writer, token, line, line_char, is_direct);
 }
 
-/* Return a fake token to the caller. */
-static RETURN fake_token(YIP *yip, YIP_CODE code, const char *text) {
-    yip_invariant(yip);
-    assert(Next_return_token < 0);
-    if (text) assert(yip_code_type(code) == YIP_FAKE);
-    else      assert(code == YIP_DONE || yip_code_type(code) == YIP_BEGIN || yip_code_type(code) == YIP_END);
-    if (size_of(Token->buffer)) {
-        if (stack_push(Tokens) < 0) return RETURN_ERROR;
-        *Token = *Curr;
-        Token->buffer->end = Token->buffer->begin;
+/* Create a writer of tokens to a file descriptor. */
+YIP_WRITER *yip_writer(int fd, int to_close, YIP_FORMAT format, const YIP *yip) {
+    YIP_WRITER *writer;
+    if (fd < 0 || format < YIP_YEAST || format > YIP_YEAST_BINARY) {
+        errno = EINVAL;
+        writer = NULL;
+    } else if ((writer = (YIP_WRITER *)calloc(1, sizeof(*writer)))
+            && !(writer->buffer = (unsigned char *)malloc(WRITER_BUFFER_SIZE))) {
+        free(writer);
+        writer = NULL;
     }
-    Token->code = code;
-    if (text) {
-        Token->buffer->begin = (const unsigned char *)text;
-        Token->buffer->end = Token->buffer->begin + strlen(text);
+    if (!writer) {
+        int saved_errno = errno;
+        if (fd >= 0 && to_close) close(fd);
+        errno = saved_errno;
+        return NULL;
     }
-    if (depth_of(Frames) == 1) {
-        assert(depth_of(Tokens) <= 2);
-        Next_return_token = 0;
-        yip_invariant(yip);
-        return RETURN_TOKEN;
+    writer->fd = fd;
+    writer->to_close = to_close;
+    writer->format = format;
+    writer->yip = yip;
+    if (format == YIP_YEAST_BINARY) {
+        memcpy(writer->buffer, binary_magic, sizeof(binary_magic));
+        writer->size = sizeof(binary_magic);
     }
-    if (stack_push(Tokens) < 0) return RETURN_ERROR;
-    *Token = *Curr;
-    Token->buffer->end = Token->buffer->begin;
-    Token->code = Code;
-    yip_invariant(yip);
-    return RETURN_DONE;
+    return writer;
 }
 
-/* Return an empty token to the caller. */
-static RETURN empty_token(YIP *yip, YIP_CODE code) {
-    return fake_token(yip, code, NULL);
+/* Write a token, copying its bytes. */
+int yip_writer_put(YIP_WRITER *writer, const YIP_TOKEN *token) {
+    if (!writer || !token) {
+        errno = EINVAL;
+        return -1;
+    }
+    return writer_put(writer, token, 0);
 }
 
-/* Return an error for an unexpected input character. */
-static RETURN unexpected(YIP *yip) {
-    static char buffer[24];
-    if (Curr->code == INVALID_CODE) return fake_token(yip, YIP_ERROR, "Invalid byte sequence");
-    if (Curr->code == EOF)          return fake_token(yip, YIP_ERROR, "Unexpected end of input");
-    if (Curr->code == '\'')         return fake_token(yip, YIP_ERROR, "Unexpected \"'\"");
-    if (' ' <= Curr->code && Curr->code <= '~') sprintf((char *)buffer, "Unexpected '%c'", Curr->code);
-    else if (Curr->code <= 0xFF)                sprintf((char *)buffer, "Unexpected '\\x%02x'", Curr->code);
-    else if (Curr->code <= 0xFFFF)              sprintf((char *)buffer, "Unexpected '\\u%04x'", Curr->code);
-    else                                        sprintf((char *)buffer, "Unexpected '\\U%08x'", Curr->code);
-    return fake_token(yip, YIP_ERROR, buffer);
+/* Write a batch of tokens, referring to large runs of their bytes directly. These must be written before returning. */
+int yip_writer_put_tokens(YIP_WRITER *writer, const YIP_TOKEN *tokens, int count) {
+    int index;
+    if (!writer || (!tokens && count) || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (index = 0; index < count; index++)
+        if (writer_put(writer, tokens + index, 1) < 0) return -1;
+    return writer->pieces_count ? yip_writer_flush(writer) : 0;
 }
 
-/* Prevent further named backtracking. */
-static RETURN commit(YIP *yip, CHOICE choice) {
-    return fake_token(yip, YIP_ERROR, choices_error[choice]);
+/* Write all the buffered tokens and release the writer. */
+int yip_writer_close(YIP_WRITER *writer) {
+    int status;
+    if (!writer) {
+        errno = EINVAL;
+        return -1;
+    }
+    status = yip_writer_flush(writer);
+    if (writer->to_close && close(writer->fd) < 0) status = -1;
+    free(writer->buffer);
+    free(writer);
+    return status;
 }
 
-/* Push current state for backtracking. */
-static int push_state(YIP *yip) {
-    yip_invariant(yip);
-    assert(!size_of(Token->buffer));
-    assert(Token->code == YIP_UNPARSED);
-    if (stack_push(Frames) < 0) return -1;
-    Frame[0] = Frame[-1];
-    Frame[-1].tokens_depth = depth_of(Tokens);
-    Frame[-1].codes_depth = depth_of(Codes);
-    yip_invariant(yip);
+/* Reader of tokens written in the binary format. */
+struct YIP_READER {
+    YIP_SOURCE *source;         /* Source of the written bytes. */
+    int to_close;               /* Whether to close the source. */
+    int is_done;                /* Whether the final token was returned. */
+    long consumed;              /* Number of source bytes of the returned token, released by the next call. */
+    YIP_TOKEN token[1];         /* Returned token, whose positions the next token's are relative to. */
+};
+
+/* Fetch source bytes until the buffer holds at least some number of them, or the source is exhausted. */
+static int reader_fill(YIP_READER *reader, long size) {
+    while (size_of(reader->source->buffer) < size) {
+        long missing = size - size_of(reader->source->buffer);
+        int status = reader->source->more(reader->source, missing > DYNAMIC_BUFFER_SIZE ? (int)missing
+                                                                                       : DYNAMIC_BUFFER_SIZE);
+        if (status < 0) return -1;
+        if (!status) break;
+    }
     return 0;
 }
 
-/* Update the state for backtracking. */
-static RETURN set_state(YIP *yip) {
-    yip_invariant(yip);
-    assert(depth_of(Frames) > 1);
-    assert(!size_of(Token->buffer));
-    assert(Token->code == YIP_UNPARSED);
-    Frame[-1] = Frame[0];
-    Frame[-1].codes_depth = depth_of(Codes);
-    if (depth_of(Frames) > 1 || depth_of(Tokens) == 1) {
-        Frame[-1].tokens_depth = depth_of(Tokens);
-        yip_invariant(yip);
-        return RETURN_DONE;
+/* Create a reader of tokens written in the binary format. */
+YIP_READER *yip_reader(YIP_SOURCE *source, int to_close) {
+    YIP_READER *reader;
+    if (!source) {
+        errno = EINVAL;
+        return NULL;
     }
-    Frame[-1].tokens_depth = 1;
-    stack_pop(Tokens);
-    Next_return_token = 0;
-    yip_invariant(yip);
-    return RETURN_TOKEN;
+    if (!(reader = (YIP_READER *)calloc(1, sizeof(*reader)))) return NULL;
+    reader->source = source;
+    reader->to_close = to_close;
+    if (reader_fill(reader, sizeof(binary_magic)) < 0) {
+        free(reader);
+        return NULL;
+    }
+    if (size_of(source->buffer) < (long)sizeof(binary_magic)
+     || memcmp(source->buffer->begin, binary_magic, sizeof(binary_magic))) {
+        free(reader);
+        errno = EILSEQ;
+        return NULL;
+    }
+    reader->consumed = sizeof(binary_magic);
+    return reader;
 }
 
-/* Backtrack to a previous state. */
-static void reset_state(YIP *yip) {
-    yip_invariant(yip);
-    assert(!size_of(Token->buffer));
-    assert(Token->code == YIP_UNPARSED);
-    assert(depth_of(Frames) > 1);
-    Frame[0] = Frame[-1];
-    Codes->top = Codes->begin + Frame->codes_depth - 1;
-    Token = Tokens->begin + Frame->tokens_depth - 1;
-    *Token = *Curr;
-    Token->buffer->end = Token->buffer->begin;
-    Token->code = Code;
-    Frame->tokens_depth = -1;
-    Frame->codes_depth = -1;
-    yip_invariant(yip);
+/* Return the next token read back, pointing into the source buffer. */
+const YIP_TOKEN *yip_reader_next_token(YIP_READER *reader) {
+    const unsigned char *next;
+    unsigned long code, byte_delta, char_delta, line_delta, line_char, size;
+    long header;
+    if (!reader) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (reader->is_done) return reader->token;
+    if (reader->consumed && reader->source->less(reader->source, (int)reader->consumed) < 0) return NULL;
+    reader->consumed = 0;
+    if (reader_fill(reader, READER_HEADER_SIZE) < 0) return NULL;
+    next = reader->source->buffer->begin;
+    if (get_varint(&next, reader->source->buffer->end, &code) < 0
+     || get_varint(&next, reader->source->buffer->end, &byte_delta) < 0
+     || get_varint(&next, reader->source->buffer->end, &char_delta) < 0
+     || get_varint(&next, reader->source->buffer->end, &line_delta) < 0
+     || get_varint(&next, reader->source->buffer->end, &line_char) < 0
+     || get_varint(&next, reader->source->buffer->end, &size) < 0
+     || yip_code_type((YIP_CODE)(code % 128)) < 0 || code / 128 > YIP_UTF32BE || size > INT_MAX) {
+        errno = EILSEQ;
+        return NULL;
+    }
+    header = next - reader->source->buffer->begin;
+    if (reader_fill(reader, header + (long)size) < 0) return NULL;
+    if (size_of(reader->source->buffer) < header + (long)size) {
+        errno = EILSEQ;
+        return NULL;
+    }
+    reader->token->buffer->begin = reader->source->buffer->begin + header;
+    reader->token->buffer->end = reader->token->buffer->begin + size;
+    reader->token->byte_offset += unzigzag(byte_delta);
+    reader->token->char_offset += unzigzag(char_delta);
+    reader->token->line += unzigzag(line_delta);
+    reader->token->line_char = unzigzag(line_char);
+    reader->token->encoding = (YIP_ENCODING)(code / 128);
+    reader->token->code = (YIP_CODE)(code % 128);
+    reader->consumed = header + size;
+    reader->is_done = reader->token->code == YIP_DONE;
+    return reader->token;
 }
 
-/* End backtracking keeping the current state. */
-static RETURN pop_state(YIP *yip) {
-    yip_invariant(yip);
-    assert(!size_of(Token->buffer));
-    assert(Token->code == YIP_UNPARSED);
-    assert(depth_of(Frames) > 1);
-    Frame[-1] = Frame[0];
-    Frame--;
-    Frame->tokens_depth = -1;
-    Frame->codes_depth = -1;
-    if (depth_of(Frames) > 1 || depth_of(Tokens) == 1) {
-        yip_invariant(yip);
-        return RETURN_DONE;
+/* Release a reader, closing the source if needed. */
+int yip_reader_close(YIP_READER *reader) {
+    int status = 0;
+    if (!reader) {
+        errno = EINVAL;
+        return -1;
     }
-    stack_pop(Tokens);
-    Next_return_token = 0;
-    yip_invariant(yip);
-    return RETURN_TOKEN;
+    if (reader->to_close) status = reader->source->close(reader->source);
+    free(reader);
+    return status;
 }
 
-/* Test whether current state has changed from pushed state. */
-static int is_same_state(YIP *yip) {
-    yip_invariant(yip);
-    assert(depth_of(Frames) > 1);
-    return Curr->buffer->begin == Frame[-1].curr->token->buffer->begin;
+/* Push more bytes to a parser reading from a feed source. */
+int yip_feed(YIP *yip, const void *bytes, int size, int is_last) {
+    if (!yip || Source->more != feed_more) {
+        errno = EINVAL;
+        return -1;
+    }
+    return feed_bytes(Source, bytes, size, is_last);
 }
 
-/* }}} */
-
-#include "functions.i"
-#include "by_name.i"
-
-/* {{{ */
-
-/* Locate production list by parameters. */
-static const MACHINE_BY_NAME *machine_by_parameters(const YIP_PRODUCTION *production) {
-    if (!production->n && !production->t) return machines;
-    if ( production->n && !production->t) return machines_with_n;
-    if (!production->n &&  production->t) return machines_with_t;
-    if (production->n  &&  production->t) return machines_with_nt;
-    errno = EINVAL;
-    return NULL;
+/* Collect the rest of the current input line, including its line break. */
+static int next_unparsed_line(YIP *yip) {
+    while (Curr->code != EOF) {
+        int code = Curr->code;
+        if (next_char(yip) < 0) return -1;
+        if (code == '\n' || (code == '\r' && Curr->code != '\n')) return next_line(yip);
+    }
+    return 0;
 }
 
-/* Locate production machine by name. */
-static MACHINE machine_by_name(const MACHINE_BY_NAME *by_name, const char *name, const char *context) {
-    int name_length = strlen(name);
-    int context_length = context ? (int)strlen(context) : -1;
-    for (; by_name->name; by_name++) {
-        if (context) {
-            int by_name_length = strlen(by_name->name);
-            if (by_name_length == name_length + 1 + context_length
-             && !strncmp(by_name->name, name, name_length)
-             && !strcmp(by_name->name + name_length + 1, context)) {
-                return by_name->machine;
+/* State machine used once a limit was exceeded. It returns the tokens committed before the oldest frame, the limit
+ * error, the rest of the input as unparsed lines, the end tokens of the groups still open and the final token. The end
+ * tokens are returned even if they are dropped at this point, since the caller has seen their begin tokens. */
+static RETURN limit_machine(YIP *yip) {
+    RETURN status;
+    TRACE_MACHINE(machines_count());
+    for (;;) {
+        switch (State) {
+        case 0:
+            if (depth_of(Tokens) > 1) {
+                stack_pop(Tokens);
+                Next_return_token = 0;
+                return RETURN_TOKEN;
             }
-        } else if (!strcmp(by_name->name, name)) {
-            return by_name->machine;
+            if ((status = fake_token(yip, YIP_ERROR, Limit_error)) == RETURN_ERROR) return status;
+            State = 1;
+            if (status == RETURN_TOKEN) return status;
+            break;
+        case 1:
+            if (next_unparsed_line(yip) < 0) return RETURN_ERROR;
+            if (!Token->byte_size) State = 2;
+            else if ((status = complete_token(yip)) != RETURN_DONE) return status;
+            break;
+        case 2:
+            if (depth_of(Groups) > 1) {
+                YIP_CODE code = yip_code_pair(*Groups->top);
+                char is_dropped = Token_filter[code];
+                Token_filter[code] = 0;
+                status = empty_token(yip, code);
+                Token_filter[code] = is_dropped;
+                return status;
+            }
+            State = 3;
+            break;
+        default:
+            return empty_token(yip, YIP_DONE);
         }
     }
-    return NULL;
 }
 
-/* Initialize a YIP parser object for a production with no parameters. */
-YIP *yip_test(YIP_SOURCE *source, int to_close, const YIP_PRODUCTION *production) {
-    const MACHINE_BY_NAME *by_name = machine_by_parameters(production);
-    if (!by_name) {
-        if (to_close) source->close(source);
-        return NULL;
-    } else {
-        MACHINE machine = machine_by_name(by_name, production->name, production->c);
-        if (!machine) {
-            if (to_close) source->close(source);
-            return NULL;
-        }
-        return yip_init(source, to_close, machine, production);
+/* Give up parsing after a limit was exceeded. This backtracks to the oldest frame, discarding everything collected
+ * since, and continues with the limit machine. */
+static void give_up(YIP *yip) {
+    if (depth_of(Frames) > 1) {
+        count_lookahead(yip);
+        Frames->top = Frames->begin;
+        Token = Tokens->begin + Frame->tokens_depth - 1;
+#ifdef YIP_LAZY_POSITIONS
+        Lines->top = Lines->begin + Frame->lines_depth - 1;
+        Frame->lines_depth = -1;
+#endif /* YIP_LAZY_POSITIONS */
+        reset_token(yip, YIP_UNPARSED);
+        Frame->tokens_depth = -1;
+        Frame->codes_depth = -1;
     }
-}
-
-/* Release a YIP parser object and release all allocated resources. */
-int yip_close(YIP *yip) {
-    YIP_SOURCE *source = Source;
-    int to_close = To_close;
-    yip_invariant(yip);
-    stack_close(Codes);
-    stack_close(Frames);
-    stack_close(Tokens);
-    free(yip);
-    if (to_close) return source->close(source);
-    return 0;
-}
-
-/* Return the next prepared token to the caller. */
-static const YIP_TOKEN *next_token(YIP *yip) {
-    const YIP_TOKEN *token = Tokens->begin + Next_return_token;
-    yip_invariant(yip);
-    assert(depth_of(Frames) == 1);
-    assert(Next_return_token >= 0);
-    if (token->code == YIP_DONE) return token;
-    Next_return_token++;
+    stack_clear(Codes);
+    Code = YIP_UNPARSED;
+    Token->code = YIP_UNPARSED;
+    Lookahead_limit = LONG_MAX;
+    Machine = limit_machine;
+    State = 0;
     yip_invariant(yip);
-    return token;
 }
 
-/* Reset after returning the last token. */
-static void last_token(YIP *yip) {
-    yip_invariant(yip);
-    assert(depth_of(Frames) == 1);
-    Next_return_token = -1;
-    Token = Tokens->begin;
-    *Token = *Curr;
-    Token->buffer->end = Token->buffer->begin;
-    Token->code = Code;
-    yip_invariant(yip);
+/* Run the state machine until it has tokens to return or fails. A machine failing due to an exceeded limit is replaced
+ * by the limit machine, which is traced as a machine of its own. */
+static RETURN run_machine(YIP *yip) {
+    RETURN status = (*Machine)(yip);
+    if (status == RETURN_ERROR && Limit_error && Machine != limit_machine) {
+        TRACE(YIP_TRACE_EXIT, status);
+        give_up(yip);
+        status = limit_machine(yip);
+    }
+    TRACE(YIP_TRACE_EXIT, status);
+    return status;
 }
 
 /* Return the next parsed token, or Null with errno. */
 const YIP_TOKEN *yip_next_token(YIP *yip) {
+    if (start(yip) < 0) return NULL;
     yip_invariant(yip);
-    if (Next_return_token >= depth_of(Tokens)) last_token(yip);
-    else if (Next_return_token >= 0) return next_token(yip);
-    switch ((*Machine)(yip)) {
+    if (Next_return_token >= depth_of(Tokens)) {
+        last_token(yip);
+        if (release_input(yip) < 0) return NULL;
+    } else if (Next_return_token >= 0) return next_token(yip);
+    switch (run_machine(yip)) {
     case RETURN_ERROR:
         return NULL;
     case RETURN_TOKEN:
@@ -1474,4 +4487,90 @@ const YIP_TOKEN *yip_next_token(YIP *yip) {
     }
 }
 
+/* Return up to "max" parsed tokens into "tokens", or -1 with errno. A batch ends early after the final #YIP_DONE
+ * token or a #YIP_ERROR token, whose text may be reused by the next error. The input is only released at the start of
+ * the next batch, so if the source buffer moves while parsing, the already collected tokens are simply re-pointed. */
+int yip_next_tokens(YIP *yip, YIP_TOKEN *tokens, int max) {
+    int count = 0;
+    if (!tokens || max <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (start(yip) < 0) return -1;
+    yip_invariant(yip);
+    if (Next_return_token >= depth_of(Tokens)) {
+        last_token(yip);
+        if (release_input(yip) < 0) return -1;
+    }
+    while (count < max) {
+        if (Next_return_token >= depth_of(Tokens)) last_token(yip);
+        else if (Next_return_token >= 0) {
+            const YIP_TOKEN *token = next_token(yip);
+            if (!token) return count ? count : -1;
+            tokens[count] = *token;
+            if (tokens[count++].code == YIP_DONE || tokens[count - 1].code == YIP_ERROR) break;
+            continue;
+        }
+        {
+            const unsigned char *begin = Source->buffer->begin;
+            RETURN status;
+            Is_batching = count > 0;
+            status = run_machine(yip);
+            Is_batching = 0;
+            if (Source->buffer->begin != begin) {
+                int index;
+                for (index = 0; index < count; index++)
+                    if (yip_code_type(tokens[index].code) != YIP_FAKE) {
+                        long size = size_of(tokens[index].buffer);
+                        tokens[index].buffer->begin = source_pointer(yip, tokens[index].byte_offset);
+                        tokens[index].buffer->end = tokens[index].buffer->begin + size;
+                    }
+            }
+            if (status == RETURN_ERROR) return count ? count : -1;
+            if (status != RETURN_TOKEN) {
+                assert(0);
+                errno = EFAULT;
+                return -1;
+            }
+        }
+    }
+    yip_invariant(yip);
+    return count;
+}
+
+/* Skip the rest of the group begun by the last returned token, up to and including its matching end token. While
+ * skipping, every token except the group's own begin and end tokens and the errors is dropped, so nothing is collected
+ * for backtracking and the skipped input is released as it is parsed. Since groups are always properly nested,
+ * counting the group's own code is enough to find its matching end. The count is kept in the parser, so a skip stopped
+ * by a feed source waiting for input (EAGAIN) is resumed by the next call. */
+const YIP_TOKEN *yip_skip_node(YIP *yip, int *errors) {
+    const YIP_TOKEN *token;
+    if (errors) *errors = 0;
+    if (!yip || (!Skip_depth && yip_code_type(Result->code) != YIP_BEGIN)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!Skip_depth) {
+        Skip_code = Result->code;
+        Skip_depth = 1;
+        Skip_errors = 0;
+        memcpy(Skip_filter, Token_filter, sizeof(Skip_filter));
+        memset(Token_filter, 1, sizeof(Token_filter));
+        Token_filter[YIP_DONE] = 0;
+        Token_filter[YIP_ERROR] = 0;
+        Token_filter[Skip_code] = 0;
+        Token_filter[yip_code_pair(Skip_code)] = 0;
+    }
+    while ((token = yip_next_token(yip)) != NULL) {
+        if (token->code == YIP_ERROR) Skip_errors++;
+        else if (token->code == Skip_code) Skip_depth++;
+        else if ((token->code == yip_code_pair(Skip_code) && !--Skip_depth) || token->code == YIP_DONE) break;
+    }
+    if (errors) *errors = Skip_errors;
+    if (!token && errno == EAGAIN) return NULL;
+    Skip_depth = 0;
+    memcpy(Token_filter, Skip_filter, sizeof(Skip_filter));
+    return token;
+}
+
 /* }}} */
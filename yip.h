@@ -26,6 +26,8 @@
  *
  * - @ref Parsers : Opaque YIP parsers.
  *
+ * - @ref Writers : Writing and reading back #YIP_TOKEN streams.
+ *
  * <b>General issues:</b>
  *
  * - <em>Run-time errors</em>:
@@ -40,7 +42,8 @@
  *   the parser. In practice, one can expect no memory operations at all once
  *   these stabilize to a sufficient size (which should be very quick), unless
  *   encountering a pathological input file. Testing with valgrind have shown
- *   no leaks or other problems.
+ *   no leaks or other problems. All this memory may be allocated using a
+ *   custom #YIP_ALLOCATOR.
  *
  * - <em>Thread safety</em>:
  *   No global variables are used (other than constants), so this should be as
@@ -261,6 +264,100 @@ extern int yip_decode_utf32le(const unsigned char **begin, const unsigned char *
  */
 extern int yip_decode_utf32be(const unsigned char **begin, const unsigned char *end);
 
+/**
+ * @brief Memory allocation hooks.
+ *
+ * By default, all memory is allocated using the standard malloc, realloc and
+ * free. Passing an allocator to #yip_test_with_allocator and to the source
+ * constructors (e.g. #yip_fp_source_with_allocator) allows using a different
+ * memory manager. All hooks are invoked with the #context of the allocator as
+ * their first argument.
+ *
+ * @see #yip_arena_allocator
+ */
+typedef struct YIP_ALLOCATOR {
+
+    /**
+     * @brief Allocate a block of memory.
+     *
+     * @return
+     *    The allocated (uninitialized) memory, or NULL (and sets errno) if
+     *    some error occured.
+     */
+    void *(*allocate)(void *context, size_t size);
+
+    /**
+     * @brief Change the size of a block of memory.
+     *
+     * Like realloc, the memory may be NULL (in which case the old size is
+     * zero), and the block may move, keeping its contents.
+     *
+     * @return
+     *    The reallocated memory, or NULL (and sets errno) if some error
+     *    occured, in which case the original memory is not released.
+     */
+    void *(*reallocate)(void *context, void *memory, size_t old_size, size_t new_size);
+
+    /**
+     * @brief Release a block of memory.
+     */
+    void (*release)(void *context, void *memory);
+
+    /**
+     * @brief Release the allocator itself. May be NULL.
+     *
+     * If not NULL, this is invoked by #yip_close, after the parser (and the
+     * source, if it is closed by the parser) released all their memory.
+     */
+    void (*close)(struct YIP_ALLOCATOR *allocator);
+
+    /**
+     * @brief Opaque context passed to all the hooks.
+     */
+    void *context;
+} YIP_ALLOCATOR;
+
+/**
+ * @brief Create an arena allocator.
+ *
+ * An arena allocates memory in large chunks and never releases individual
+ * blocks. Instead, all the memory is released at once when the arena is
+ * closed. This is useful for giving each parser its own arena, so that all its
+ * memory is released together by #yip_close.
+ *
+ * Blocks larger than a chunk (such as the buffers of sources reading large
+ * inputs) are the exception. These are allocated on their own, so they are
+ * resized and released like standard memory, and growing them does not leave
+ * old copies behind in the arena.
+ *
+ * The parser and its source may share the same arena, as long as the source is
+ * closed by the parser.
+ *
+ * @param chunk_size
+ *    The size of each chunk of memory. Larger blocks get a chunk of their own.
+ *    If zero, a reasonable default is used.
+ *
+ * @return
+ *    A new arena allocator, or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_ALLOCATOR
+ */
+extern YIP_ALLOCATOR *yip_arena_allocator(size_t chunk_size);
+
+/**
+ * @brief Return the amount of memory held by an arena allocator.
+ *
+ * @param allocator
+ *    An allocator returned by #yip_arena_allocator.
+ *
+ * @return
+ *    The number of bytes in the chunks and large blocks of the arena, or a
+ *    negative value (and sets errno) if some error occured.
+ *
+ * @see #yip_arena_allocator
+ */
+extern long yip_arena_size(const YIP_ALLOCATOR *allocator);
+
 /**
  * @}
  */
@@ -304,7 +401,8 @@ extern int yip_decode_utf32be(const unsigned char **begin, const unsigned char *
  *
  * @see #YIP_BUFFER
  * @see #yip_buffer_source, #yip_string_source, #yip_fp_source,
- *      #yip_fd_read_source, #yip_fd_map_source, #yip_path_source
+ *      #yip_fd_read_source, #yip_fd_map_source, #yip_path_source,
+ *      #yip_gzip_source
  */
 typedef struct YIP_SOURCE {
 
@@ -439,6 +537,30 @@ extern YIP_SOURCE *yip_string_source(const char *string);
  */
 extern YIP_SOURCE *yip_fp_source(FILE *fp, int to_close);
 
+/**
+ * @brief Wrap a file pointer as a source of bytes for parsing using stdio,
+ * using an allocator.
+ *
+ * This is the same as #yip_fp_source, except that memory is allocated using
+ * the allocator.
+ *
+ * @param fp
+ *    File pointer to wrap as a source. May be NULL.
+ *
+ * @param to_close
+ *    If true, the file pointer will be closed when the #YIP_SOURCE is.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR
+ */
+extern YIP_SOURCE *yip_fp_source_with_allocator(FILE *fp, int to_close, YIP_ALLOCATOR *allocator);
+
 /**
  * @brief Wrap a file descriptor as a source of bytes for parsing using UNIX
  * I/O.
@@ -459,6 +581,78 @@ extern YIP_SOURCE *yip_fp_source(FILE *fp, int to_close);
  */
 extern YIP_SOURCE *yip_fd_read_source(int fd, int to_close);
 
+/**
+ * @brief Wrap a file descriptor as a source of bytes for parsing using UNIX
+ * I/O, using an allocator.
+ *
+ * This is the same as #yip_fd_read_source, except that memory is allocated
+ * using the allocator.
+ *
+ * @param fd
+ *    File decsriptor to wrap as a source. May be negative.
+ *
+ * @param to_close
+ *    If true, the file descriptor will be closed when the #YIP_SOURCE is.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR
+ */
+extern YIP_SOURCE *yip_fd_read_source_with_allocator(int fd, int to_close, YIP_ALLOCATOR *allocator);
+
+/**
+ * @brief Wrap a file descriptor as a source of bytes for parsing using UNIX
+ * I/O in a background thread.
+ *
+ * This is the same as #yip_fd_read_source, except that a reader thread reads
+ * ahead into several chunks while the parser decodes earlier ones, so reading
+ * overlaps parsing. Reads grow to large sizes for fast pipes and sockets and
+ * shrink back for slow ones. This is not available if the library was
+ * compiled with @c YIP_NO_THREADS.
+ *
+ * @param fd
+ *    File decsriptor to wrap as a source. May be negative.
+ *
+ * @param to_close
+ *    If true, the file descriptor will be closed when the #YIP_SOURCE is.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured. This
+ *    sets errno to ENOSYS if the library was compiled without threads.
+ *
+ * @see #YIP_SOURCE, #yip_fd_read_source
+ */
+extern YIP_SOURCE *yip_fd_async_source(int fd, int to_close);
+
+/**
+ * @brief Wrap a file descriptor as a source of bytes for parsing using UNIX
+ * I/O in a background thread, using an allocator.
+ *
+ * This is the same as #yip_fd_async_source, except that memory is allocated
+ * using the allocator. The allocator is only used by the parsing thread.
+ *
+ * @param fd
+ *    File decsriptor to wrap as a source. May be negative.
+ *
+ * @param to_close
+ *    If true, the file descriptor will be closed when the #YIP_SOURCE is.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR
+ */
+extern YIP_SOURCE *yip_fd_async_source_with_allocator(int fd, int to_close, YIP_ALLOCATOR *allocator);
+
 /**
  * @brief Wrap a file descriptor as a source of bytes for parsing using memory
  * mapping.
@@ -479,12 +673,41 @@ extern YIP_SOURCE *yip_fd_read_source(int fd, int to_close);
  */
 extern YIP_SOURCE *yip_fd_map_source(int fd, int to_close);
 
+/**
+ * @brief Wrap a file descriptor as a source of bytes for parsing using a
+ * sliding memory map window.
+ *
+ * This is almost as efficient as #yip_fd_map_source, but only maps the bytes
+ * the parser still needs and a window ahead of them. The window is remapped as
+ * parsing advances, the kernel is advised to read ahead, and pages the parser
+ * is done with are unmapped. This allows parsing files larger than the memory
+ * (or the address space). Like #yip_fd_map_source, it does not work for pipes
+ * etc.
+ *
+ * @param fd
+ *    File decsriptor to wrap as a source. May be negative.
+ *
+ * @param to_close
+ *    If true, the file descriptor will be closed when the #YIP_SOURCE is.
+ *
+ * @param window_size
+ *    The number of bytes to map ahead of the parser, rounded up to whole
+ *    pages, or zero for the default (64MB). This may be at most 1GB.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE
+ */
+extern YIP_SOURCE *yip_fd_window_source(int fd, int to_close, long window_size);
+
 /**
  * @brief Wrap a file descriptor as a source of bytes for parsing using
  * either memory maps or UNIX I/O.
  *
  * This attempts to use memory mapping, but if it fails (due to the input being
- * a pipe etc.) it falls back to using UNIX I/O.
+ * a pipe etc.) it falls back to using UNIX I/O. Files larger than 1GB are
+ * mapped through a sliding window (see #yip_fd_window_source).
  *
  * @param fd
  *    File decsriptor to wrap as a source. May be negative.
@@ -499,6 +722,30 @@ extern YIP_SOURCE *yip_fd_map_source(int fd, int to_close);
  */
 extern YIP_SOURCE *yip_fd_source(int fd, int to_close);
 
+/**
+ * @brief Wrap a file descriptor as a source of bytes for parsing using
+ * either memory maps or UNIX I/O, using an allocator.
+ *
+ * This is the same as #yip_fd_source, except that if UNIX I/O is used, memory
+ * is allocated using the allocator. Memory mapped sources need no buffering.
+ *
+ * @param fd
+ *    File decsriptor to wrap as a source. May be negative.
+ *
+ * @param to_close
+ *    If true, the file descriptor will be closed when the #YIP_SOURCE is.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR
+ */
+extern YIP_SOURCE *yip_fd_source_with_allocator(int fd, int to_close, YIP_ALLOCATOR *allocator);
+
 /* File path as a source of bytes for parsing using memory map if possible or
  * read otherwise. Returns source of NULL with errno. */
 /**
@@ -506,7 +753,8 @@ extern YIP_SOURCE *yip_fd_source(int fd, int to_close);
  * maps or UNIX I/O.
  *
  * This attempts to use memory mapping, but if it fails (due to the input being
- * a pipe etc.) it falls back to using UNIX I/O.
+ * a pipe etc.) it falls back to using UNIX I/O. Compressed files are
+ * decompressed on the fly (see #yip_decompress_source).
  *
  * @param path
  *    The path of the file to open. May be NULL. As a special case "-" is taken
@@ -515,10 +763,202 @@ extern YIP_SOURCE *yip_fd_source(int fd, int to_close);
  * @return
  *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
  *
- * @see #YIP_SOURCE
+ * @see #YIP_SOURCE, #yip_decompress_source
  */
 extern YIP_SOURCE *yip_path_source(const char *path);
 
+/**
+ * @brief Open a disk file as a source of bytes for parsing using either memory
+ * maps or UNIX I/O, using an allocator.
+ *
+ * This is the same as #yip_path_source, except that if UNIX I/O is used,
+ * memory is allocated using the allocator.
+ *
+ * @param path
+ *    The path of the file to open. May be NULL. As a special case "-" is taken
+ *    to mean standard input.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR
+ */
+extern YIP_SOURCE *yip_path_source_with_allocator(const char *path, YIP_ALLOCATOR *allocator);
+
+/**
+ * @brief Create a source of bytes pushed to the parser using #yip_feed.
+ *
+ * This allows parsing input as it arrives (e.g., from a non-blocking socket)
+ * without first collecting all of it. When the parser needs bytes which were
+ * not fed yet, it fails with errno set to EAGAIN. Feeding more bytes and
+ * invoking the parser again resumes parsing where it stopped.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #yip_feed
+ */
+extern YIP_SOURCE *yip_feed_source(void);
+
+/**
+ * @brief Create a source of bytes pushed to the parser using #yip_feed, using
+ * an allocator.
+ *
+ * This is the same as #yip_feed_source, except that memory is allocated using
+ * the allocator.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR, #yip_feed
+ */
+extern YIP_SOURCE *yip_feed_source_with_allocator(YIP_ALLOCATOR *allocator);
+
+/**
+ * @brief Wrap a source of gzip compressed bytes as a source of the
+ * decompressed bytes for parsing.
+ *
+ * Compressed bytes are only fetched from the wrapped source as they are
+ * needed, and are decompressed directly into the buffer, so there is no need
+ * for a temporary file or an extra copy. Decompressed bytes are released as
+ * the parser is done with them. Zlib streams and concatenated gzip members are
+ * also accepted. This is only available if the library was compiled with
+ * @c YIP_ZLIB.
+ *
+ * @param compressed
+ *    The source of compressed bytes (e.g., from #yip_fd_source). It will be
+ *    closed when the returned #YIP_SOURCE is, or immediately if some error
+ *    occured. May be NULL, in which case NULL is returned without changing
+ *    errno.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured. This
+ *    sets errno to ENOSYS if the library was compiled without zlib. Invalid or
+ *    truncated compressed bytes cause #YIP_SOURCE::more to fail with errno set
+ *    to EIO.
+ *
+ * @see #YIP_SOURCE, #yip_decompress_source
+ */
+extern YIP_SOURCE *yip_gzip_source(YIP_SOURCE *compressed);
+
+/**
+ * @brief Wrap a source of gzip compressed bytes as a source of the
+ * decompressed bytes for parsing, using an allocator.
+ *
+ * This is the same as #yip_gzip_source, except that memory (including the
+ * decompression state) is allocated using the allocator.
+ *
+ * @param compressed
+ *    The source of compressed bytes. It will be closed when the returned
+ *    #YIP_SOURCE is, or immediately if some error occured. May be NULL.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR
+ */
+extern YIP_SOURCE *yip_gzip_source_with_allocator(YIP_SOURCE *compressed, YIP_ALLOCATOR *allocator);
+
+/**
+ * @brief Wrap a source of zstd compressed bytes as a source of the
+ * decompressed bytes for parsing.
+ *
+ * This is the same as #yip_gzip_source, except for the compression format.
+ * Concatenated zstd frames are also accepted. This is only available if the
+ * library was compiled with @c YIP_ZSTD.
+ *
+ * @param compressed
+ *    The source of compressed bytes (e.g., from #yip_fd_source). It will be
+ *    closed when the returned #YIP_SOURCE is, or immediately if some error
+ *    occured. May be NULL, in which case NULL is returned without changing
+ *    errno.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured. This
+ *    sets errno to ENOSYS if the library was compiled without zstd.
+ *
+ * @see #YIP_SOURCE, #yip_decompress_source
+ */
+extern YIP_SOURCE *yip_zstd_source(YIP_SOURCE *compressed);
+
+/**
+ * @brief Wrap a source of zstd compressed bytes as a source of the
+ * decompressed bytes for parsing, using an allocator.
+ *
+ * This is the same as #yip_zstd_source, except that the buffer is allocated
+ * using the allocator. The decompression state is allocated by the zstd
+ * library.
+ *
+ * @param compressed
+ *    The source of compressed bytes. It will be closed when the returned
+ *    #YIP_SOURCE is, or immediately if some error occured. May be NULL.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR
+ */
+extern YIP_SOURCE *yip_zstd_source_with_allocator(YIP_SOURCE *compressed, YIP_ALLOCATOR *allocator);
+
+/**
+ * @brief Wrap a source as a source of decompressed bytes if it is compressed.
+ *
+ * This peeks at the first bytes of the source. If they are the magic bytes of
+ * a supported compression format (gzip if compiled with @c YIP_ZLIB, zstd if
+ * compiled with @c YIP_ZSTD), the source is wrapped by #yip_gzip_source or
+ * #yip_zstd_source. Otherwise, the source itself is returned. This is safe
+ * since none of the magic bytes sequences is valid YAML text.
+ *
+ * @param source
+ *    The source of possibly compressed bytes. If it is wrapped, it will be
+ *    closed when the returned #YIP_SOURCE is; if some error occured, it is
+ *    closed immediately. May be NULL, in which case NULL is returned without
+ *    changing errno.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #yip_gzip_source, #yip_zstd_source
+ */
+extern YIP_SOURCE *yip_decompress_source(YIP_SOURCE *source);
+
+/**
+ * @brief Wrap a source as a source of decompressed bytes if it is compressed,
+ * using an allocator.
+ *
+ * This is the same as #yip_decompress_source, except that memory is allocated
+ * using the allocator.
+ *
+ * @param source
+ *    The source of possibly compressed bytes. May be NULL.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A valid #YIP_SOURCE or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_SOURCE, #YIP_ALLOCATOR
+ */
+extern YIP_SOURCE *yip_decompress_source_with_allocator(YIP_SOURCE *source, YIP_ALLOCATOR *allocator);
+
 /**
  * @}
  */
@@ -653,8 +1093,8 @@ typedef struct YIP_TOKEN {
     YIP_BUFFER buffer[1];       /**< Token data bytes. */
     long byte_offset;           /**< Zero based offset in source bytes. */
     long char_offset;           /**< Zero based offset in source characters. */
-    long line;                  /**< One based source line number. */
-    long line_char;             /**< Zero based source character in line. */
+    long line;                  /**< One based source line number, or -1 (see #yip_token_position). */
+    long line_char;             /**< Zero based source character in line, or -1 (see #yip_token_position). */
     YIP_ENCODING encoding;      /**< Encoding used in buffer bytes. */
     YIP_CODE code;              /**< Parsed token code. */
 } YIP_TOKEN;
@@ -714,33 +1154,263 @@ extern YIP *yip_test(YIP_SOURCE *source, int to_close,
                      const YIP_PRODUCTION *production);
 
 /**
- * @brief Close a parser and release all resources.
+ * @brief Initialize a YIP parser object for a production, using an allocator.
  *
- * @param yip
- *    The parser to close.
+ * This is the same as #yip_test, except that all the parser memory is
+ * allocated using the allocator. The parser takes ownership of the allocator:
+ * if its close hook is not NULL, it is invoked when the parser is closed, or
+ * if the parser could not be created.
+ *
+ * @param source
+ *    Source of bytes for parsing.
+ *
+ * @param to_close
+ *    If true, the source will be closed when the parser is.
+ * 
+ * @param production
+ *    The production to test, including parameter values.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
  *
  * @return
- *    Zero if all is well, or a negative value (and sets errno) if some error
- *    occured.
+ *    A parser for testing the production, or NULL (and sets errno) if some
+ *    error occured.
  *
- * @see YIP
+ * @see #YIP, #YIP_PRODUCTION, #YIP_SOURCE, #YIP_ALLOCATOR
  */
-extern int yip_close(YIP *yip);
+extern YIP *yip_test_with_allocator(YIP_SOURCE *source, int to_close,
+                                    const YIP_PRODUCTION *production,
+                                    YIP_ALLOCATOR *allocator);
 
 /**
- * @brief Return the next parsed token.
+ * @brief An entry point into a source, recorded while parsing it.
  *
- * The returned token is only valid until the next call.
+ * @see #yip_index, #yip_index_entry, #yip_index_read, #yip_test_at
+ */
+typedef struct YIP_INDEX_ENTRY {
+    long byte_offset;       /**< Offset of the first byte of the token. */
+    long char_offset;       /**< Offset of the first character of the token. */
+    long line;              /**< Line of the first character of the token. */
+    long line_char;         /**< Offset of the first character in its line. */
+    YIP_ENCODING encoding;  /**< Encoding of the source. */
+    YIP_CODE code;          /**< Code of the #YIP_BEGIN token. */
+    int depth;              /**< Number of groups enclosing the token. */
+} YIP_INDEX_ENTRY;
+
+/**
+ * @brief Initialize a YIP parser object for a production, starting at an
+ * entry point of the source.
  *
- * The parser tries to recover from errors by skipping some parts of the input
- * (e.g., until a less-indented line) and picking up from there. This is
- * reported as #YIP_UNPARSED and #YIP_ERROR tokens. Thus, discarding these
- * tokens as well as all #YIP_FAKE tokens results in a valid YAML stream
- * (missing possibly large parts of the original stream).
+ * This is the same as #yip_test, except that parsing starts at the entry
+ * (e.g., of a single document in a large stream) rather than at the first
+ * byte, and the positions of the parsed tokens are those in the whole source.
+ * The skipped source bytes are released without being parsed, which is
+ * practically free for mapped sources (see #yip_fd_map_source).
  *
- * The tokens nesting structure is properly maintained so that every #YIP_BEGIN
- * token has a matching #YIP_END token, even when errors are detected and parts
- * of the input is skipped.
+ * The source must be the same one the entry was recorded for, and the
+ * production should be the one that parses the input starting at the entry.
+ *
+ * @param source
+ *    Source of bytes for parsing.
+ *
+ * @param to_close
+ *    If true, the source will be closed when the parser is.
+ *
+ * @param production
+ *    The production to parse, including parameter values.
+ *
+ * @param entry
+ *    The entry point to start parsing at. May be NULL to start at the first
+ *    byte, as #yip_test does.
+ *
+ * @return
+ *    A parser starting at the entry, or NULL (and sets errno) if some error
+ *    occured. This sets errno to EINVAL if the entry is beyond the end of the
+ *    source.
+ *
+ * @see #YIP, #YIP_PRODUCTION, #YIP_SOURCE, #YIP_INDEX_ENTRY
+ */
+extern YIP *yip_test_at(YIP_SOURCE *source, int to_close,
+                        const YIP_PRODUCTION *production,
+                        const YIP_INDEX_ENTRY *entry);
+
+/**
+ * @brief Initialize a YIP parser object for a production, starting at an
+ * entry point of the source, using an allocator.
+ *
+ * This is the same as #yip_test_at, except that all the parser memory is
+ * allocated using the allocator (see #yip_test_with_allocator).
+ *
+ * @param source
+ *    Source of bytes for parsing.
+ *
+ * @param to_close
+ *    If true, the source will be closed when the parser is.
+ *
+ * @param production
+ *    The production to parse, including parameter values.
+ *
+ * @param entry
+ *    The entry point to start parsing at.
+ *
+ * @param allocator
+ *    The allocator to use. May be NULL to use the standard malloc, realloc and
+ *    free.
+ *
+ * @return
+ *    A parser starting at the entry, or NULL (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP, #YIP_PRODUCTION, #YIP_SOURCE, #YIP_INDEX_ENTRY, #YIP_ALLOCATOR
+ */
+extern YIP *yip_test_at_with_allocator(YIP_SOURCE *source, int to_close,
+                                       const YIP_PRODUCTION *production,
+                                       const YIP_INDEX_ENTRY *entry,
+                                       YIP_ALLOCATOR *allocator);
+
+/**
+ * @brief Close a parser and release all resources.
+ *
+ * @param yip
+ *    The parser to close.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see YIP
+ */
+extern int yip_close(YIP *yip);
+
+/**
+ * @brief Reuse a parser for parsing a new source.
+ *
+ * This closes the previous source (if the parser was asked to close it),
+ * rewinds all the parsing state and detects the encoding of the new source.
+ * The memory already allocated by the parser is kept, so parsing many sources
+ * using the same parser quickly stops allocating memory.
+ *
+ * @param yip
+ *    The parser to reuse.
+ *
+ * @param source
+ *    Source of bytes for parsing.
+ *
+ * @param to_close
+ *    If true, the source will be closed when the parser is (or when it is
+ *    reset again).
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured. If only closing the previous source failed, the parser was still
+ *    reset.
+ *
+ * @see #YIP, #YIP_SOURCE, #yip_pool
+ */
+extern int yip_reset(YIP *yip, YIP_SOURCE *source, int to_close);
+
+/**
+ * @brief Opaque pool of idle parsers.
+ *
+ * A pool is not protected by any lock. Multi-threaded servers should either
+ * give each thread its own pool or protect a shared pool with a lock.
+ *
+ * @see #yip_pool, #yip_pool_take, #yip_pool_give, #yip_pool_close
+ */
+typedef struct YIP_POOL YIP_POOL;
+
+/**
+ * @brief Create a pool of parsers for a production.
+ *
+ * @param production
+ *    The production all the parsers will parse. The strings it points to must
+ *    remain valid until the pool is closed.
+ *
+ * @param max_idle
+ *    The maximal number of idle parsers kept in the pool.
+ *
+ * @return
+ *    A new empty pool, or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_POOL, #YIP_PRODUCTION
+ */
+extern YIP_POOL *yip_pool(const YIP_PRODUCTION *production, int max_idle);
+
+/**
+ * @brief Take a parser from a pool for parsing a source.
+ *
+ * This resets an idle parser (see #yip_reset), or creates a new one if the
+ * pool is empty.
+ *
+ * @param pool
+ *    The pool to take the parser from.
+ *
+ * @param source
+ *    Source of bytes for parsing.
+ *
+ * @param to_close
+ *    If true, the source will be closed when the parser is closed or given
+ *    back to the pool.
+ *
+ * @return
+ *    A parser for the source, or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_POOL, #yip_pool_give
+ */
+extern YIP *yip_pool_take(YIP_POOL *pool, YIP_SOURCE *source, int to_close);
+
+/**
+ * @brief Give a parser back to a pool.
+ *
+ * The source is closed (if the parser was asked to close it). The parser is
+ * kept for reuse, unless the pool already holds the maximal number of idle
+ * parsers, in which case it is closed.
+ *
+ * @param pool
+ *    The pool to give the parser to.
+ *
+ * @param yip
+ *    The parser, which must have been taken from the pool.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP_POOL, #yip_pool_take
+ */
+extern int yip_pool_give(YIP_POOL *pool, YIP *yip);
+
+/**
+ * @brief Close a pool and all the idle parsers in it.
+ *
+ * @param pool
+ *    The pool to close. Parsers taken from the pool must be closed (or given
+ *    back) separately.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP_POOL
+ */
+extern int yip_pool_close(YIP_POOL *pool);
+
+/**
+ * @brief Return the next parsed token.
+ *
+ * The returned token is only valid until the next call.
+ *
+ * The parser tries to recover from errors by skipping some parts of the input
+ * (e.g., until a less-indented line) and picking up from there. This is
+ * reported as #YIP_UNPARSED and #YIP_ERROR tokens. Thus, discarding these
+ * tokens as well as all #YIP_FAKE tokens results in a valid YAML stream
+ * (missing possibly large parts of the original stream).
+ *
+ * The tokens nesting structure is properly maintained so that every #YIP_BEGIN
+ * token has a matching #YIP_END token, even when errors are detected and parts
+ * of the input is skipped.
  *
  * @param yip
  *    The parser to fetch the next token from.
@@ -752,6 +1422,736 @@ extern int yip_close(YIP *yip);
  */
 extern const YIP_TOKEN *yip_next_token(YIP *yip);
 
+/**
+ * @brief Return a batch of parsed tokens.
+ *
+ * This is the same as calling #yip_next_token repeatedly, copying each token
+ * into the given array, but with less overhead per token. The batch ends
+ * early after the final #YIP_DONE token or after a #YIP_ERROR token.
+ *
+ * The returned tokens are only valid until the next call to either
+ * #yip_next_tokens or #yip_next_token.
+ *
+ * @param yip
+ *    The parser to fetch the tokens from.
+ *
+ * @param tokens
+ *    The array to fill with parsed tokens.
+ *
+ * @param max
+ *    The maximal number of tokens to fetch (the size of the array).
+ *
+ * @return
+ *    The number of fetched tokens, or a negative value (and sets errno) if
+ *    some error occured. An error occuring after some tokens were fetched is
+ *    reported by the next call.
+ *
+ * @see #YIP, #YIP_TOKEN, #yip_next_token
+ */
+extern int yip_next_tokens(YIP *yip, YIP_TOKEN *tokens, int max);
+
+/**
+ * @brief Drop tokens the caller is not interested in.
+ *
+ * Dropped tokens are never collected or returned by #yip_next_token and
+ * #yip_next_tokens, which is cheaper than discarding them after they are
+ * returned. For example, dropping the "bwit" codes leaves only the content,
+ * structure and errors of the YAML stream.
+ *
+ * To keep the returned tokens properly nested, each #YIP_BEGIN token code must
+ * be dropped together with its #YIP_END pair (see #yip_code_pair). The final
+ * #YIP_DONE token is never dropped. Resetting the parser (see #yip_reset)
+ * clears the filter.
+ *
+ * @param yip
+ *    The parser to filter the tokens of.
+ *
+ * @param codes
+ *    The codes of the tokens to drop, as a string of #YIP_CODE characters. May
+ *    be NULL to drop no specific codes.
+ *
+ * @param types
+ *    The types of the tokens to drop, as a mask of (1 << #YIP_CODE_TYPE)
+ *    bits. May be zero to drop no specific types.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured. This sets errno to EINVAL for unknown codes or types, and for
+ *    begin or end codes which are not dropped together with their pair.
+ *
+ * @see #YIP, #YIP_CODE, #YIP_CODE_TYPE
+ */
+extern int yip_set_token_filter(YIP *yip, const char *codes, int types);
+
+/**
+ * @brief Skip the rest of a group of tokens.
+ *
+ * This must be called right after #yip_next_token (or #yip_next_tokens)
+ * returned a #YIP_BEGIN token (e.g., #YIP_BEGIN_NODE). It skips all the
+ * tokens up to and including the matching #YIP_END token, which is returned.
+ * The skipped input is still fully parsed, but none of the skipped tokens are
+ * collected, so this is much cheaper than fetching and discarding them, and
+ * allows efficiently extracting a small part of a large document.
+ *
+ * The returned token is only valid until the next call to #yip_next_token or
+ * #yip_next_tokens.
+ *
+ * If the source is a #yip_feed_source which needs more input, this returns
+ * NULL with errno set to EAGAIN, and the parser is left in the middle of the
+ * skip. Once more bytes are fed (see #yip_feed), calling this again (and not
+ * #yip_next_token) resumes skipping the same group. The token filter must not
+ * be changed in between.
+ *
+ * @param yip
+ *    The parser to skip the tokens of.
+ *
+ * @param errors
+ *    If not NULL, is set to the number of #YIP_ERROR tokens skipped so far in
+ *    the group, which is zero unless the skipped input is malformed.
+ *
+ * @return
+ *    The matching #YIP_END token, the #YIP_DONE token if the input ended
+ *    before it (which only happens if the production does not nest its groups
+ *    properly), or NULL (and sets errno) if some error occured. This sets
+ *    errno to EINVAL if the last returned token is not a #YIP_BEGIN token and
+ *    no skip is being resumed.
+ *
+ * @see #YIP, #YIP_TOKEN, #yip_next_token, #yip_code_pair
+ */
+extern const YIP_TOKEN *yip_skip_node(YIP *yip, int *errors);
+
+/**
+ * @brief Push more input bytes to a parser.
+ *
+ * The parser must have been created for a source returned by
+ * #yip_feed_source. The bytes are copied, so the caller may reuse them once
+ * this returns. Feeding bytes invalidates previously returned tokens.
+ *
+ * When #yip_next_token returns NULL with errno set to EAGAIN (or
+ * #yip_next_tokens returns a negative value with errno set to EAGAIN), the
+ * parser needs more input; it will resume where it stopped once more bytes are
+ * fed.
+ *
+ * @param yip
+ *    The parser to push bytes to.
+ *
+ * @param bytes
+ *    The bytes to push. May be NULL if size is zero.
+ *
+ * @param size
+ *    The (non-negative) number of bytes to push.
+ *
+ * @param is_last
+ *    If true, these are the last bytes of the input. No bytes may be fed
+ *    afterwards.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP, #yip_feed_source, #yip_next_token
+ */
+extern int yip_feed(YIP *yip, const void *bytes, int size, int is_last);
+
+/**
+ * @brief Compute the line position of a returned token.
+ *
+ * Normally every token carries its line and position in the line. If the
+ * library was compiled with @c YIP_LAZY_POSITIONS, the parser only records the
+ * offset of the start of each line, so tokens (and the backtracking state)
+ * are smaller and each character costs less work. The line and line_char of
+ * returned tokens are then set to -1, and are computed by this function on
+ * demand (in logarithmic time). The parser keeps the line starts from the
+ * oldest backtracking state or unreleased token onward, and drops the earlier
+ * ones when it releases the input, so positions can only be computed for
+ * tokens which are still valid (i.e., until the next token or batch of tokens
+ * is requested).
+ *
+ * This works in both cases, so code that needs line positions only rarely
+ * (e.g., when reporting an error) should use it instead of reading the token
+ * members directly.
+ *
+ * @param yip
+ *    The parser which returned the token.
+ *
+ * @param token
+ *    A token returned by the parser, which is still valid.
+ *
+ * @param line
+ *    Where to store the one based source line number. May be NULL.
+ *
+ * @param line_char
+ *    Where to store the zero based source character in line. May be NULL.
+ *
+ * @param char_offset
+ *    Where to store the zero based offset in source characters. May be NULL.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP, #YIP_TOKEN
+ */
+extern int yip_token_position(const YIP *yip, const YIP_TOKEN *token, long *line, long *line_char, long *char_offset);
+
+/**
+ * @brief Return the number of character decodes saved by backtracking.
+ *
+ * When the parser backtracks it goes back to an earlier input position and
+ * reads the same characters again. Characters read while backtracking was
+ * possible are cached, so reading them again does not decode them again.
+ *
+ * @param yip
+ *    The parser to query.
+ *
+ * @return
+ *    The number of characters taken from the cache so far.
+ *
+ * @see #YIP
+ */
+extern long yip_saved_decodes(const YIP *yip);
+
+/**
+ * @brief Bounds on the work done by a parser.
+ *
+ * Backtracking allows a crafted input to make the parser keep a lot of input
+ * and tokens in memory, or examine the same input many times. When parsing
+ * untrusted input, these may be bounded (see #yip_set_limits). The same
+ * structure is used to report how close the input came to each limit (see
+ * #yip_limits_usage).
+ *
+ * @see #yip_set_limits, #yip_limits_usage
+ */
+typedef struct YIP_LIMITS {
+    int max_frames_depth;       /**< Maximal depth of the backtracking stack (at least one), or 0 for no limit. */
+    int max_tokens_depth;       /**< Maximal number of tokens collected while backtracking, or 0 for no limit. */
+    long max_lookahead;         /**< Maximal number of bytes read ahead of the oldest backtracking point, or 0 for no limit. */
+    long max_chars_per_byte;    /**< Maximal number of characters examined per input byte, or 0 for no limit. */
+} YIP_LIMITS;
+
+/**
+ * @brief Bound the work done by a parser.
+ *
+ * Once a limit is exceeded, the parser stops backtracking and gives up on the
+ * rest of the input. It returns a #YIP_ERROR token naming the exceeded limit,
+ * followed by #YIP_UNPARSED tokens for the rest of the input (one per line,
+ * starting at the oldest backtracking point), #YIP_END tokens for all the
+ * groups returned so far which were not yet ended, and the final #YIP_DONE
+ * token. Tokens collected while backtracking are discarded. This keeps the
+ * returned tokens properly nested and terminated, and bounds the cost of a
+ * pathological input to a single linear pass over it.
+ *
+ * The characters examined per byte are counted over the input read so far
+ * plus 4096 bytes, so backtracking near the start of the input does not
+ * exceed a reasonable limit. Exceeding the lookahead may be detected up to a
+ * single run of same-class characters late.
+ *
+ * The limits are kept when the parser is reset (see #yip_reset), so a pool of
+ * parsers for untrusted input remains bounded.
+ *
+ * @param yip
+ *    The parser to bound.
+ *
+ * @param limits
+ *    The limits to apply, or NULL to remove all limits.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured. This sets errno to EINVAL for negative limits.
+ *
+ * @see #YIP, #YIP_LIMITS, #yip_limits_usage
+ */
+extern int yip_set_limits(YIP *yip, const YIP_LIMITS *limits);
+
+/**
+ * @brief Report how close the input came to each limit.
+ *
+ * This is available whether or not any limits were set, so it may be used to
+ * choose limits which real inputs never come close to. The lookahead is
+ * measured whenever the oldest backtracking point is moved, discarded or
+ * backtracked to. The usage covers the input since the parser was created or
+ * reset.
+ *
+ * @param yip
+ *    The parser to query.
+ *
+ * @param usage
+ *    Is set to the maximal value reached for each limit, the characters
+ *    examined per byte being rounded up.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP, #YIP_LIMITS, #yip_set_limits
+ */
+extern int yip_limits_usage(const YIP *yip, YIP_LIMITS *usage);
+
+/**
+ * @brief Number of times a single state machine was entered.
+ *
+ * @see #YIP_STATS
+ */
+typedef struct YIP_MACHINE_STATS {
+    const char *id;             /**< Machine identifier in the grammar. */
+    const char *name;           /**< Name of the production the machine implements. */
+    long entries;               /**< Number of times the machine was invoked or resumed. */
+} YIP_MACHINE_STATS;
+
+/**
+ * @brief Runtime statistics of a parser.
+ *
+ * These are only collected if the library was compiled with @c YIP_COUNT_STATS;
+ * otherwise the counting compiles to nothing.
+ *
+ * @see #yip_get_stats
+ */
+typedef struct YIP_STATS {
+    long decoded_chars;         /**< Number of characters decoded or classified from the source. */
+    long push_states;           /**< Number of pushed backtracking points. */
+    long reset_states;          /**< Number of times the parser backtracked. */
+    long pop_states;            /**< Number of backtracking points discarded on success. */
+    long rescanned_bytes;       /**< Number of bytes scanned again after backtracking. */
+    long rebases;               /**< Number of times reading more input moved the source buffer. */
+    long more_calls;            /**< Number of times the source was asked for more input. */
+    long more_bytes;            /**< Number of bytes these requests added to the source buffer. */
+    int max_tokens_depth;       /**< Maximal number of collected tokens. */
+    int max_frames_depth;       /**< Maximal depth of the backtracking stack. */
+    int max_codes_depth;        /**< Maximal nesting depth of tokens. */
+    int machines_count;         /**< Number of state machines. */
+    const YIP_MACHINE_STATS *machines; /**< Statistics of each state machine. */
+} YIP_STATS;
+
+/**
+ * @brief Return the runtime statistics of a parser.
+ *
+ * The statistics cover the input since the parser was created or reset. The
+ * returned object belongs to the parser, is updated as parsing continues and
+ * is valid until the parser is closed.
+ *
+ * @param yip
+ *    The parser to query.
+ *
+ * @return
+ *    The parser statistics, or NULL (and sets errno to ENOSYS) if the library
+ *    was compiled without @c YIP_COUNT_STATS.
+ *
+ * @see #YIP, #yip_reset
+ */
+extern const YIP_STATS *yip_get_stats(const YIP *yip);
+
+/**
+ * @brief Kinds of trace events.
+ *
+ * @see #YIP_TRACE_EVENT
+ */
+typedef enum YIP_TRACE_KIND {
+    YIP_TRACE_ENTER,    /**< Entered or resumed the state machine. */
+    YIP_TRACE_EXIT,     /**< Returned from the state machine; the value is positive if tokens are ready. */
+    YIP_TRACE_STATE,    /**< Moved to a state; the value is the state index. */
+    YIP_TRACE_PUSH,     /**< Pushed a backtracking point; the value is the new depth. */
+    YIP_TRACE_RESET,    /**< Backtracked; the value is the depth. */
+    YIP_TRACE_POP,      /**< Discarded a backtracking point; the value is the new depth. */
+    YIP_TRACE_TOKEN     /**< Returned a token to the caller; the value is its code. */
+} YIP_TRACE_KIND;
+
+/**
+ * @brief A single recorded trace event.
+ *
+ * @see #yip_trace, #yip_trace_event
+ */
+typedef struct YIP_TRACE_EVENT {
+    unsigned long long ticks;   /**< Time stamp in trace clock ticks. */
+    long byte_offset;           /**< Offset of the current input character. */
+    int value;                  /**< Value specific to the kind of event. */
+    short machine;              /**< Index of the state machine, as in #YIP_STATS, or the machines count once a limit was exceeded. */
+    unsigned char kind;         /**< Kind of event (#YIP_TRACE_KIND). */
+} YIP_TRACE_EVENT;
+
+/**
+ * @brief Start or stop recording trace events.
+ *
+ * Events are recorded in a ring buffer of the parser, so only the most recent
+ * ones are kept. This is only possible if the library was compiled with
+ * @c YIP_TRACE; otherwise tracing compiles to nothing.
+ *
+ * @param yip
+ *    The parser to trace.
+ *
+ * @param capacity
+ *    The number of recent events to keep, or zero to stop tracing and discard
+ *    all recorded events.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured. This sets errno to ENOSYS if the library was compiled without
+ *    @c YIP_TRACE.
+ *
+ * @see #YIP, #yip_trace_dump, #yip_trace_event
+ */
+extern int yip_trace(YIP *yip, int capacity);
+
+/**
+ * @brief Return the number of recorded trace events held by a parser.
+ *
+ * @param yip
+ *    The traced parser.
+ *
+ * @return
+ *    The number of events that can be accessed using #yip_trace_event.
+ *
+ * @see #YIP, #yip_trace
+ */
+extern int yip_trace_count(const YIP *yip);
+
+/**
+ * @brief Return a recorded trace event.
+ *
+ * @param yip
+ *    The traced parser.
+ *
+ * @param index
+ *    The index of the event, where zero is the oldest event still held.
+ *
+ * @return
+ *    The event, which is valid until parsing continues, or NULL (and sets
+ *    errno) if there is no such event.
+ *
+ * @see #YIP, #yip_trace, #yip_trace_count
+ */
+extern const YIP_TRACE_EVENT *yip_trace_event(const YIP *yip, int index);
+
+/**
+ * @brief Write the recorded trace events as Chrome trace JSON.
+ *
+ * The output can be loaded into chrome://tracing or Perfetto. Machine runs are
+ * shown as durations and all other events as instants. Time stamps are in
+ * microseconds since tracing started.
+ *
+ * @param yip
+ *    The traced parser.
+ *
+ * @param fp
+ *    The file to write to.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP, #yip_trace
+ */
+extern int yip_trace_dump(const YIP *yip, FILE *fp);
+
+/**
+ * @brief Start or stop recording entry points while parsing.
+ *
+ * An entry is recorded for each returned #YIP_BEGIN token of one of the
+ * codes, unless it is nested too deeply. For example, recording the
+ * #YIP_BEGIN_DOCUMENT tokens allows parsing any single document of a large
+ * stream later on, without parsing the documents before it (see
+ * #yip_test_at). Resetting the parser (see #yip_reset) stops recording and
+ * discards all recorded entries.
+ *
+ * Group depths are counted from the point recording starts, so this should be
+ * invoked before fetching any tokens.
+ *
+ * @param yip
+ *    The parser to record entries of.
+ *
+ * @param codes
+ *    The codes of the #YIP_BEGIN tokens to record, as a string of #YIP_CODE
+ *    characters. May be NULL or empty to stop recording and discard all
+ *    recorded entries.
+ *
+ * @param max_depth
+ *    The maximal number of (returned) groups enclosing a recorded token, where
+ *    zero records only the outermost groups.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured. This sets errno to EINVAL for codes which are not #YIP_BEGIN
+ *    codes.
+ *
+ * @see #YIP, #YIP_INDEX_ENTRY, #yip_index_count, #yip_index_write
+ */
+extern int yip_index(YIP *yip, const char *codes, int max_depth);
+
+/**
+ * @brief Return the number of entries recorded by a parser.
+ *
+ * @param yip
+ *    The recording parser.
+ *
+ * @return
+ *    The number of entries that can be accessed using #yip_index_entry, or a
+ *    negative value (and sets errno) if some error occured while recording.
+ *
+ * @see #YIP, #yip_index
+ */
+extern int yip_index_count(const YIP *yip);
+
+/**
+ * @brief Return a recorded entry.
+ *
+ * @param yip
+ *    The recording parser.
+ *
+ * @param index
+ *    The index of the entry, in source order.
+ *
+ * @return
+ *    The entry, which is valid until parsing continues, or NULL (and sets
+ *    errno) if there is no such entry.
+ *
+ * @see #YIP, #YIP_INDEX_ENTRY, #yip_index, #yip_index_count
+ */
+extern const YIP_INDEX_ENTRY *yip_index_entry(const YIP *yip, int index);
+
+/**
+ * @brief Write the recorded entries to an index file.
+ *
+ * The index is a compact binary file, holding a fixed size record for each
+ * entry, so a single entry can be read from it without reading the rest (see
+ * #yip_index_read). The file is portable between platforms.
+ *
+ * @param yip
+ *    The recording parser.
+ *
+ * @param fp
+ *    The (binary) file to write to.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP, #yip_index, #yip_index_read
+ */
+extern int yip_index_write(const YIP *yip, FILE *fp);
+
+/**
+ * @brief Read an entry from an index file.
+ *
+ * @param fp
+ *    The (binary) file written by #yip_index_write.
+ *
+ * @param index
+ *    The index of the entry to read.
+ *
+ * @param entry
+ *    Is set to the entry. May be NULL to only count the entries.
+ *
+ * @return
+ *    The number of entries in the file, or a negative value (and sets errno)
+ *    if some error occured. This sets errno to EINVAL if the file is not an
+ *    index file, or if there is no such entry.
+ *
+ * @see #YIP_INDEX_ENTRY, #yip_index_write, #yip_test_at
+ */
+extern int yip_index_read(FILE *fp, int index, YIP_INDEX_ENTRY *entry);
+
+/**
+ * @}
+ */
+
+/**
+ * @addtogroup Writers
+ *
+ * @brief Write @ref Tokens to files and read them back.
+ *
+ * @{
+ */
+
+/**
+ * @brief Formats of written tokens.
+ *
+ * This is a signed enum so negative values can be used to signify errors.
+ *
+ * @see #yip_writer
+ */
+typedef enum YIP_FORMAT {
+    YIP_YEAST,              /**< Textual YEAST, one token per line. */
+    YIP_YEAST_POSITIONS,    /**< Textual YEAST, each token preceded by a comment line with its position. */
+    YIP_YEAST_BINARY,       /**< Compact binary tokens, which may be read back using #yip_reader. */
+    YIP_FORMAT_SIGNED = -1  /* Force enum to be signed. */
+} YIP_FORMAT;
+
+/**
+ * @brief Opaque writer of tokens to a file descriptor.
+ *
+ * @see #yip_writer
+ */
+typedef struct YIP_WRITER YIP_WRITER;
+
+/**
+ * @brief Create a writer of tokens to a file descriptor.
+ *
+ * Textual YEAST is the format of the regression tests: each token is written
+ * as a line holding its code followed by its text, where characters other
+ * than printable ASCII are escaped (e.g. "\x0a") and so is "\" (other than
+ * in #YIP_ERROR tokens). The final #YIP_DONE token is not written.
+ *
+ * The binary format starts with the 4 bytes "YIPB". Each token is then
+ * written as unsigned LEB128 varints: the code plus 128 times the encoding,
+ * the zig-zag encoded differences of the byte offset, character offset and
+ * line from the previous token, the zig-zag encoded line character, and the
+ * number of bytes, followed by the token bytes themselves. The final
+ * #YIP_DONE token is written as well, to mark the end of the tokens.
+ *
+ * Tokens are gathered in a large buffer and written using writev(2), so there
+ * is only one system call for many tokens.
+ *
+ * @param fd
+ *    The file descriptor to write to.
+ *
+ * @param to_close
+ *    If true, the file descriptor will be closed when the writer is.
+ *
+ * @param format
+ *    The format of the written tokens.
+ *
+ * @param yip
+ *    The parser which returns the written tokens, used to compute their
+ *    positions (see #yip_token_position), or NULL if the tokens carry their
+ *    positions (e.g., they are read by a #yip_reader).
+ *
+ * @return
+ *    A writer, or NULL (and sets errno) if some error occured.
+ *
+ * @see #YIP_WRITER, #YIP_FORMAT, #yip_writer_put, #yip_writer_close
+ */
+extern YIP_WRITER *yip_writer(int fd, int to_close, YIP_FORMAT format, const YIP *yip);
+
+/**
+ * @brief Write a token.
+ *
+ * The token bytes are copied, so the token need not remain valid once this
+ * returns.
+ *
+ * @param writer
+ *    The writer to write the token with.
+ *
+ * @param token
+ *    The token to write.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP_WRITER, #yip_writer_put_tokens
+ */
+extern int yip_writer_put(YIP_WRITER *writer, const YIP_TOKEN *token);
+
+/**
+ * @brief Write a batch of tokens.
+ *
+ * This is meant for the tokens returned by #yip_next_tokens. Large runs of
+ * token bytes which need no escaping are written directly from the tokens
+ * rather than copied, and everything is written before this returns, so the
+ * tokens need only remain valid until then.
+ *
+ * @param writer
+ *    The writer to write the tokens with.
+ *
+ * @param tokens
+ *    The tokens to write.
+ *
+ * @param count
+ *    The number of tokens to write.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP_WRITER, #yip_writer_put, #yip_next_tokens
+ */
+extern int yip_writer_put_tokens(YIP_WRITER *writer, const YIP_TOKEN *tokens, int count);
+
+/**
+ * @brief Write all the buffered tokens.
+ *
+ * @param writer
+ *    The writer to flush.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured.
+ *
+ * @see #YIP_WRITER
+ */
+extern int yip_writer_flush(YIP_WRITER *writer);
+
+/**
+ * @brief Write all the buffered tokens and release all resources.
+ *
+ * @param writer
+ *    The writer to close.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured. The writer is released in either case.
+ *
+ * @see #YIP_WRITER
+ */
+extern int yip_writer_close(YIP_WRITER *writer);
+
+/**
+ * @brief Opaque reader of tokens written in the binary format.
+ *
+ * @see #yip_reader
+ */
+typedef struct YIP_READER YIP_READER;
+
+/**
+ * @brief Create a reader of tokens written in the binary format.
+ *
+ * This allows replaying the tokens of a document without parsing it again.
+ *
+ * @param source
+ *    Source of the bytes written by a #YIP_YEAST_BINARY #yip_writer.
+ *
+ * @param to_close
+ *    If true, the source will be closed when the reader is.
+ *
+ * @return
+ *    A reader, or NULL (and sets errno) if some error occured. This sets
+ *    errno to EILSEQ if the source does not start with binary tokens.
+ *
+ * @see #YIP_READER, #YIP_SOURCE, #yip_reader_next_token, #yip_reader_close
+ */
+extern YIP_READER *yip_reader(YIP_SOURCE *source, int to_close);
+
+/**
+ * @brief Return the next token read back.
+ *
+ * The token bytes point into the source buffer, and the token is only valid
+ * until the next call. Once the final #YIP_DONE token is returned, it is
+ * returned again by any further call.
+ *
+ * @param reader
+ *    The reader to read the token with.
+ *
+ * @return
+ *    The next token, or NULL (and sets errno) if some error occured. This
+ *    sets errno to EILSEQ if the source holds a malformed or truncated token.
+ *
+ * @see #YIP_READER, #YIP_TOKEN
+ */
+extern const YIP_TOKEN *yip_reader_next_token(YIP_READER *reader);
+
+/**
+ * @brief Close a reader and release all resources.
+ *
+ * @param reader
+ *    The reader to close.
+ *
+ * @return
+ *    Zero if all is well, or a negative value (and sets errno) if some error
+ *    occured (e.g., when closing the source).
+ *
+ * @see #YIP_READER
+ */
+extern int yip_reader_close(YIP_READER *reader);
+
 /**
  * @}
  */
@@ -0,0 +1,361 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "yip.h"
+
+#ifndef O_BINARY
+#   define O_BINARY 0
+#endif /* O_BINARY */
+
+/* {{{ */
+
+/* File holding the current corpus while it is being parsed. */
+static const char *corpus_path = "yip_bench.input";
+
+/* Approximate size of each generated corpus in bytes. */
+static long corpus_size = 16 * 1024 * 1024;
+
+/* A growing text buffer. */
+typedef struct TEXT {
+    char *data;     /* Text bytes. */
+    long size;      /* Number of used bytes. */
+    long capacity;  /* Number of allocated bytes. */
+} TEXT;
+
+/* Abort execution with errno-based message. */
+static void die(const char *where) {
+    perror(where);
+    exit(1);
+}
+
+/* Current wall clock time in seconds. */
+static double now() {
+    struct timeval tv;
+    if (gettimeofday(&tv, NULL) < 0) die("gettimeofday");
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/* Deterministic pseudo-random numbers, so runs are reproducible. */
+static unsigned long random_state = 1;
+static unsigned long next_random(unsigned long limit) {
+    random_state = random_state * 1103515245 + 12345;
+    return (random_state >> 16) % limit;
+}
+
+/* Append bytes to a text buffer. */
+static void append_bytes(TEXT *text, const char *bytes, long size) {
+    if (text->size + size > text->capacity) {
+        text->capacity = 2 * (text->size + size);
+        text->data = realloc(text->data, text->capacity);
+        if (!text->data) die("realloc");
+    }
+    memcpy(text->data + text->size, bytes, size);
+    text->size += size;
+}
+
+/* Append a string to a text buffer. */
+static void append(TEXT *text, const char *string) {
+    append_bytes(text, string, strlen(string));
+}
+
+/* Append a string repeated some times to a text buffer. */
+static void append_repeated(TEXT *text, const char *string, int count) {
+    while (count-- > 0) append(text, string);
+}
+
+/* }}} */
+/* {{{ */
+
+/* Runs of white space. */
+static void generate_white(TEXT *text) {
+    while (text->size < corpus_size) append(text, next_random(2) ? " " : "\t");
+}
+
+/* A huge block mapping, with some nested mappings. */
+static void generate_mapping(TEXT *text) {
+    char line[128];
+    long key = 0;
+    while (text->size < corpus_size) {
+        sprintf(line, "key%ld: value %ld\n", key, key);
+        append(text, line);
+        if (!(++key % 10)) {
+            sprintf(line, "nested%ld:\n  inner%ld: value\n  other%ld: [a, b]\n", key, key, key);
+            append(text, line);
+        }
+    }
+}
+
+/* A single flow sequence of deeply nested flow collections. */
+static void generate_flow(TEXT *text) {
+    append(text, "[");
+    while (text->size < corpus_size) {
+        append_repeated(text, "[", 100);
+        append(text, "{a: b}");
+        append_repeated(text, "]", 100);
+        append(text, ", ");
+    }
+    append(text, "x]\n");
+}
+
+/* A long scalar of lines of words. */
+static void generate_lines(TEXT *text) {
+    static const char *words[] = { "lorem ", "ipsum ", "dolor ", "sit ", "amet " };
+    while (text->size < corpus_size) {
+        int line_size = 0;
+        append(text, "  ");
+        while (line_size < 1000) {
+            const char *word = words[next_random(5)];
+            append(text, word);
+            line_size += strlen(word);
+        }
+        append(text, "end\n");
+    }
+}
+
+/* A long folded scalar. */
+static void generate_folded(TEXT *text) {
+    append(text, "--- >\n");
+    generate_lines(text);
+}
+
+/* A long literal scalar. */
+static void generate_literal(TEXT *text) {
+    append(text, "--- |\n");
+    generate_lines(text);
+}
+
+/* Many small documents. */
+static void generate_documents(TEXT *text) {
+    while (text->size < corpus_size) append(text, "--- {a: 1, b: [x, y]}\n");
+}
+
+/* Input full of errors the parser has to recover from. */
+static void generate_errors(TEXT *text) {
+    static const char *lines[] = {
+        "key: [unclosed\n", "\t- tab indented\n", "a: b: c\n", "\x01\x02 control\n", "- ok\n", "  ]]] }\n"
+    };
+    while (text->size < corpus_size) append(text, lines[next_random(6)]);
+}
+
+/* }}} */
+/* {{{ */
+
+/* Generator of a benchmark corpus. */
+typedef struct CORPUS {
+    const char *name;                   /* Corpus name. */
+    const char *production;             /* Production to parse the corpus with. */
+    void (*generate)(TEXT *text);       /* Corpus generator. */
+    int all_encodings;                  /* Whether to also parse the corpus in UTF-16 and UTF-32 encodings. */
+} CORPUS;
+
+/* All the benchmark corpora. */
+static const CORPUS corpora[] = {
+    { "white",      "s-separate-in-line",   generate_white,     1 },
+    { "mapping",    "l-yaml-stream",        generate_mapping,   1 },
+    { "flow",       "l-yaml-stream",        generate_flow,      0 },
+    { "folded",     "l-yaml-stream",        generate_folded,    0 },
+    { "literal",    "l-yaml-stream",        generate_literal,   0 },
+    { "documents",  "l-yaml-stream",        generate_documents, 0 },
+    { "errors",     "l-yaml-stream",        generate_errors,    0 }
+};
+
+/* Names of all the source types. */
+static const char *sources[] = { "str", "buf", "fp", "fdr", "fda", "fdm", "fdw" };
+
+/* Write the (ASCII) corpus in an encoding, with a BOM for non-UTF8 encodings. */
+static void write_corpus(const TEXT *text, YIP_ENCODING encoding) {
+    static const int unit_sizes[] = { 1, 2, 2, 4, 4 };
+    static const int is_big_endian[] = { 0, 0, 1, 0, 1 };
+    int unit_size = unit_sizes[encoding];
+    FILE *fp = fopen(corpus_path, "wb");
+    long i;
+    if (!fp) die(corpus_path);
+    for (i = encoding == YIP_UTF8 ? 0 : -1; i < text->size; i++) {
+        unsigned long code = i < 0 ? 0xFEFF : (unsigned char)text->data[i];
+        int byte;
+        for (byte = 0; byte < unit_size; byte++) {
+            int shift = 8 * (is_big_endian[encoding] ? unit_size - 1 - byte : byte);
+            if (putc((code >> shift) & 0xFF, fp) == EOF) die(corpus_path);
+        }
+    }
+    if (fclose(fp) < 0) die(corpus_path);
+}
+
+/* Read the whole corpus into memory for the str and buf sources. */
+static char *read_corpus(long *size) {
+    FILE *fp = fopen(corpus_path, "rb");
+    char *data;
+    if (!fp) die(corpus_path);
+    if (fseek(fp, 0, SEEK_END) < 0 || (*size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) < 0) die(corpus_path);
+    data = malloc(*size + 1);
+    if (!data) die("malloc");
+    if ((long)fread(data, 1, *size, fp) != *size) die(corpus_path);
+    data[*size] = '\0';
+    if (fclose(fp) < 0) die(corpus_path);
+    return data;
+}
+
+/* Create a source of some type for the corpus. */
+static YIP_SOURCE *open_source(const char *source, char **data) {
+    long size;
+    *data = NULL;
+    if (!strcmp(source, "str")) {
+        *data = read_corpus(&size);
+        return yip_string_source(*data);
+    } else if (!strcmp(source, "buf")) {
+        *data = read_corpus(&size);
+        return yip_buffer_source(*data, *data + size);
+    } else if (!strcmp(source, "fp")) {
+        return yip_fp_source(fopen(corpus_path, "rb"), 1);
+    } else if (!strcmp(source, "fdr")) {
+        return yip_fd_read_source(open(corpus_path, O_RDONLY|O_BINARY), 1);
+    } else if (!strcmp(source, "fda")) {
+        return yip_fd_async_source(open(corpus_path, O_RDONLY|O_BINARY), 1);
+    } else if (!strcmp(source, "fdm")) {
+        return yip_fd_map_source(open(corpus_path, O_RDONLY|O_BINARY), 1);
+    } else {
+        return yip_fd_window_source(open(corpus_path, O_RDONLY|O_BINARY), 1, 0);
+    }
+}
+
+/* Whether the grammar has a machine for the production of a corpus. */
+static int is_implemented(const CORPUS *corpus) {
+    YIP_PRODUCTION production = { NULL, NULL, NULL, NULL };
+    YIP_SOURCE *source = yip_string_source("");
+    YIP *yip;
+    if (!source) die("yip_string_source");
+    production.name = corpus->production;
+    yip = yip_test(source, 1, &production);
+    if (!yip) return 0;
+    if (yip_close(yip) < 0) die("yip_close");
+    return 1;
+}
+
+/* Wait for a child process, aborting execution if it failed. */
+static void wait_child(pid_t pid, const CORPUS *corpus, YIP_ENCODING encoding, const char *what) {
+    int status;
+    if (waitpid(pid, &status, 0) < 0) die("waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "yip_bench: %s %s %s: crashed\n", corpus->name, yip_encoding_name(encoding), what);
+        exit(1);
+    }
+}
+
+/* Generate the corpus and write it in an encoding. This is done in a child process, so that the generated text is not
+ * part of the peak memory usage of the (forked) parsing runs. */
+static void prepare(const CORPUS *corpus, YIP_ENCODING encoding) {
+    pid_t pid;
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) die("fork");
+    if (!pid) {
+        TEXT text = { NULL, 0, 0 };
+        random_state = 1;
+        corpus->generate(&text);
+        write_corpus(&text, encoding);
+        free(text.data);
+        _exit(0);
+    }
+    wait_child(pid, corpus, encoding, "generate");
+}
+
+/* Parse the corpus using a source of some type and print one line of results. This is done in a child process, so
+ * that the peak memory usage is that of a single run. */
+static void bench_child(const CORPUS *corpus, YIP_ENCODING encoding, const char *source_name) {
+    YIP_PRODUCTION production = { NULL, NULL, NULL, NULL };
+    const char *status = "ok";
+    long bytes = 0, chars = 0, tokens = 0;
+    int max_depth = 0;
+    double start, seconds;
+    struct rusage usage;
+    YIP_LIMITS used;
+    char *data;
+    YIP_SOURCE *source = open_source(source_name, &data);
+    YIP *yip;
+    if (!source) die(source_name);
+    production.name = corpus->production;
+    start = now();
+    if (!(yip = yip_test(source, 1, &production))) die("yip_test");
+    for (;;) {
+        const YIP_TOKEN *token = yip_next_token(yip);
+        if (!token) {
+            status = "failed";
+            break;
+        }
+        tokens++;
+        if (token->code == YIP_DONE) {
+            bytes = token->byte_offset;
+            chars = token->char_offset;
+            break;
+        }
+    }
+    if (yip_limits_usage(yip, &used) < 0) die("yip_limits_usage");
+    max_depth = used.max_frames_depth;
+    if (yip_close(yip) < 0) die("yip_close");
+    seconds = now() - start;
+    if (getrusage(RUSAGE_SELF, &usage) < 0) die("getrusage");
+    printf("%s,%s,%s,%ld,%ld,%ld,%.6f,%.3f,%.0f,%.3f,%ld,%d,%s\n",
+           corpus->name, yip_encoding_name(encoding), source_name, bytes, chars, tokens, seconds,
+           seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+           seconds > 0 ? tokens / seconds : 0.0,
+           chars > 0 ? seconds * 1e9 / chars : 0.0,
+           (long)usage.ru_maxrss, max_depth, status);
+    free(data);
+}
+
+/* Parse the corpus using a source of some type in a child process. */
+static void bench(const CORPUS *corpus, YIP_ENCODING encoding, const char *source) {
+    pid_t pid;
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) die("fork");
+    if (!pid) {
+        bench_child(corpus, encoding, source);
+        fflush(stdout);
+        _exit(0);
+    }
+    wait_child(pid, corpus, encoding, source);
+}
+
+/* Aborts execution with a helpful message. */
+static void usage() {
+    fprintf(stderr, "Usage: yip_bench [megabytes]\n");
+    exit(1);
+}
+
+/* Generate all the corpora and parse each using all source types, printing one CSV line per run. Corpora whose
+ * production the grammar does not implement (yet) are skipped, with a note on the standard error. */
+int main(int argc, char *argv[]) {
+    int corpus_index, source_index;
+    YIP_ENCODING encoding;
+    if (argc > 2) usage();
+    if (argc == 2 && (corpus_size = atol(argv[1]) * 1024 * 1024) <= 0) usage();
+    printf("corpus,encoding,source,bytes,chars,tokens,seconds,mb_per_s,tokens_per_s,ns_per_char,"
+           "peak_rss_kb,max_frames_depth,status\n");
+    for (corpus_index = 0; corpus_index < (int)(sizeof(corpora) / sizeof(corpora[0])); corpus_index++) {
+        const CORPUS *corpus = corpora + corpus_index;
+        if (!is_implemented(corpus)) {
+            fprintf(stderr, "yip_bench: %s: %s is not implemented\n", corpus->name, corpus->production);
+            continue;
+        }
+        for (encoding = YIP_UTF8; encoding <= (corpus->all_encodings ? YIP_UTF32BE : YIP_UTF8); encoding++) {
+            prepare(corpus, encoding);
+            for (source_index = 0; source_index < (int)(sizeof(sources) / sizeof(sources[0])); source_index++)
+                /* Strings end at the first zero byte, so only make sense for UTF8. */
+                if (encoding == YIP_UTF8 || strcmp(sources[source_index], "str"))
+                    bench(corpus, encoding, sources[source_index]);
+        }
+    }
+    if (unlink(corpus_path) < 0 && errno != ENOENT) die(corpus_path);
+    return 0;
+}
+
+/* }}} */
@@ -0,0 +1,84 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "yip.h"
+
+/* {{{ */
+
+/* Abort execution with errno-based message. */
+static void die(const char *where) {
+    perror(where);
+    exit(1);
+}
+
+/* Split the next dot-separated part of a file name. */
+static char *next_dot(char *text) {
+    assert(text);
+    assert(*text);
+    while (*text != '.') {
+        text++;
+        if (!*text) {
+            errno = EFAULT;
+            die("next_dot");
+        }
+    }
+    *text++ = '\0';
+    return text;
+}
+
+/* Deduce the traced production from an input file name, as yaml2yeast_test does. */
+static YIP_PRODUCTION parse_file_name(char *file) {
+    YIP_PRODUCTION production = { file, NULL, NULL, NULL };
+    char *text = next_dot(file);
+    if (!strncmp(text, "n=", 2)) {
+        production.n = text + 2;
+        text = next_dot(text + 2);
+    }
+    if (!strncmp(text, "c=", 2)) {
+        production.c = text + 2;
+        text = next_dot(text + 2);
+    }
+    if (!strncmp(text, "t=", 2)) {
+        production.t = text + 2;
+        text = next_dot(text + 2);
+    }
+    return production;
+}
+
+/* Aborts execution with a helpful message. */
+static void usage() {
+    fprintf(stderr, "Usage: yip_trace input-file [events] > trace.json\n");
+    exit(1);
+}
+
+/* Parse an input file while tracing, and write the most recent events as Chrome trace JSON. */
+int main(int argc, char *argv[]) {
+    const char *path = argv[1];
+    const char *base;
+    char *file;
+    int capacity = 1000000;
+    YIP_PRODUCTION production;
+    YIP *yip;
+    if (argc < 2 || argc > 3 || (argc == 3 && (capacity = atoi(argv[2])) <= 0)) usage();
+    base = strrchr(path, '/');
+    file = malloc(strlen(base ? base + 1 : path) + 1);
+    if (!file) die("malloc");
+    strcpy(file, base ? base + 1 : path);
+    production = parse_file_name(file);
+    yip = yip_test(yip_path_source(path), 1, &production);
+    if (!yip) die(path);
+    if (yip_trace(yip, capacity) < 0) die("yip_trace");
+    for (;;) {
+        const YIP_TOKEN *token = yip_next_token(yip);
+        if (!token) die(path);
+        if (token->code == YIP_DONE) break;
+    }
+    if (yip_trace_dump(yip, stdout) < 0) die("yip_trace_dump");
+    if (yip_close(yip) < 0) die(path);
+    free(file);
+    return 0;
+}
+
+/* }}} */